@@ -26,6 +26,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 void CL_FinishTimeDemo (void);
 
+cvar_t	cl_demojitter = {"cl_demojitter", "0"};	// seconds demo messages may be held back, to test interpolation
+
 /*
 ==============================================================================
 
@@ -86,6 +88,8 @@ void CL_WriteDemoMessage (void)
 	Sys_FileWrite(cls.demofile, net_message.data, net_message.cursize);
 }
 
+static double	demo_duetime;		// when a held back demo message is let through
+
 /*
 ====================
 CL_GetMessage
@@ -118,8 +122,17 @@ int CL_GetMessage (void)
 			}
 			else if ( /* cl.time > 0 && */ cl.time <= cl.mtime[0])
 			{
+					demo_duetime = 0;
 					return 0;		// don't need another message yet
 			}
+			else if (cl_demojitter.value > 0)
+			{	// make it arrive late, as it might over a bad network
+				if (!demo_duetime)
+					demo_duetime = realtime + cl_demojitter.value * (rand () & 0x7fff) / 0x7fff;
+				if (realtime < demo_duetime)
+					return 0;
+				demo_duetime = 0;
+			}
 		}
 
 	// get the next message
@@ -253,6 +266,7 @@ void CL_Record_f (void)
 
 	Con_Printf ("recording to %s.\n", name);
 	cls.demofile = Sys_FileOpenWrite(name);
+	COM_GameDirWritten ();
 	if (cls.demofile < 0)
 	{
 		Con_Printf ("ERROR: couldn't open demo for writing.\n");
@@ -452,6 +452,20 @@ void CL_SendMove (usercmd_t *cmd)
 
 	cl.cmd = *cmd;
 
+// number the move, if the server predicts with us
+	if (cl.movevars_valid)
+	{
+		MSG_WriteByte (&buf, clc_movesequence);
+		MSG_WriteLong (&buf, cl.movesequence + 1);
+	}
+
+// tell the server which entity frame it can delta from
+	if (cl.delta_acked)
+	{
+		MSG_WriteByte (&buf, clc_deltaack);
+		MSG_WriteLong (&buf, cl.delta_acked);
+	}
+
 // send the movement message
     MSG_WriteByte (&buf, clc_move);
 
@@ -495,6 +509,22 @@ void CL_SendMove (usercmd_t *cmd)
 	{
 		Con_Printf ("CL_SendMove: lost server connection\n");
 		CL_Disconnect ();
+		return;
+	}
+
+// keep it to replay until the server has run it
+	if (cl.movevars_valid)
+	{
+		predictcmd_t	*pcmd;
+
+		cl.movesequence++;
+		pcmd = &cl.predict_cmds[cl.movesequence & (CL_PREDICT_CMDS-1)];
+		pcmd->sequence = cl.movesequence;
+		pcmd->frametime = host_frametime;
+		VectorAdd (cl.viewangles, cl.punchangle, pcmd->angles);
+		pcmd->forwardmove = cmd->forwardmove;
+		pcmd->sidemove = cmd->sidemove;
+		pcmd->buttons = bits;
 	}
 }
 
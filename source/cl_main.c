@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // cl_main.c  -- client main loop
 
 #include "quakedef.h"
+#include "net_sim.h"
 #ifdef HTTP_DOWNLOAD
 #include "curl.h"
 #endif
@@ -33,6 +34,11 @@ cvar_t	cl_color = {"_cl_color", "0", true};
 
 cvar_t	cl_shownet = {"cl_shownet","0"};	// can be 0, 1, or 2
 cvar_t	cl_nolerp = {"cl_nolerp","0"};
+cvar_t	cl_interpdelay = {"cl_interpdelay","0", true};	// seconds entities are drawn behind the newest update, 0 = between the last two
+cvar_t	cl_extrapolate = {"cl_extrapolate","0.05", true};	// longest an entity is carried on past its newest update
+cvar_t	cl_interpstats = {"cl_interpstats","0"};			// measure entity smoothness for interp_stats
+cvar_t	cl_deltaupdates = {"cl_deltaupdates","1", true};	// ask the server for delta compressed entities
+cvar_t	cl_rate = {"cl_rate","0", true};					// bytes a second the server may send, 0 = no limit
 cvar_t  cl_gameplayhack_monster_lerp = {"cl_gameplayhack_monster_lerp","1"};
 
 cvar_t	lookspring = {"lookspring","0", true};
@@ -226,6 +232,73 @@ void CL_Disconnect_f (void)
 }
 
 
+#define	MAX_BENCH_RTTS	8
+
+static char		bench_host[128];
+static int		bench_rtt[MAX_BENCH_RTTS];
+static double	bench_time[MAX_BENCH_RTTS];
+static int		bench_count;		// nonzero while connect_bench is running
+static int		bench_current;
+static float	bench_oldlatency;
+
+/*
+=====================
+CL_ConnectBench_Next
+
+Connects with the next round trip time, or reports once they have all been done
+=====================
+*/
+static void CL_ConnectBench_Next (void)
+{
+	int		i;
+
+	if (bench_current < bench_count)
+	{
+		// the simulator only holds back what this end sends, so the
+		// whole round trip goes on the way out
+		Cvar_SetValueByRef (&net_simlatency, bench_rtt[bench_current]);
+		Cbuf_AddText (va("connect \"%s\"\n", bench_host));
+		return;
+	}
+
+	Con_Printf ("connect times to %s\n", bench_host);
+	for (i = 0 ; i < bench_count ; i++)
+		Con_Printf ("%4i ms rtt: %.2f seconds\n", bench_rtt[i], bench_time[i]);
+
+	Cvar_SetValueByRef (&net_simlatency, bench_oldlatency);
+	bench_count = 0;
+}
+
+/*
+=====================
+CL_ConnectBench_f
+
+connect_bench <host> <rtt ms> [rtt ms ...]
+Times the connection to a server at each simulated round trip time
+=====================
+*/
+static void CL_ConnectBench_f (void)
+{
+	int		i;
+
+	if (Cmd_Argc () < 3)
+	{
+		Con_Printf ("connect_bench <host> <rtt ms> [rtt ms ...] : time connecting to a server through net_simlatency\n");
+		return;
+	}
+
+	if (!bench_count)
+		bench_oldlatency = net_simlatency.value;
+
+	strlcpy (bench_host, Cmd_Argv (1), sizeof(bench_host));
+	bench_count = 0;
+	bench_current = 0;
+	for (i = 2 ; i < Cmd_Argc () && bench_count < MAX_BENCH_RTTS ; i++)
+		bench_rtt[bench_count++] = QMAX(0, atoi (Cmd_Argv (i)));
+
+	CL_ConnectBench_Next ();
+}
+
 /*
 =====================
 CL_EstablishConnection
@@ -243,9 +316,15 @@ void CL_EstablishConnection (char *host)
 
 	CL_Disconnect ();
 
+	cls.connect_starttime = Sys_DoubleTime ();
 	cls.netcon = NET_Connect (host);
 	if (!cls.netcon) // Baker 3.60 - Rook's Qrack port 26000 notification on failure
 	{
+		if (bench_count)
+		{
+			Cvar_SetValueByRef (&net_simlatency, bench_oldlatency);
+			bench_count = 0;
+		}
 		Con_Printf ("\nsyntax: connect server:port (port is optional)\n");//r00k added
 		if (net_hostport != 26000)
 			Con_Printf ("\nTry using port 26000\n");//r00k added
@@ -267,6 +346,7 @@ void CL_EstablishConnection (char *host)
 	cls.demonum = -1;			// not in the demo loop now
 	cls.state = ca_connected;
 	cls.signon = 0;				// need all the signon messages before playing
+	cls.rate_sent = false;
 
 	MSG_WriteByte(&cls.message, clc_nop);	// JPG 3.40 - fix for NAT
 }
@@ -313,6 +393,44 @@ unsigned source_key1 = 0x36117cbd;
 unsigned source_key2 = 0x2e26857c;
 #endif
 
+/*
+=====================
+CL_SendRate
+
+Tells the server how fast it may send, and that bigger datagrams are fine.
+Only a server running this engine acknowledges with NETFLAG_SACK, so
+nothing is sent until one of those has come back.
+=====================
+*/
+void CL_SendRate (void)
+{
+	if (cls.state != ca_connected || cls.demoplayback || !cls.netcon->windowed)
+		return;
+
+	cls.rate_sent = true;
+
+	MSG_WriteByte (&cls.message, clc_stringcmd);
+	MSG_WriteString (&cls.message, va("rate %i %i", (int)cl_rate.value, MAX_EXTDATAGRAM));
+}
+
+/*
+=====================
+CL_SendInterpDelay
+
+Tells the server how far behind the newest update entities are drawn, so
+its lag compensation rewinds traces to what the player sees.  Servers
+that don't know the command just ignore it.
+=====================
+*/
+void CL_SendInterpDelay (void)
+{
+	if (cls.state != ca_connected || cls.demoplayback || sv.active)
+		return;
+
+	MSG_WriteByte (&cls.message, clc_stringcmd);
+	MSG_WriteString (&cls.message, va("interpdelay %g", cl.snapshots && !cl_nolerp.value ? QMAX(cl_interpdelay.value, 0) : 0));
+}
+
 /*
 =====================
 CL_SignonReply
@@ -332,6 +450,20 @@ Con_DPrintf ("CL_SignonReply: %i\n", cls.signon);
 	switch (cls.signon)
 	{
 	case 1:
+		if (cl_deltaupdates.value)
+		{
+			MSG_WriteByte (&cls.message, clc_stringcmd);
+			MSG_WriteString (&cls.message, "deltaupdates 1");
+		}
+		CL_SendRate ();
+		if (cl.snapshots && cl_interpdelay.value > 0)
+			CL_SendInterpDelay ();
+		if (cl_predict.value && !sv.active)
+		{	// nothing to hide on a local server
+			MSG_WriteByte (&cls.message, clc_stringcmd);
+			MSG_WriteString (&cls.message, "predict 1");
+		}
+
 		MSG_WriteByte (&cls.message, clc_stringcmd);
 		MSG_WriteString (&cls.message, "prespawn");
 
@@ -343,6 +475,9 @@ Con_DPrintf ("CL_SignonReply: %i\n", cls.signon);
 		break;
 
 	case 2:
+		if (!cls.rate_sent)
+			CL_SendRate ();		// the server's first acknowledgements are in by now
+
 		MSG_WriteByte (&cls.message, clc_stringcmd);
 		MSG_WriteString (&cls.message, va("name \"%s\"\n", cl_name.string));
 
@@ -399,6 +534,9 @@ Con_DPrintf ("CL_SignonReply: %i\n", cls.signon);
 		break;
 
 	case 3:
+		if (!cls.rate_sent)
+			CL_SendRate ();
+
 		MSG_WriteByte (&cls.message, clc_stringcmd);
 		MSG_WriteString (&cls.message, "begin");
 		Cache_Report ();		// print remaining memory
@@ -411,6 +549,17 @@ Con_DPrintf ("CL_SignonReply: %i\n", cls.signon);
 
 	case 4:
 		SCR_EndLoadingPlaque ();		// allow normal screen updates
+		if (cls.connect_starttime)
+		{
+			cls.connect_time = Sys_DoubleTime () - cls.connect_starttime;
+			cls.connect_starttime = 0;
+			Con_DPrintf ("Connected in %.2f seconds\n", cls.connect_time);
+			if (bench_count)
+			{
+				bench_time[bench_current++] = cls.connect_time;
+				CL_ConnectBench_Next ();
+			}
+		}
 		break;
 	}
 }
@@ -601,6 +750,243 @@ static float	CL_LerpPoint (void)
 	return frac;
 }
 
+/*
+===============================================================================
+
+ENTITY SNAPSHOTS
+
+With cl_interpdelay set, entities are drawn at a server time that trails
+the newest update by that much, on a clock that runs at the local frame
+rate and is only steered gently towards the updates.  An update arriving
+late or early then changes nothing on screen as long as the ones either
+side of the drawn time are in; if none newer is, the entity is carried on
+along its last motion for at most cl_extrapolate seconds.
+
+interp_stats judges the result against the path through every update:
+where the entity was drawn compared to where that path puts it at a
+steadily advancing time.  Play back a recorded demo with cl_demojitter
+to hold messages back at random, and compare cl_interpdelay settings.
+
+===============================================================================
+*/
+
+static	int		interp_samples;
+static	double	interp_sum, interp_sumsq;
+static	float	interp_max;
+
+/*
+===============
+CL_SnapshotLerp
+
+Returns true if the time falls within the updates kept
+===============
+*/
+static qboolean CL_SnapshotLerp (entsnaps_t *s, float time, vec3_t origin, vec3_t angles, float extrapolate)
+{
+	entsnap_t	*newer, *older;
+	int			i, j;
+	float		f, d;
+
+	newer = &s->snaps[s->head];
+	if (time >= newer->time || s->count < 2)
+	{
+		VectorCopy (newer->origin, origin);
+		VectorCopy (newer->angles, angles);
+		if (time <= newer->time || s->count < 2)
+			return time == newer->time;
+
+	// late: keep going the way it was
+		older = &s->snaps[(s->head - 1) & (CL_SNAPSHOTS-1)];
+		f = time - newer->time;
+		if (f > extrapolate)
+			f = extrapolate;
+		f /= newer->time - older->time;
+		for (j=0 ; j<3 ; j++)
+			origin[j] += f * (newer->origin[j] - older->origin[j]);
+		return false;
+	}
+
+	for (i=1 ; i<s->count ; i++)
+	{
+		older = &s->snaps[(s->head - i) & (CL_SNAPSHOTS-1)];
+		if (older->time <= time)
+		{
+			f = (time - older->time) / (newer->time - older->time);
+			for (j=0 ; j<3 ; j++)
+			{
+				origin[j] = older->origin[j] + f * (newer->origin[j] - older->origin[j]);
+
+				d = newer->angles[j] - older->angles[j];
+				if (d > 180)
+					d -= 360;
+				else if (d < -180)
+					d += 360;
+				angles[j] = older->angles[j] + f * d;
+			}
+			return true;
+		}
+		newer = older;
+	}
+
+// older than anything kept
+	VectorCopy (newer->origin, origin);
+	VectorCopy (newer->angles, angles);
+	return false;
+}
+
+/*
+===============
+CL_InterpSample
+
+Scores a drawn position once the updates around its time are in
+===============
+*/
+static qboolean CL_InterpSample (entsnaps_t *s, float time, vec3_t origin)
+{
+	vec3_t		truth, angles, delta;
+	float		error;
+
+	if (!CL_SnapshotLerp (s, time, truth, angles, 0))
+		return false;
+
+	VectorSubtract (origin, truth, delta);
+	error = VectorLength (delta);
+	interp_samples++;
+	interp_sum += error;
+	interp_sumsq += error * error;
+	if (error > interp_max)
+		interp_max = error;
+
+	return true;
+}
+
+/*
+===============
+CL_InterpChanged
+
+The entity histories are allocated at level load, so cl_interpdelay and
+cl_interpstats can't be turned on in the middle of a level that started
+without them
+===============
+*/
+void CL_InterpChanged (void)
+{
+	if (cls.state != ca_connected)
+		return;
+	if (cl.snapshots)
+	{
+		CL_SendInterpDelay ();
+		return;
+	}
+	if (cl_interpdelay.value <= 0 && !cl_interpstats.value)
+		return;
+
+	Con_Printf ("cl_interpdelay and cl_interpstats take effect from the next level\n");
+	Cvar_SetValueByRef (cl_interpdelay.value > 0 ? &cl_interpdelay : &cl_interpstats, 0);
+}
+
+/*
+===============
+CL_PushSnapshot
+
+Called by the parser after an entity's update has been read
+===============
+*/
+void CL_PushSnapshot (int num, qboolean reset)
+{
+	entsnaps_t	*s;
+	entity_t	*ent = &cl_entities[num];
+	entsnap_t	*snap;
+	int			j;
+
+	if (!cl.snapshots)
+		return;
+	s = &cl.snapshots[num];
+
+	if (s->count)
+	{
+		snap = &s->snaps[s->head];
+		if (cl.mtime[0] < snap->time)
+			reset = true;		// demo rewind
+		for (j=0 ; j<3 ; j++)
+			if (ent->msg_origins[0][j] - snap->origin[j] > 100 || ent->msg_origins[0][j] - snap->origin[j] < -100)
+				reset = true;	// teleported, don't lerp across it
+	}
+
+	if (reset)
+	{
+		s->count = 0;
+		s->sampletime = 0;
+	}
+
+	if (!s->count || cl.mtime[0] != s->snaps[s->head].time)
+	{
+		s->head = (s->head + 1) & (CL_SNAPSHOTS-1);
+		if (s->count < CL_SNAPSHOTS)
+			s->count++;
+	}
+	snap = &s->snaps[s->head];
+	snap->time = cl.mtime[0];
+	VectorCopy (ent->msg_origins[0], snap->origin);
+	VectorCopy (ent->msg_angles[0], snap->angles);
+
+	if (s->sampletime && CL_InterpSample (s, s->sampletime, s->sampleorigin))
+		s->sampletime = 0;
+}
+
+/*
+===============
+CL_SnapshotClock
+
+Moves the time entities are drawn at on by a frame, and steers it towards
+cl_interpdelay behind the newest update
+===============
+*/
+static void CL_SnapshotClock (void)
+{
+	double	target, diff;
+
+	if (cl.paused)
+		return;
+
+	target = cl.mtime[0] - cl_interpdelay.value;
+	cl.snaptime += host_frametime;
+	diff = target - cl.snaptime;
+
+	if (diff > 0.25 || diff < -0.25)
+		cl.snaptime = target;	// level start, a long stall or a change of delay
+	else
+		cl.snaptime += diff * QMIN(host_frametime * 2, 1);
+}
+
+/*
+===============
+CL_InterpStats_f
+===============
+*/
+static void CL_InterpStats_f (void)
+{
+	if (Cmd_Argc () > 1 && !strcmp (Cmd_Argv (1), "reset"))
+	{
+		interp_samples = 0;
+		interp_sum = interp_sumsq = 0;
+		interp_max = 0;
+		return;
+	}
+
+	if (!cl_interpstats.value)
+		Con_Printf ("set cl_interpstats 1 to measure\n");
+	if (!interp_samples)
+	{
+		Con_Printf ("no samples\n");
+		return;
+	}
+
+	Con_Printf ("entity position error, %i samples\n", interp_samples);
+	Con_Printf ("mean %.2f  rms %.2f  max %.1f units\n", interp_sum / interp_samples,
+		sqrt (interp_sumsq / interp_samples), interp_max);
+}
+
 #ifdef PROQUAKE_EXTENSION
 extern cvar_t pq_timer; // JPG - need this for CL_RelinkEntities
 #endif
@@ -617,10 +1003,29 @@ static void CL_RelinkEntities (void)
 	float		frac, f, d, bobjrotate;
 	vec3_t		delta, oldorg;
 	dlight_t	*dl;
+	qboolean	snapshots;
+	double		lag, reftime;
+	entsnaps_t	*s;
 
 // determine partial update time
 	frac = CL_LerpPoint ();
 
+	snapshots = cl_interpdelay.value > 0 && cl.snapshots && !sv.active && !cls.timedemo && !cl_nolerp.value;
+	if (snapshots)
+		CL_SnapshotClock ();
+
+// the steady time positions are judged at, for interp_stats
+	reftime = 0;
+	if (cl_interpstats.value && cl.snapshots)
+	{
+		lag = realtime - (snapshots ? cl.snaptime : cl.mtime[1] + frac * (cl.mtime[0] - cl.mtime[1]));
+		if (!cl.interplag || fabs (lag - cl.interplag) > 1)
+			cl.interplag = lag;
+		else
+			cl.interplag += (lag - cl.interplag) * QMIN(host_frametime / 2, 1);
+		reftime = realtime - cl.interplag;
+	}
+
 #ifdef PROQUAKE_EXTENSION
 // JPG - check to see if we need to update the status bar
 	if (pq_timer.value && ((int) cl.time != (int) cl.oldtime))
@@ -694,6 +1099,10 @@ static void CL_RelinkEntities (void)
 			VectorCopy (ent->msg_origins[0], ent->origin);
 			VectorCopy (ent->msg_angles[0], ent->angles);
 		}
+		else if (snapshots && cl.snapshots[i].count)
+		{
+			CL_SnapshotLerp (&cl.snapshots[i], cl.snaptime, ent->origin, ent->angles, cl_extrapolate.value);
+		}
 		else
 		{	// if the delta is large, assume a teleport and don't lerp
 			f = frac;
@@ -730,6 +1139,16 @@ static void CL_RelinkEntities (void)
 
 		}
 
+		if (reftime && i != cl.viewentity && !CL_InterpSample (&cl.snapshots[i], reftime, ent->origin))
+		{	// judge it when the next update is in
+			s = &cl.snapshots[i];
+			if (reftime > s->snaps[s->head].time)
+			{
+				s->sampletime = reftime;
+				VectorCopy (ent->origin, s->sampleorigin);
+			}
+		}
+
 // rotate binary objects locally
 		if (ent->model->flags & EF_ROTATE)
 		{
@@ -932,6 +1351,7 @@ int CL_ReadFromServer (void)
 		Con_Printf ("\n");
 
 	CL_RelinkEntities ();
+	CL_PredictMove ();
 	CL_UpdateTEnts ();
 
 // bring the links up to date
@@ -1167,6 +1587,7 @@ void CL_Init (void)
 
 	CL_InitInput ();
 	CL_InitTEnts ();
+	CL_InitPrediction ();
 
 // register our commands
 	Cvar_RegisterVariable (&cl_name, NULL);
@@ -1181,6 +1602,12 @@ void CL_Init (void)
 	Cvar_RegisterVariable (&cl_anglespeedkey, NULL);
 	Cvar_RegisterVariable (&cl_shownet, NULL);
 	Cvar_RegisterVariable (&cl_nolerp, NULL);
+	Cvar_RegisterVariable (&cl_interpdelay, CL_InterpChanged);
+	Cvar_RegisterVariable (&cl_extrapolate, NULL);
+	Cvar_RegisterVariable (&cl_interpstats, CL_InterpChanged);
+	Cvar_RegisterVariable (&cl_demojitter, NULL);
+	Cvar_RegisterVariable (&cl_deltaupdates, NULL);
+	Cvar_RegisterVariable (&cl_rate, CL_SendRate);
 	Cvar_RegisterVariable (&lookspring, NULL);
 	Cvar_RegisterVariable (&lookstrafe, NULL);
 	Cvar_RegisterVariable (&sensitivity, NULL);
@@ -1214,6 +1641,8 @@ void CL_Init (void)
 	Cvar_RegisterVariable (&cl_bobbing, NULL);
 
 	Cmd_AddCommand ("entities", CL_PrintEntities_f);
+	Cmd_AddCommand ("interp_stats", CL_InterpStats_f);
+	Cmd_AddCommand ("connect_bench", CL_ConnectBench_f);
 	Cmd_AddCommand ("disconnect", CL_Disconnect_f);
 	Cmd_AddCommand ("record", CL_Record_f);
 	Cmd_AddCommand ("stop", CL_Stop_f);
@@ -76,6 +76,9 @@ char *svc_strings[] =
 	"",
 	"",
 	"svc_fog", // 41		// [byte] start [byte] end [byte] red [byte] green [byte] blue [float] time
+	"svc_deltapacket", // 42	// [long] sequence [long] delta base, then entity updates
+	"svc_moveack", // 43	// [long] move sequence [byte] flags [coord3] origin [short3] velocity
+	"svc_movevars", // 44	// [float] gravity friction edgefriction stopspeed maxspeed accelerate
 };
 
 //=============================================================================
@@ -189,6 +192,7 @@ static void CL_KeepaliveMessage (void)
 		}
 	} while (ret);
 
+	old.data = net_message.data;	// the loopback may have swapped buffers
 	net_message = old;
 	memcpy_vfpu(net_message.data, olddata, net_message.cursize);
 
@@ -244,6 +248,7 @@ static void CL_ParseServerInfo (void)
 	int		i, nummodels, numsounds;
 	char	model_precache[MAX_MODELS][MAX_QPATH];
 	char	sound_precache[MAX_SOUNDS][MAX_QPATH];
+	double	start, modeltime, soundtime;
 
 #ifdef HTTP_DOWNLOAD
 	extern cvar_t cl_web_download;
@@ -273,6 +278,10 @@ static void CL_ParseServerInfo (void)
 	}
 	cl.scores = Hunk_AllocName (cl.maxclients*sizeof(*cl.scores), "scores");
 
+// the entity histories are only worth their memory when something reads them
+	if (cl_interpdelay.value > 0 || cl_interpstats.value)
+		cl.snapshots = Hunk_AllocName (MAX_EDICTS*sizeof(entsnaps_t), "snapshot");
+
 // parse gametype
 	cl.gametype = MSG_ReadByte ();
 
@@ -286,7 +295,9 @@ static void CL_ParseServerInfo (void)
 
 // first we go through and touch all of the precache data that still
 // happens to be in the cache, so precaching something else doesn't
-// needlessly purge it
+// needlessly purge it; whatever isn't is read ahead in the background
+// while the loaders below work through the lists
+	COM_BeginPrefetch (MAX_MODELS + MAX_SOUNDS);
 
 // precache models
 	memset (cl.model_precache, 0, sizeof(cl.model_precache));
@@ -301,7 +312,8 @@ static void CL_ParseServerInfo (void)
 			return;
 		}
 		strcpy (model_precache[nummodels], str);
-		Mod_TouchModel (str);
+		if (!Mod_TouchModel (str) && str[0] != '*')
+			COM_PrefetchFile (str);
 	}
 
 // precache sounds
@@ -318,16 +330,19 @@ static void CL_ParseServerInfo (void)
 		}
 
 		strcpy (sound_precache[numsounds], str);
-		S_TouchSound (str);
+		if (!S_TouchSound (str))
+			COM_PrefetchFile (va("sound/%s", str));
 	}
 
 	{
 		char	mapname[MAX_QPATH];
 		COM_StripExtension (COM_SkipPath(model_precache[1]), mapname);
 		R_PreMapLoad (mapname);
+		Memory_NameMap (mapname);
 	}
 
 // now we try to load everything else until a cache allocation fails
+	start = Sys_DoubleTime ();
 	for (i=1 ; i<nummodels ; i++)
 	{
 		cl.model_precache[i] = Mod_ForName (model_precache[i], false);
@@ -379,6 +394,7 @@ static void CL_ParseServerInfo (void)
 					//Rename the .tmp file to the final precache filename
 					snprintf (download_finalname, sizeof(download_finalname), "%s/%s", com_gamedir, model_precache[i]);
 					rename (download_tempname, download_finalname);
+					COM_GameDirWritten ();
 
 					free(download_tempname);  // Baker: ... uh?
 					free(download_finalname); // Baker: ... uh?
@@ -412,6 +428,9 @@ static void CL_ParseServerInfo (void)
 		CL_KeepaliveMessage ();
 	}
 
+	modeltime = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
 	S_BeginPrecaching ();
 	for (i=1 ; i<numsounds ; i++)
 	{
@@ -420,6 +439,11 @@ static void CL_ParseServerInfo (void)
 		CL_KeepaliveMessage ();
 	}
 	S_EndPrecaching ();
+	soundtime = Sys_DoubleTime () - start;
+
+	COM_EndPrefetch ();
+	Con_Printf ("Map load %.0f ms: %i models %.0f, %i sounds %.0f\n",
+		(modeltime + soundtime) * 1000, nummodels - 1, modeltime * 1000, numsounds - 1, soundtime * 1000);
 
 // local state
 	cl_entities[0].model = cl.worldmodel = cl.model_precache[1];
@@ -670,6 +694,267 @@ if (bits&(1<<i))
 		VectorCopy (ent->msg_angles[0], ent->angles);
 		ent->forcelink = true;
 	}
+
+	CL_PushSnapshot (num, forcelink);
+}
+
+/*
+==================
+CL_DeltaFromBaseline
+==================
+*/
+static void CL_DeltaFromBaseline (int num, entity_delta_t *to)
+{
+	int			i;
+	entity_t	*ent;
+
+	ent = CL_EntityNum (num);
+
+	to->number = num;
+	for (i=0 ; i<3 ; i++)
+	{
+		to->origin[i] = (int)floor(ent->baseline.origin[i]*8 + 0.5);
+		to->angles[i] = (int)floor(ent->baseline.angles[i]*256/360 + 0.5) & 255;
+	}
+	to->modelindex = ent->baseline.modelindex;
+	to->frame = ent->baseline.frame;
+	to->colormap = ent->baseline.colormap;
+	to->skin = ent->baseline.skin;
+	to->effects = 0;
+	to->step = 0;
+}
+
+/*
+==================
+CL_RelinkDeltaEntity
+
+Same as the tail of CL_ParseUpdate, for a state out of a delta frame
+==================
+*/
+static void CL_RelinkDeltaEntity (entity_delta_t *state)
+{
+	int			i;
+	model_t		*model;
+	qboolean	forcelink;
+	entity_t	*ent;
+
+	ent = CL_EntityNum (state->number);
+
+	if (ent->msgtime != cl.mtime[1])
+		forcelink = true;	// no previous frame to lerp from
+	else
+		forcelink = false;
+
+	ent->msgtime = cl.mtime[0];
+
+	model = cl.model_precache[state->modelindex];
+	if (model != ent->model)
+	{
+		ent->model = model;
+	// automatic animation (torches, etc) can be either all together or randomized
+		if (model)
+		{
+			if (model->synctype == ST_RAND)
+				ent->syncbase = (float)(rand()&0x7fff) / 0x7fff;
+			else
+				ent->syncbase = 0.0;
+		}
+		else
+			forcelink = true;	// hack to make null model players work
+	}
+
+	ent->frame = state->frame;
+
+	if (!state->colormap)
+		ent->colormap = vid.colormap;
+	else
+	{
+		if (state->colormap > cl.maxclients)
+			Sys_Error ("i >= cl.maxclients");
+		ent->colormap = cl.scores[state->colormap-1].translations;
+	}
+
+	ent->skinnum = state->skin;
+	ent->effects = state->effects;
+
+// shift the known values for interpolation
+	VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
+	VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
+
+	for (i=0 ; i<3 ; i++)
+	{
+		ent->msg_origins[0][i] = state->origin[i] * (1.0/8);
+		ent->msg_angles[0][i] = (signed char)state->angles[i] * (360.0/256);
+	}
+
+	if (state->step)
+	{
+		extern cvar_t cl_gameplayhack_monster_lerp;
+
+		if (!cl_gameplayhack_monster_lerp.value)
+			ent->forcelink = true;
+		else
+			ent->forcelink = (sv.active == true); // Baker: single player behavior varies from client-only behavior
+	}
+
+	if ( forcelink )
+	{	// didn't have an update last message
+		VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
+		VectorCopy (ent->msg_origins[0], ent->origin);
+		VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
+		VectorCopy (ent->msg_angles[0], ent->angles);
+		ent->forcelink = true;
+	}
+
+	CL_PushSnapshot (state->number, forcelink);
+}
+
+/*
+==================
+CL_ParseDeltaPacket
+
+Entity updates encoded against a frame we already acknowledged.  If that
+frame is gone the packet is read and thrown away, and the server falls back
+to a complete frame once our acknowledgements stop moving.
+==================
+*/
+static int		cl_deltabase[MAX_EDICTS];			// index+1 into the base frame, by entity number
+static qboolean	cl_deltatouched[MAX_DELTA_ENTITIES];	// base frame entries the packet mentioned
+
+static void CL_ParseDeltaPacket (void)
+{
+	int				i, bits, num, idx, sequence, basesequence;
+	qboolean		valid;
+	delta_frame_t	*frame, *base;
+	entity_delta_t	*to, discard;
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	sequence = MSG_ReadLong ();
+	basesequence = MSG_ReadLong ();
+
+	frame = &cl.delta_frames[sequence & UPDATE_MASK];
+	base = NULL;
+	valid = (sequence > cl.delta_acked);
+	if (valid && basesequence)
+	{
+		base = &cl.delta_frames[basesequence & UPDATE_MASK];
+		if (base->sequence != basesequence || sequence - basesequence >= UPDATE_BACKUP)
+			valid = false;
+	}
+
+	if (valid)
+	{
+		frame->num_entities = 0;
+		if (base)
+		{
+			for (i=0 ; i<base->num_entities ; i++)
+			{
+				cl_deltabase[base->entities[i].number] = i + 1;
+				cl_deltatouched[i] = false;
+			}
+		}
+	}
+
+	while (1)
+	{
+		bits = MSG_ReadByte ();
+		if (msg_badread)
+			Host_Error ("CL_ParseDeltaPacket: unterminated packet");
+		if (!bits)
+			break;
+
+		if (bits & U_MOREBITS)
+			bits |= MSG_ReadByte () << 8;
+
+		if (bits & U_LONGENTITY)
+			num = MSG_ReadShort ();
+		else
+			num = MSG_ReadByte ();
+
+		if (num < 0 || num >= MAX_EDICTS)
+			Host_Error ("CL_ParseDeltaPacket: %i is an invalid number", num);
+
+		idx = (valid && base) ? cl_deltabase[num] : 0;
+		if (idx)
+			cl_deltatouched[idx - 1] = true;
+
+		if (bits & U_REMOVE)
+			continue;
+
+		if (!valid)
+			to = &discard;
+		else if (frame->num_entities == MAX_DELTA_ENTITIES)
+			Host_Error ("CL_ParseDeltaPacket: too many entities");
+		else
+			to = &frame->entities[frame->num_entities++];
+
+		if (idx)
+			*to = base->entities[idx - 1];
+		else
+			CL_DeltaFromBaseline (num, to);
+
+		if (bits & U_MODEL)
+			to->modelindex = MSG_ReadByte ();
+		if (bits & U_FRAME)
+			to->frame = MSG_ReadByte ();
+		if (bits & U_COLORMAP)
+			to->colormap = MSG_ReadByte ();
+		if (bits & U_SKIN)
+			to->skin = MSG_ReadByte ();
+		if (bits & U_EFFECTS)
+			to->effects = MSG_ReadByte ();
+		if (bits & U_ORIGIN1)
+			to->origin[0] = MSG_ReadShort ();
+		if (bits & U_ANGLE1)
+			to->angles[0] = MSG_ReadByte ();
+		if (bits & U_ORIGIN2)
+			to->origin[1] = MSG_ReadShort ();
+		if (bits & U_ANGLE2)
+			to->angles[1] = MSG_ReadByte ();
+		if (bits & U_ORIGIN3)
+			to->origin[2] = MSG_ReadShort ();
+		if (bits & U_ANGLE3)
+			to->angles[2] = MSG_ReadByte ();
+		to->step = (bits & U_STEP) != 0;
+	}
+
+	if (!valid)
+	{
+		Con_DPrintf ("CL_ParseDeltaPacket: can't delta frame %i from %i\n", sequence, basesequence);
+
+	// keep showing the last good frame rather than letting everything blink out
+		frame = &cl.delta_frames[cl.delta_acked & UPDATE_MASK];
+		if (!cl.delta_acked || frame->sequence != cl.delta_acked)
+			return;
+	}
+	else
+	{
+	// whatever the packet didn't mention is unchanged
+		if (base)
+		{
+			for (i=0 ; i<base->num_entities ; i++)
+			{
+				if (!cl_deltatouched[i])
+				{
+					if (frame->num_entities == MAX_DELTA_ENTITIES)
+						Host_Error ("CL_ParseDeltaPacket: too many entities");
+					frame->entities[frame->num_entities++] = base->entities[i];
+				}
+				cl_deltabase[base->entities[i].number] = 0;
+			}
+		}
+
+		frame->sequence = sequence;
+		cl.delta_acked = sequence;
+	}
+
+	for (i=0 ; i<frame->num_entities ; i++)
+		CL_RelinkDeltaEntity (&frame->entities[i]);
 }
 
 /*
@@ -1479,6 +1764,30 @@ void CL_ParseServerMessage (void)
 		case svc_fog:
 			//Fog_ParseServerMessage ();
 			break;
+
+		case svc_deltapacket:
+			CL_ParseDeltaPacket ();
+			break;
+
+		case svc_moveack:
+			cl.moveack.sequence = MSG_ReadLong ();
+			cl.moveack.flags = MSG_ReadByte ();
+			for (i=0 ; i<3 ; i++)
+				cl.moveack.origin[i] = MSG_ReadCoord ();
+			for (i=0 ; i<3 ; i++)
+				cl.moveack.velocity[i] = MSG_ReadShort ();
+			cl.moveack_valid = true;
+			break;
+
+		case svc_movevars:
+			cl.movevars.gravity = MSG_ReadFloat ();
+			cl.movevars.friction = MSG_ReadFloat ();
+			cl.movevars.edgefriction = MSG_ReadFloat ();
+			cl.movevars.stopspeed = MSG_ReadFloat ();
+			cl.movevars.maxspeed = MSG_ReadFloat ();
+			cl.movevars.accelerate = MSG_ReadFloat ();
+			cl.movevars_valid = true;
+			break;
 		}
 	}
 }
@@ -0,0 +1,613 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// cl_pred.c -- client side prediction of the local player's movement
+//
+// Each frame the player is put back where the last svc_moveack says the
+// server had it, and every move sent since is run again on top of that with
+// the same acceleration and friction code the server uses (sv_user.c), and
+// a copy of its slide move (sv_phys.c) that clips against the world and the
+// brush models the client knows about.  Other players and monsters aren't
+// clipped against, so running into them is corrected when the server's
+// answer comes back; corrections are spread over a few frames.
+
+#include "quakedef.h"
+
+cvar_t	cl_predict = {"cl_predict", "1", true};	// predict our own movement on remote servers
+
+typedef struct
+{
+	vec3_t		origin;
+	vec3_t		velocity;
+	qboolean	onground;
+	qboolean	jumpreleased;
+} predictstate_t;
+
+static	vec3_t	player_mins = {-16, -16, -24};
+
+#define	PREDICT_SNAP		64			// corrections bigger than this aren't smoothed
+#define	PREDICT_SMOOTH		0.1			// seconds a correction is spread over
+
+/*
+===============================================================================
+
+TRACING
+
+===============================================================================
+*/
+
+/*
+==================
+CL_ClipToHull
+
+Clips the move against one hull placed at offset, keeping the nearest hit
+the way SV_ClipToLinks does
+==================
+*/
+static void CL_ClipToHull (hull_t *hull, vec3_t offset, vec3_t start, vec3_t end, trace_t *trace)
+{
+	trace_t	clip;
+	vec3_t	start_l, end_l;
+
+	memset (&clip, 0, sizeof(clip));
+	clip.fraction = 1;
+	clip.allsolid = true;
+	VectorCopy (end, clip.endpos);
+
+	VectorSubtract (start, offset, start_l);
+	VectorSubtract (end, offset, end_l);
+	SV_RecursiveHullCheck (hull, hull->firstclipnode, start_l, end_l, &clip);
+	if (clip.fraction != 1)
+		VectorAdd (clip.endpos, offset, clip.endpos);
+
+	if (clip.allsolid || clip.startsolid || clip.fraction < trace->fraction)
+	{
+		if (trace->startsolid)
+		{
+			*trace = clip;
+			trace->startsolid = true;
+		}
+		else
+			*trace = clip;
+	}
+	else if (clip.startsolid)
+		trace->startsolid = true;
+}
+
+/*
+==================
+CL_PredictTrace
+
+Hull 1 is the player's box, hull 0 a point.  Rotated brush models are left
+to the server.
+==================
+*/
+static trace_t CL_PredictTrace (vec3_t start, vec3_t end, int hullnum)
+{
+	trace_t		trace;
+	entity_t	*ent;
+	int			i;
+
+	memset (&trace, 0, sizeof(trace));
+	trace.fraction = 1;
+	trace.allsolid = true;
+	VectorCopy (end, trace.endpos);
+
+	SV_RecursiveHullCheck (&cl.worldmodel->hulls[hullnum], cl.worldmodel->hulls[hullnum].firstclipnode, start, end, &trace);
+
+	for (i=1, ent=cl_entities+1 ; i<cl.num_entities ; i++, ent++)
+	{
+		if (i == cl.viewentity || !ent->model || ent->model->type != mod_brush || ent->model->name[0] != '*')
+			continue;
+		if (ent->angles[0] || ent->angles[1] || ent->angles[2])
+			continue;
+		CL_ClipToHull (&ent->model->hulls[hullnum], ent->origin, start, end, &trace);
+	}
+
+	return trace;
+}
+
+/*
+===============================================================================
+
+PLAYER MOVEMENT
+
+A copy of SV_WalkMove and what it calls, working on a predictstate_t
+instead of an edict.
+
+===============================================================================
+*/
+
+#define	MAX_CLIP_PLANES	5
+#define	STEPSIZE		18
+
+static int CL_PredictFlyMove (predictstate_t *state, float time, trace_t *steptrace)
+{
+	int			i, j, bumpcount, numplanes, blocked;
+	vec3_t		dir, planes[MAX_CLIP_PLANES], primal_velocity, original_velocity, new_velocity, end;
+	float		d, time_left;
+	trace_t		trace;
+
+	blocked = 0;
+	VectorCopy (state->velocity, original_velocity);
+	VectorCopy (state->velocity, primal_velocity);
+	numplanes = 0;
+
+	time_left = time;
+
+	for (bumpcount=0 ; bumpcount<4 ; bumpcount++)
+	{
+		if (!state->velocity[0] && !state->velocity[1] && !state->velocity[2])
+			break;
+
+		for (i=0 ; i<3 ; i++)
+			end[i] = state->origin[i] + time_left * state->velocity[i];
+
+		trace = CL_PredictTrace (state->origin, end, 1);
+
+		if (trace.allsolid)
+		{	// trapped
+			VectorCopy (vec3_origin, state->velocity);
+			return 3;
+		}
+
+		if (trace.fraction > 0)
+		{
+			VectorCopy (trace.endpos, state->origin);
+			VectorCopy (state->velocity, original_velocity);
+			numplanes = 0;
+		}
+
+		if (trace.fraction == 1)
+			 break;
+
+		if (trace.plane.normal[2] > 0.7)
+		{
+			blocked |= 1;		// floor
+			state->onground = true;
+		}
+		if (!trace.plane.normal[2])
+		{
+			blocked |= 2;		// step
+			if (steptrace)
+				*steptrace = trace;
+		}
+
+		time_left -= time_left * trace.fraction;
+
+		if (numplanes >= MAX_CLIP_PLANES)
+		{
+			VectorCopy (vec3_origin, state->velocity);
+			return 3;
+		}
+
+		VectorCopy (trace.plane.normal, planes[numplanes]);
+		numplanes++;
+
+		for (i=0 ; i<numplanes ; i++)
+		{
+			ClipVelocity (original_velocity, planes[i], new_velocity, 1);
+			for (j=0 ; j<numplanes ; j++)
+				if (j != i && DotProduct (new_velocity, planes[j]) < 0)
+					break;
+			if (j == numplanes)
+				break;
+		}
+
+		if (i != numplanes)
+		{
+			VectorCopy (new_velocity, state->velocity);
+		}
+		else
+		{
+			if (numplanes != 2)
+			{
+				VectorCopy (vec3_origin, state->velocity);
+				return 7;
+			}
+			CrossProduct (planes[0], planes[1], dir);
+			d = DotProduct (dir, state->velocity);
+			VectorScale (dir, d, state->velocity);
+		}
+
+		if (DotProduct (state->velocity, primal_velocity) <= 0)
+		{
+			VectorCopy (vec3_origin, state->velocity);
+			return blocked;
+		}
+	}
+
+	return blocked;
+}
+
+static trace_t CL_PredictPush (predictstate_t *state, vec3_t push)
+{
+	trace_t	trace;
+	vec3_t	end;
+
+	VectorAdd (state->origin, push, end);
+	trace = CL_PredictTrace (state->origin, end, 1);
+	VectorCopy (trace.endpos, state->origin);
+
+	return trace;
+}
+
+static void CL_PredictWallFriction (predictstate_t *state, vec3_t v_angle, trace_t *trace)
+{
+	vec3_t		forward, right, up, into, side;
+	float		d, i;
+
+	AngleVectors (v_angle, forward, right, up);
+	d = DotProduct (trace->plane.normal, forward) + 0.5;
+	if (d >= 0)
+		return;
+
+	i = DotProduct (trace->plane.normal, state->velocity);
+	VectorScale (trace->plane.normal, i, into);
+	VectorSubtract (state->velocity, into, side);
+
+	state->velocity[0] = side[0] * (1 + d);
+	state->velocity[1] = side[1] * (1 + d);
+}
+
+static int CL_PredictUnstick (predictstate_t *state, vec3_t oldvel)
+{
+	static	float	nudge[8][2] = {{2, 0}, {0, 2}, {-2, 0}, {0, -2}, {2, 2}, {-2, 2}, {2, -2}, {-2, -2}};
+	int		i, clip;
+	vec3_t	oldorg, dir;
+	trace_t	steptrace;
+
+	VectorCopy (state->origin, oldorg);
+
+	for (i=0 ; i<8 ; i++)
+	{
+		dir[0] = nudge[i][0];
+		dir[1] = nudge[i][1];
+		dir[2] = 0;
+		CL_PredictPush (state, dir);
+
+		state->velocity[0] = oldvel[0];
+		state->velocity[1] = oldvel[1];
+		state->velocity[2] = 0;
+		clip = CL_PredictFlyMove (state, 0.1, &steptrace);
+
+		if (fabsf(oldorg[1] - state->origin[1]) > 4 || fabsf(oldorg[0] - state->origin[0]) > 4)
+			return clip;
+
+		VectorCopy (oldorg, state->origin);
+	}
+
+	VectorCopy (vec3_origin, state->velocity);
+	return 7;
+}
+
+static void CL_PredictWalkMove (predictstate_t *state, vec3_t v_angle, float frametime)
+{
+	vec3_t		upmove, downmove, oldorg, oldvel, nosteporg, nostepvel;
+	int			clip;
+	qboolean	oldonground;
+	trace_t		steptrace, downtrace;
+
+	oldonground = state->onground;
+	state->onground = false;
+
+	VectorCopy (state->origin, oldorg);
+	VectorCopy (state->velocity, oldvel);
+
+	clip = CL_PredictFlyMove (state, frametime, &steptrace);
+
+	if (!(clip & 2) || !oldonground)
+		return;
+
+	VectorCopy (state->origin, nosteporg);
+	VectorCopy (state->velocity, nostepvel);
+
+// try moving up and forward to go up a step
+	VectorCopy (oldorg, state->origin);
+
+	VectorCopy (vec3_origin, upmove);
+	VectorCopy (vec3_origin, downmove);
+	upmove[2] = STEPSIZE;
+	downmove[2] = -STEPSIZE + oldvel[2]*frametime;
+
+	CL_PredictPush (state, upmove);
+
+	state->velocity[0] = oldvel[0];
+	state->velocity[1] = oldvel[1];
+	state->velocity[2] = 0;
+	clip = CL_PredictFlyMove (state, frametime, &steptrace);
+
+	if (clip)
+	{
+		if (fabsf(oldorg[1] - state->origin[1]) < 0.03125 && fabsf(oldorg[0] - state->origin[0]) < 0.03125)
+			clip = CL_PredictUnstick (state, oldvel);
+	}
+
+	if (clip & 2)
+		CL_PredictWallFriction (state, v_angle, &steptrace);
+
+	downtrace = CL_PredictPush (state, downmove);
+
+	if (downtrace.plane.normal[2] > 0.7)
+	{
+		state->onground = true;
+	}
+	else
+	{
+		VectorCopy (nosteporg, state->origin);
+		VectorCopy (nostepvel, state->velocity);
+	}
+}
+
+/*
+==================
+CL_PredictFriction
+
+SV_UserFriction, with the drop-off test done against the world
+==================
+*/
+static void CL_PredictFriction (predictstate_t *state, float frametime)
+{
+	float	*vel, speed, friction;
+	vec3_t	start, stop;
+	trace_t	trace;
+
+	vel = state->velocity;
+
+	speed = sqrtf(vel[0]*vel[0] +vel[1]*vel[1]);
+	if (!speed)
+		return;
+
+	start[0] = stop[0] = state->origin[0] + vel[0]/speed*16;
+	start[1] = stop[1] = state->origin[1] + vel[1]/speed*16;
+	start[2] = state->origin[2] + player_mins[2];
+	stop[2] = start[2] - 34;
+
+	trace = CL_PredictTrace (start, stop, 0);
+
+	friction = cl.movevars.friction;
+	if (trace.fraction == 1.0)
+		friction *= cl.movevars.edgefriction;
+
+	SV_ApplyFriction (vel, friction, cl.movevars.stopspeed, frametime);
+}
+
+/*
+==================
+CL_PredictCmd
+
+One move, in the order the server runs it: SV_ClientThink's acceleration,
+then PlayerPreThink's jump, gravity and the slide move
+==================
+*/
+static void CL_PredictCmd (predictstate_t *state, predictcmd_t *cmd)
+{
+	vec3_t		angles, forward, right, up, wishvel, wishdir;
+	float		wishspeed;
+	int			i;
+
+	angles[PITCH] = -cmd->angles[PITCH]/3;
+	angles[YAW] = cmd->angles[YAW];
+	angles[ROLL] = 0;
+	angles[ROLL] = V_CalcRoll (angles, state->velocity)*4;
+
+	AngleVectors (angles, forward, right, up);
+	for (i=0 ; i<3 ; i++)
+		wishvel[i] = forward[i]*cmd->forwardmove + right[i]*cmd->sidemove;
+	wishvel[2] = 0;
+
+	VectorCopy (wishvel, wishdir);
+	wishspeed = VectorNormalize (wishdir);
+	if (wishspeed > cl.movevars.maxspeed)
+	{
+		VectorScale (wishvel, cl.movevars.maxspeed/wishspeed, wishvel);
+		wishspeed = cl.movevars.maxspeed;
+	}
+
+	if (state->onground)
+	{
+		CL_PredictFriction (state, cmd->frametime);
+		SV_AccelerateVelocity (state->velocity, wishdir, wishspeed, cl.movevars.accelerate, cmd->frametime);
+	}
+	else
+		SV_AirAccelerateVelocity (state->velocity, wishvel, wishspeed, cl.movevars.accelerate, cmd->frametime);
+
+// jump, as player.qc does it
+	if (cmd->buttons & 2)
+	{
+		if (state->onground && state->jumpreleased)
+		{
+			state->onground = false;
+			state->jumpreleased = false;
+			state->velocity[2] += 270;
+		}
+	}
+	else
+		state->jumpreleased = true;
+
+	state->velocity[2] -= cl.movevars.gravity * cmd->frametime;
+
+	CL_PredictWalkMove (state, cmd->angles, cmd->frametime);
+}
+
+/*
+==================
+CL_PredictFrom
+
+Runs the moves sent after base on top of it
+==================
+*/
+static void CL_PredictFrom (predictack_t *base, predictstate_t *state)
+{
+	int				seq;
+	predictcmd_t	*cmd;
+
+	VectorCopy (base->origin, state->origin);
+	VectorCopy (base->velocity, state->velocity);
+	state->onground = (base->flags & MA_ONGROUND) != 0;
+	state->jumpreleased = (base->flags & MA_JUMPRELEASED) != 0;
+
+	if (cl.movesequence - base->sequence >= CL_PREDICT_CMDS)
+		return;		// too far behind to replay, just show the server's answer
+
+	for (seq = base->sequence + 1 ; seq <= cl.movesequence ; seq++)
+	{
+		cmd = &cl.predict_cmds[seq & (CL_PREDICT_CMDS-1)];
+		if (cmd->sequence == seq)
+			CL_PredictCmd (state, cmd);
+	}
+}
+
+/*
+===============================================================================
+
+PREDICTION
+
+===============================================================================
+*/
+
+/*
+==================
+CL_PredictTest_f
+
+Walks forward for a moment and times how long the view takes to move, and
+how long until the server's idea of the player does.  Try it with and
+without cl_predict against a server with net_simlatency set.
+==================
+*/
+static	double	predict_teststart;
+static	double	predict_testpredicted, predict_testconfirmed;
+static	vec3_t	predict_testorigin, predict_testserver;
+
+static void CL_PredictTest_f (void)
+{
+	entity_t	*ent;
+
+	if (cls.state != ca_connected || cls.signon != SIGNONS || cls.demoplayback)
+	{
+		Con_Printf ("predict_test: not connected to a server\n");
+		return;
+	}
+
+	ent = &cl_entities[cl.viewentity];
+	VectorCopy (ent->origin, predict_testorigin);
+	VectorCopy (ent->msg_origins[0], predict_testserver);
+	predict_teststart = realtime;
+	predict_testpredicted = predict_testconfirmed = 0;
+
+	Cbuf_AddText ("+forward\n");
+}
+
+static void CL_PredictTestFrame (void)
+{
+	entity_t	*ent;
+	vec3_t		delta;
+
+	if (!predict_teststart)
+		return;
+
+	ent = &cl_entities[cl.viewentity];
+
+	VectorSubtract (ent->origin, predict_testorigin, delta);
+	if (!predict_testpredicted && VectorLength (delta) > 1)
+		predict_testpredicted = realtime;
+
+	VectorSubtract (ent->msg_origins[0], predict_testserver, delta);
+	if (!predict_testconfirmed && VectorLength (delta) > 1)
+		predict_testconfirmed = realtime;
+
+	if (predict_testconfirmed && predict_testpredicted)
+		Con_Printf ("predict_test: view moved after %.0f ms, server after %.0f ms\n",
+			(predict_testpredicted - predict_teststart) * 1000, (predict_testconfirmed - predict_teststart) * 1000);
+	else if (realtime - predict_teststart > 2)
+		Con_Printf ("predict_test: no movement within 2 seconds\n");
+	else
+		return;
+
+	Cbuf_AddText ("-forward\n");
+	predict_teststart = 0;
+}
+
+/*
+==================
+CL_PredictMove
+
+Called after the entities have been relinked; moves the view entity to
+where the moves the server hasn't answered yet should take it
+==================
+*/
+void CL_PredictMove (void)
+{
+	predictstate_t	state, old;
+	entity_t		*ent;
+	float			scale;
+	int				i;
+
+	if (cls.state != ca_connected || cls.signon != SIGNONS)
+		return;
+
+	if (!cl_predict.value || !cl.movevars_valid || !cl.moveack_valid || cls.demoplayback
+		|| cl.intermission || (cl.moveack.flags & MA_NOPREDICT))
+	{
+		VectorClear (cl.predict_error);
+		cl.predict_basevalid = false;
+		CL_PredictTestFrame ();
+		return;
+	}
+
+	CL_PredictFrom (&cl.moveack, &state);
+
+// a new answer from the server: whatever it moves the view by is
+// spread over the next few frames instead of popping at once
+	if (!cl.predict_basevalid || cl.predict_base.sequence != cl.moveack.sequence)
+	{
+		if (cl.predict_basevalid)
+		{
+			CL_PredictFrom (&cl.predict_base, &old);
+			for (i=0 ; i<3 ; i++)
+				cl.predict_error[i] += old.origin[i] - state.origin[i];
+			if (VectorLength (cl.predict_error) > PREDICT_SNAP)
+				VectorClear (cl.predict_error);
+		}
+		cl.predict_base = cl.moveack;
+		cl.predict_basevalid = true;
+	}
+
+	scale = 1 - host_frametime / PREDICT_SMOOTH;
+	if (scale < 0)
+		scale = 0;
+	VectorScale (cl.predict_error, scale, cl.predict_error);
+
+	ent = &cl_entities[cl.viewentity];
+	VectorAdd (state.origin, cl.predict_error, ent->origin);
+	VectorCopy (state.velocity, cl.velocity);
+
+	CL_PredictTestFrame ();
+}
+
+/*
+==================
+CL_InitPrediction
+==================
+*/
+void CL_InitPrediction (void)
+{
+	Cvar_RegisterVariable (&cl_predict, NULL);
+	Cmd_AddCommand ("predict_test", CL_PredictTest_f);
+}
@@ -166,6 +166,9 @@ typedef struct
 	int			signon;			// 0 to SIGNONS
 	struct qsocket_s	*netcon;
 	sizebuf_t	message;		// writing buffer to send to server
+	double		connect_starttime;	// nonzero until the first signon completes
+	double		connect_time;		// seconds from connect to signon 4, for net_stats
+	qboolean	rate_sent;			// the server has been told cl_rate
 #ifdef HTTP_DOWNLOAD
 	download_t	download;
 #endif
@@ -177,6 +180,60 @@ typedef struct
 
 extern client_static_t	cls;
 
+#define	CL_PREDICT_CMDS		64			// moves kept for replay, must be a power of two
+
+typedef struct
+{
+	int			sequence;		// clc_movesequence it went out with
+	float		frametime;
+	vec3_t		angles;
+	float		forwardmove;
+	float		sidemove;
+	int			buttons;
+} predictcmd_t;
+
+typedef struct
+{
+	int			sequence;		// last move the server had run
+	int			flags;			// MA_* bits
+	vec3_t		origin;
+	vec3_t		velocity;
+} predictack_t;
+
+typedef struct
+{
+	float		gravity;
+	float		friction;
+	float		edgefriction;
+	float		stopspeed;
+	float		maxspeed;
+	float		accelerate;
+} movevars_t;
+
+// entity updates kept for drawing entities a little in the past
+#ifdef PSP_LOW_MEMORY_SYSTEM
+#define	CL_SNAPSHOTS		4			// must be a power of two
+#else
+#define	CL_SNAPSHOTS		8
+#endif
+
+typedef struct
+{
+	float		time;			// cl.mtime[0] of the message
+	vec3_t		origin;
+	vec3_t		angles;
+} entsnap_t;
+
+typedef struct
+{
+	int			head;			// newest
+	int			count;
+	entsnap_t	snaps[CL_SNAPSHOTS];
+
+	float		sampletime;		// drawn position still waiting for updates to judge it against
+	vec3_t		sampleorigin;
+} entsnaps_t;
+
 // the client_state_t structure is wiped completely at every
 // server signon
 typedef struct
@@ -258,6 +315,7 @@ typedef struct
 
 // frag scoreboard
 	scoreboard_t	*scores;			// [cl.maxclients]
+	entsnaps_t		*snapshots;			// [MAX_EDICTS], on the hunk if cl_interpdelay or cl_interpstats was set at level load
 #ifdef PROQUAKE_EXTENSION
 	teamscore_t		*teamscores;		// [13] - JPG for teamscores in status bar
 	qboolean		teamgame;			// JPG = true for match, false for individual
@@ -275,6 +333,24 @@ typedef struct
 	vec3_t			death_location;		// JPG 3.20 - used for %d formatting
 #endif
 
+// delta compressed entity updates
+	delta_frame_t	delta_frames[UPDATE_BACKUP];
+	int				delta_acked;		// newest svc_deltapacket parsed, sent back in clc_deltaack
+
+// movement prediction
+	qboolean		movevars_valid;		// the server agreed to svc_moveack and sent svc_movevars
+	movevars_t		movevars;
+	int				movesequence;		// last clc_movesequence sent
+	predictcmd_t	predict_cmds[CL_PREDICT_CMDS];
+	qboolean		moveack_valid;
+	predictack_t	moveack;			// newest svc_moveack
+	qboolean		predict_basevalid;
+	predictack_t	predict_base;		// svc_moveack the current prediction started from
+	vec3_t			predict_error;		// correction still being smoothed out
+
+// entity interpolation
+	double			snaptime;			// server time entities are drawn at, with cl_interpdelay
+	double			interplag;			// average of realtime minus that, for interp_stats
 } client_state_t;
 
 extern	client_state_t	cl;
@@ -282,6 +358,8 @@ extern	client_state_t	cl;
 // cvars
 extern	cvar_t	cl_name;
 extern	cvar_t	cl_color;
+extern	cvar_t	cl_deltaupdates;
+extern	cvar_t	cl_predict;
 
 #ifdef PSP_FIXME // Baker: find out where this should really go
 extern  cvar_t  pq_maxfps;
@@ -301,6 +379,10 @@ extern	cvar_t	cl_anglespeedkey;
 
 extern	cvar_t	cl_shownet;
 extern	cvar_t	cl_nolerp;
+extern	cvar_t	cl_interpdelay;
+extern	cvar_t	cl_extrapolate;
+extern	cvar_t	cl_interpstats;
+extern	cvar_t	cl_demojitter;
 
 extern	cvar_t	cl_pitchdriftspeed;
 extern	cvar_t	lookspring;
@@ -400,6 +482,7 @@ void CL_SendMove (usercmd_t *cmd);
 void CL_SendLagMove (void); // JPG - synthetic lag
 #endif
 void CL_ClearState (void);
+void CL_PushSnapshot (int num, qboolean reset);
 
 int  CL_ReadFromServer (void);
 void CL_WriteToServer (usercmd_t *cmd);
@@ -408,6 +491,10 @@ void CL_BaseMove (usercmd_t *cmd);
 float CL_KeyState (kbutton_t *key);
 char *Key_KeynumToString (int keynum);
 
+// cl_pred.c
+void CL_InitPrediction (void);
+void CL_PredictMove (void);
+
 // cl_demo.c
 void CL_StopPlayback (void);
 int CL_GetMessage (void);
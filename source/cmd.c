@@ -31,10 +31,76 @@ typedef struct cmdalias_s
 	struct cmdalias_s	*next;
 	char	name[MAX_ALIAS_NAME];
 	char	*value;
+	struct cmdalias_s	*hash_next;
 } cmdalias_t;
 
 cmdalias_t	*cmd_alias;
 
+// commands and aliases are also chained by a case insensitive hash of
+// their names, since that is how Cmd_ExecuteString matches them
+#define	CMD_HASH_SIZE	256		// must be a power of two
+
+static cmdalias_t	*cmd_alias_hash[CMD_HASH_SIZE];
+
+/*
+============
+Cmd_HashName
+============
+*/
+static unsigned Cmd_HashName (char *name)
+{
+	unsigned	hash = 2166136261u;
+	int			c;
+
+	while ((c = (byte)*name++))
+	{
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = (hash ^ c) * 16777619u;
+	}
+
+	return hash & (CMD_HASH_SIZE-1);
+}
+
+/*
+============
+Cmd_FindAlias
+
+exact tells whether case has to match too
+============
+*/
+static cmdalias_t *Cmd_FindAlias (char *name, qboolean exact)
+{
+	cmdalias_t	*a;
+
+	for (a = cmd_alias_hash[Cmd_HashName (name)] ; a ; a = a->hash_next)
+		if (exact ? !strcmp (name, a->name) : !strcasecmp (name, a->name))
+			return a;
+
+	return NULL;
+}
+
+/*
+============
+Cmd_FreeAlias
+============
+*/
+static void Cmd_FreeAlias (cmdalias_t *alias)
+{
+	cmdalias_t	**link;
+
+	for (link = &cmd_alias ; *link != alias ; link = &(*link)->next)
+		;
+	*link = alias->next;
+
+	for (link = &cmd_alias_hash[Cmd_HashName (alias->name)] ; *link != alias ; link = &(*link)->hash_next)
+		;
+	*link = alias->hash_next;
+
+	Z_Free (alias->value);
+	Z_Free (alias);
+}
+
 int trashtest;
 int *trashspot;
 
@@ -64,7 +130,22 @@ static void Cmd_Wait_f (void)
 =============================================================================
 */
 
-sizebuf_t	cmd_text;
+// The command buffer is a ring, so text can be inserted in front of what
+// is still queued without moving it, and it grows instead of dropping
+// what a big exec or stuffcmd adds
+#define	CBUF_MINSIZE	8192			// must be a power of two
+#define	CBUF_MAXSIZE	(4*1024*1024)
+
+static char		*cbuf_text;
+static int		cbuf_size;
+static int		cbuf_start;		// offset of the next unexecuted byte
+static int		cbuf_len;		// bytes queued
+
+cvar_t	cbuf_budget = {"cbuf_budget", "50"};	// ms of commands per frame, 0 for no limit
+
+static double	cbuf_added;		// bytes ever queued
+static int		cbuf_peak, cbuf_grows, cbuf_overflows;
+static int		cbuf_waits, cbuf_stalls;
 
 /*
 ============
@@ -73,9 +154,90 @@ Cbuf_Init
 */
 void Cbuf_Init (void)
 {
-	SZ_Alloc (&cmd_text, 8192);		// space for commands and script files
+	if (!(cbuf_text = malloc (CBUF_MINSIZE)))
+		Sys_Error ("Cbuf_Init: couldn't allocate %i bytes", CBUF_MINSIZE);
+	cbuf_size = CBUF_MINSIZE;
 }
 
+/*
+============
+Cbuf_Resize
+
+Moves the queued text to the start of a buffer of the given size
+============
+*/
+static qboolean Cbuf_Resize (int size)
+{
+	char	*text;
+	int		first;
+
+	if (!(text = malloc (size)))
+		return false;
+
+	first = cbuf_size - cbuf_start;
+	if (first > cbuf_len)
+		first = cbuf_len;
+	memcpy (text, cbuf_text + cbuf_start, first);
+	memcpy (text + first, cbuf_text, cbuf_len - first);
+
+	free (cbuf_text);
+	cbuf_text = text;
+	cbuf_size = size;
+	cbuf_start = 0;
+
+	return true;
+}
+
+/*
+============
+Cbuf_Reserve
+
+Makes room for len more bytes
+============
+*/
+static qboolean Cbuf_Reserve (int len)
+{
+	int		size;
+
+	if (cbuf_len + len <= cbuf_size)
+		return true;
+
+	for (size = cbuf_size ; size < cbuf_len + len ; size <<= 1)
+		if (size >= CBUF_MAXSIZE)
+			break;
+
+	if (cbuf_len + len > size || !Cbuf_Resize (size))
+	{
+		cbuf_overflows++;
+		return false;
+	}
+
+	cbuf_grows++;
+	return true;
+}
+
+/*
+============
+Cbuf_Put
+
+Copies text into the ring at the given offset
+============
+*/
+static void Cbuf_Put (int offset, char *text, int len)
+{
+	int		first;
+
+	first = cbuf_size - offset;
+	if (first > len)
+		first = len;
+	memcpy (cbuf_text + offset, text, first);
+	memcpy (cbuf_text, text + first, len - first);
+
+	cbuf_len += len;
+	cbuf_added += len;
+	if (cbuf_len > cbuf_peak)
+		cbuf_peak = cbuf_len;
+}
 
 /*
 ============
@@ -90,13 +252,13 @@ void Cbuf_AddText (char *text)
 
 	l = strlen (text);
 
-	if (cmd_text.cursize + l >= cmd_text.maxsize)
+	if (!Cbuf_Reserve (l))
 	{
 		Con_Printf ("Cbuf_AddText: overflow\n");
 		return;
 	}
 
-	SZ_Write (&cmd_text, text, strlen (text));
+	Cbuf_Put ((cbuf_start + cbuf_len) & (cbuf_size - 1), text, l);
 }
 
 /*
@@ -104,88 +266,97 @@ void Cbuf_AddText (char *text)
 Cbuf_InsertText
 
 Adds command text immediately after the current command
-Adds a \n to the text
-FIXME: actually change the command buffer to do less copying
 ============
 */
 void Cbuf_InsertText (char *text)
 {
-	char	*temp = NULL;
-	int		templen;
-
-// copy off any commands still remaining in the exec buffer
-	if ((templen = cmd_text.cursize))
-	{
-		temp = Z_Malloc (templen);
-		memcpy (temp, cmd_text.data, templen);
-		SZ_Clear (&cmd_text);
-	}
+	int		l;
 
-// add the entire text of the file
-	Cbuf_AddText (text);
+	l = strlen (text);
 
-// add the copied off data
-	if (templen)
+	if (!Cbuf_Reserve (l))
 	{
-		SZ_Write (&cmd_text, temp, templen);
-		Z_Free (temp);
+		Con_Printf ("Cbuf_InsertText: overflow\n");
+		return;
 	}
+
+	cbuf_start = (cbuf_start - l) & (cbuf_size - 1);
+	Cbuf_Put (cbuf_start, text, l);
 }
 
 /*
 ============
-Cbuf_Execute
+Cbuf_GetLine
+
+Takes the next command off the buffer, up to a \n or a ; outside quotes
 ============
 */
-void Cbuf_Execute (void)
+static void Cbuf_GetLine (char *line, int size)
 {
-	int		i;
-	char	*text;
-	char	line[1024];
-	int		quotes;
+	int		i, c, quotes, mask;
 #ifdef PROQUAKE_EXTENSION
+	char	head[4];
 	int		notcmd;	// JPG - so that the ENTIRE line can be forwarded
 #endif
-	while (cmd_text.cursize)
-	{
-// find a \n or ; line break
-		text = (char *)cmd_text.data;
 
-		quotes = 0;
+	mask = cbuf_size - 1;
+	quotes = 0;
 #ifdef PROQUAKE_EXTENSION
-		notcmd = strncmp(text, "cmd ", 4);  // JPG - so that the ENTIRE line can be forwarded
+	for (i=0 ; i<4 && i<cbuf_len ; i++)
+		head[i] = cbuf_text[(cbuf_start + i) & mask];
+	notcmd = i < 4 || strncmp(head, "cmd ", 4);  // JPG - so that the ENTIRE line can be forwarded
 #endif
-		for (i=0 ; i< cmd_text.cursize ; i++)
-		{
-			if (text[i] == '"')
-				quotes++;
+	for (i=0 ; i<cbuf_len ; i++)
+	{
+		c = cbuf_text[(cbuf_start + i) & mask];
+		if (c == '"')
+			quotes++;
 #ifdef PROQUAKE_EXTENSION
-			if ( !(quotes&1) &&  text[i] == ';' && notcmd)   // JPG - added && cmd so that the ENTIRE line can be forwareded
+		if ( !(quotes&1) &&  c == ';' && notcmd)   // JPG - added && cmd so that the ENTIRE line can be forwareded
 #else
-			if ( !(quotes&1) &&  text[i] == ';')
+		if ( !(quotes&1) &&  c == ';')
 #endif
-				break;	// don't break if inside a quoted string
-			if (text[i] == '\n')
-				break;
-		}
+			break;	// don't break if inside a quoted string
+		if (c == '\n')
+			break;
+		if (i < size - 1)
+			line[i] = c;
+	}
+	line[i < size - 1 ? i : size - 1] = 0;
 
-		memcpy_vfpu(line, text, i);
-		line[i] = 0;
+// remove it before it runs, because commands (exec, alias) can insert
+// text at the front of the buffer
+	if (i == cbuf_len)
+	{
+		cbuf_start = 0;
+		cbuf_len = 0;
+	}
+	else
+	{
+		cbuf_start = (cbuf_start + i + 1) & mask;
+		cbuf_len -= i + 1;
+	}
+}
 
-// delete the text from the command buffer and move remaining commands down
-// this is necessary because commands (exec, alias) can insert data at the
-// beginning of the text buffer
+/*
+============
+Cbuf_Execute
+============
+*/
+void Cbuf_Execute (void)
+{
+	char	line[1024];
+	double	end;
 
-		if (i == cmd_text.cursize)
-		{
-			cmd_text.cursize = 0;
-		}
-		else
-		{
-			i++;
-			cmd_text.cursize -= i;
-			memcpy (text, text+i, cmd_text.cursize);
-		}
+// once the game is running, a huge script is spread over frames
+	if (host_initialized && cbuf_budget.value > 0)
+		end = Sys_DoubleTime () + cbuf_budget.value / 1000;
+	else
+		end = 0;
+
+	while (cbuf_len)
+	{
+		Cbuf_GetLine (line, sizeof(line));
 
 // execute the command line
 		Cmd_ExecuteString (line, src_command);
@@ -193,9 +364,33 @@ void Cbuf_Execute (void)
 		if (cmd_wait)  {
 			// skip out while text still remains in buffer, leaving it for next frame
 			cmd_wait = false;
+			if (cbuf_len)
+				cbuf_waits++;
+			break;
+		}
+
+		if (end && cbuf_len && Sys_DoubleTime () > end)
+		{
+			cbuf_stalls++;
 			break;
 		}
 	}
+
+// give back what a big script needed
+	if (!cbuf_len && cbuf_size > CBUF_MINSIZE)
+		Cbuf_Resize (CBUF_MINSIZE);
+}
+
+/*
+============
+Cbuf_Stats_f
+============
+*/
+static void Cbuf_Stats_f (void)
+{
+	Con_Printf ("buffer    %i KB, %i bytes queued, %i peak\n", cbuf_size >> 10, cbuf_len, cbuf_peak);
+	Con_Printf ("added     %.0f KB, %i grows, %i overflows\n", cbuf_added / 1024, cbuf_grows, cbuf_overflows);
+	Con_Printf ("deferred  %i by wait, %i by cbuf_budget\n", cbuf_waits, cbuf_stalls);
 }
 
 /*
@@ -509,9 +704,8 @@ static void Cmd_Alias_f (void)
 			Con_SafePrintf ("no alias commands found\n");
 		break;
 	case 2: //output current alias string
-		for (a = cmd_alias ; a ; a=a->next)
-			if (!strcmp(Cmd_Argv(1), a->name))
-				Con_Printf ("   %s: %s", a->name, a->value);
+		if ((a = Cmd_FindAlias (Cmd_Argv(1), true)))
+			Con_Printf ("   %s: %s", a->name, a->value);
 		break;
 
 	default: //set alias string
@@ -524,22 +718,17 @@ static void Cmd_Alias_f (void)
 	}
 
 	// if the alias allready exists, reuse it
-	for (a = cmd_alias ; a ; a=a->next)
-	{
-		if (!strcmp(s, a->name))
-		{
-			Z_Free (a->value);
-			break;
-		}
-	}
-
-	if (!a)
+	if ((a = Cmd_FindAlias (s, true)))
+		Z_Free (a->value);
+	else
 	{
 		a = Z_Malloc (sizeof(cmdalias_t));
 		a->next = cmd_alias;
 		cmd_alias = a;
+		strcpy (a->name, s);
+		a->hash_next = cmd_alias_hash[Cmd_HashName (s)];
+		cmd_alias_hash[Cmd_HashName (s)] = a;
 	}
-	strcpy (a->name, s);
 
 // copy the rest of the command line
 	cmd[0] = 0;		// start out with a null string
@@ -564,7 +753,7 @@ Cmd_Unalias_f -- johnfitz
 */
 static void Cmd_Unalias_f (void)
 {
-	cmdalias_t	*a, *prev;
+	cmdalias_t	*a;
 
 	switch (Cmd_Argc())
 	{
@@ -573,18 +762,8 @@ static void Cmd_Unalias_f (void)
 		Con_Printf("unalias <name> : delete alias\n");
 		break;
 	case 2:
-		for (prev = a = cmd_alias; a; a = a->next)
-		{
-			if (!strcmp(Cmd_Argv(1), a->name))
-			{
-				prev->next = a->next;
-				Z_Free (a->value);
-				Z_Free (a);
-				prev = a;
-				return;
-			}
-			prev = a;
-		}
+		if ((a = Cmd_FindAlias (Cmd_Argv(1), true)))
+			Cmd_FreeAlias (a);
 		break;
 	}
 }
@@ -596,15 +775,8 @@ Cmd_Unaliasall_f -- johnfitz
 */
 static void Cmd_Unaliasall_f (void)
 {
-	cmdalias_t	*blah;
-
 	while (cmd_alias)
-	{
-		blah = cmd_alias->next;
-		Z_Free(cmd_alias->value);
-		Z_Free(cmd_alias);
-		cmd_alias = blah;
-	}
+		Cmd_FreeAlias (cmd_alias);
 }
 
 
@@ -636,14 +808,18 @@ typedef struct cmd_function_s
 	struct cmd_function_s	*next;
 	char					*name;
 	xcommand_t				function;
+	struct cmd_function_s	*hash_next;
 } cmd_function_t;
 
 static	cmd_function_t	*cmd_functions;		// possible commands to execute
+static	cmd_function_t	*cmd_function_hash[CMD_HASH_SIZE];
 
 #define	MAX_ARGS		80
+#define	MAX_ARG_CHARS	8192	// all the tokens of one command, with their terminators
 
 static	int			cmd_argc;
 static	char		*cmd_argv[MAX_ARGS];
+static	char		cmd_argchars[MAX_ARG_CHARS];
 static	char		*cmd_null_string = "";
 static	char		*cmd_args = NULL;
 
@@ -710,14 +886,12 @@ Parses the given string into command line tokens.
 */
 void Cmd_TokenizeString (char *text)
 {
-	int		i;
-
-// clear the args from the last string
-	for (i=0 ; i<cmd_argc ; i++)
-		Z_Free (cmd_argv[i]);
+	int		len, used;
 
+// the args of the last string are overwritten
 	cmd_argc = 0;
 	cmd_args = NULL;
+	used = 0;
 
 	while (1)
 	{
@@ -740,10 +914,12 @@ void Cmd_TokenizeString (char *text)
 		if (!(text = COM_Parse (text)))
 			return;
 
-		if (cmd_argc < MAX_ARGS)
+		len = strlen (com_token) + 1;
+		if (cmd_argc < MAX_ARGS && used + len <= MAX_ARG_CHARS)
 		{
-			cmd_argv[cmd_argc] = Z_Malloc (strlen(com_token)+1);
-			strcpy (cmd_argv[cmd_argc], com_token);
+			cmd_argv[cmd_argc] = cmd_argchars + used;
+			memcpy (cmd_argv[cmd_argc], com_token, len);
+			used += len;
 			cmd_argc++;
 		}
 	}
@@ -759,6 +935,7 @@ void	Cmd_AddCommand (char *cmd_name, xcommand_t function)
 {
 	cmd_function_t	*cmd;
 	cmd_function_t	*cursor,*prev; //Baker 3.75 - from Fitz johnfitz -- sorted list insert
+	unsigned		hash;
 
 	if (host_initialized)	// because hunk allocation would get stomped
 		Sys_Error ("Cmd_AddCommand after host_initialized");
@@ -771,19 +948,20 @@ void	Cmd_AddCommand (char *cmd_name, xcommand_t function)
 	}
 
 // fail if the command already exists
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	if (Cmd_Exists (cmd_name))
 	{
-		if (!strcmp (cmd_name, cmd->name))
-		{
-			Con_Printf ("Cmd_AddCommand: %s already defined\n", cmd_name);
-			return;
-		}
+		Con_Printf ("Cmd_AddCommand: %s already defined\n", cmd_name);
+		return;
 	}
 
 	cmd = Hunk_Alloc (sizeof(cmd_function_t));
 	cmd->name = cmd_name;
 	cmd->function = function;
 
+	hash = Cmd_HashName (cmd_name);
+	cmd->hash_next = cmd_function_hash[hash];
+	cmd_function_hash[hash] = cmd;
+
 	//johnfitz -- insert each entry in alphabetical order
     if (cmd_functions == NULL || strcmp(cmd->name, cmd_functions->name) < 0) //insert at front
 	{
@@ -814,7 +992,7 @@ qboolean	Cmd_Exists (char *cmd_name)
 {
 	cmd_function_t	*cmd;
 
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	for (cmd=cmd_function_hash[Cmd_HashName (cmd_name)] ; cmd ; cmd=cmd->hash_next)
 	{
 		if (!strcmp (cmd_name,cmd->name))
 			return true;
@@ -861,13 +1039,13 @@ char *Cmd_CompleteCommand (char *partial)
 Cmd_ExecuteString
 
 A complete command line has been parsed, so try to execute it
-FIXME: lookupnoadd the token to speed search?
 ============
 */
 void	Cmd_ExecuteString (char *text, cmd_source_t src)
 {
 	cmd_function_t	*cmd;
 	cmdalias_t		*a;
+	unsigned		hash;
 
 //	Con_Printf("Cmd_ExecuteString: %s \n", text);
 	cmd_source = src;
@@ -878,7 +1056,8 @@ void	Cmd_ExecuteString (char *text, cmd_source_t src)
 		return;		// no tokens
 
 // check functions
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	hash = Cmd_HashName (cmd_argv[0]);
+	for (cmd=cmd_function_hash[hash] ; cmd ; cmd=cmd->hash_next)
 	{
 		if (!strcasecmp (cmd_argv[0],cmd->name))
 		{
@@ -888,7 +1067,7 @@ void	Cmd_ExecuteString (char *text, cmd_source_t src)
 	}
 
 // check alias
-	for (a=cmd_alias ; a ; a=a->next)
+	for (a=cmd_alias_hash[hash] ; a ; a=a->hash_next)
 	{
 		if (!strcasecmp (cmd_argv[0], a->name))
 		{
@@ -1262,6 +1441,84 @@ void Cmd_CmdList_f (void) {
 // ********************** b2sync *********************
 
 
+/*
+============
+Cmd_Bench_f
+
+cmd_bench [lines]
+Times a config made up the way config.cfg is (every cvar set to what it
+already is) plus alias definitions, 10000 lines unless told otherwise,
+cut down to what fits in free hunk; cbuf_budget doesn't apply.  The text
+is built on the temp hunk, so this flushes the cache.  The aliases cycle
+through BENCH_ALIASES names, so the zone holds no more of them however
+long the run.
+============
+*/
+#define	BENCH_ALIASES	16
+
+static void Cmd_Bench_f (void)
+{
+	cvar_t		*var;
+	cmdalias_t	*a;
+	char		*text, *p, name[MAX_ALIAS_NAME], line[1024];
+	int			i, lines, maxlines, size, queued;
+	double		start, time;
+
+	lines = Cmd_Argc() > 1 ? atoi (Cmd_Argv(1)) : 10000;
+	if (lines <= 0 || !cvar_vars)
+		return;
+
+	maxlines = Hunk_TempSpace () / 128;
+	if (lines > maxlines)
+	{
+		Con_Printf ("only room for %i lines\n", maxlines);
+		lines = maxlines;
+		if (!lines)
+			return;
+	}
+
+	size = lines * 128;
+	text = p = Hunk_TempAlloc (size);
+	var = cvar_vars;
+	for (i=0 ; i<lines ; i++)
+	{
+		if ((i & 3) == 3)
+			snprintf (p, size - (p - text), "alias _bench%i \"echo %i\"\n", (i >> 2) % BENCH_ALIASES, i);
+		else
+		{
+		// anything that wouldn't come back unchanged is left out
+			while (strlen (var->name) + strlen (var->string) > 100 || strchr (var->string, '"'))
+				if (!(var = var->next))
+					var = cvar_vars;
+			snprintf (p, size - (p - text), "%s \"%s\"\n", var->name, var->string);
+			if (!(var = var->next))
+				var = cvar_vars;
+		}
+		p += strlen (p);
+	}
+
+// run it the way exec does, through the front of the command buffer,
+// leaving whatever was queued behind this command
+	start = Sys_DoubleTime ();
+	queued = cbuf_len;
+	Cbuf_InsertText (text);
+	while (cbuf_len > queued)
+	{
+		Cbuf_GetLine (line, sizeof(line));
+		Cmd_ExecuteString (line, src_command);
+	}
+	time = Sys_DoubleTime () - start;
+
+	for (i=0 ; i<BENCH_ALIASES ; i++)
+	{
+		snprintf (name, sizeof(name), "_bench%i", i);
+		if ((a = Cmd_FindAlias (name, true)))
+			Cmd_FreeAlias (a);
+	}
+
+	Con_Printf ("%i lines in %.1f ms, %.0f lines/sec, cache flushed\n", lines, time * 1000, lines / (time > 0 ? time : 1e-6));
+}
+
 /*
 ============
 Cmd_Init
@@ -1284,4 +1541,8 @@ void Cmd_Init (void) {
 	Cmd_AddCommand ("matrix", Mat_Init_f);	// JPG
 #endif
 	Cmd_AddCommand ("cmdlist", Cmd_CmdList_f);
+	Cmd_AddCommand ("cmd_bench", Cmd_Bench_f);
+	Cmd_AddCommand ("cbuf_stats", Cbuf_Stats_f);
+
+	Cvar_RegisterVariable (&cbuf_budget, NULL);
 }
@@ -48,7 +48,8 @@ void Cbuf_InsertText (char *text);
 
 void Cbuf_Execute (void);
 // Pulls off \n terminated lines of text from the command buffer and sends
-// them through Cmd_ExecuteString.  Stops when the buffer is empty.
+// them through Cmd_ExecuteString.  Stops when the buffer is empty, at a
+// wait, or once cbuf_budget milliseconds have gone by.
 // Normally called once per frame, but may be explicitly invoked.
 // Do not call inside a command function!
 
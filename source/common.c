@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // common.c -- misc functions used in client and server
 
 #include "quakedef.h"
+#include "inflate.h"
 
 #define NUM_SAFE_ARGVS  7
 
@@ -30,6 +31,13 @@ static char     *safeargvs[NUM_SAFE_ARGVS] = {"-stdvid", "-nolan", "-nosound", "
 
 cvar_t  registered = {"registered","0"};
 cvar_t  cmdline = {"cmdline","0", false, true};
+cvar_t	com_hashpaks = {"com_hashpaks", "1"};	// 0 = scan pak directories, to compare load times
+cvar_t	com_dircache = {"com_dircache", "1"};	// 0 = stat every loose file lookup
+#ifdef PSP_LOW_MEMORY_SYSTEM
+cvar_t	com_prefetch = {"com_prefetch", "512"};	// KB of precache files read ahead, 0 = off
+#else
+cvar_t	com_prefetch = {"com_prefetch", "2048"};
+#endif
 
 qboolean        com_modified;   // set true if using non-id files
 
@@ -40,6 +48,8 @@ static int             static_registered = 1;  // only for startup check, then s
 qboolean		msg_suppress_1 = 0;
 
 void COM_InitFilesystem (void);
+void COM_PakBench_f (void);
+void COM_PathRescan_f (void);
 
 // if a packfile directory differs from this, it is assumed to be hacked
 #define PAK0_COUNT              339
@@ -1003,8 +1013,13 @@ void COM_Init (char *basedir)
 
 	Cvar_RegisterVariable (&registered, NULL);
 	Cvar_RegisterVariable (&cmdline, NULL);  // Baker 3.99c: needed for test2 command
+	Cvar_RegisterVariable (&com_hashpaks, NULL);
+	Cvar_RegisterVariable (&com_dircache, NULL);
+	Cvar_RegisterVariable (&com_prefetch, NULL);
 
 	Cmd_AddCommand ("path", COM_Path_f);
+	Cmd_AddCommand ("pak_bench", COM_PakBench_f);
+	Cmd_AddCommand ("path_rescan", COM_PathRescan_f);
 
 	COM_InitFilesystem ();
 	COM_CheckRegistered ();
@@ -1069,10 +1084,14 @@ int     com_filesize;
 // in memory
 //
 
-typedef struct
+typedef struct packfile_s
 {
 	char    name[MAX_QPATH];
 	int             filepos, filelen;
+	int				complen;	// zip: deflated size, 0 if stored
+	qboolean		zipheader;	// zip: filepos is still the local header
+	struct pack_s		*pack;
+	struct packfile_s	*hashnext;	// next file in the same com_packhash chain
 } packfile_t;
 
 typedef struct pack_s
@@ -1081,6 +1100,7 @@ typedef struct pack_s
 	int             handle;
 	int             numfiles;
 	packfile_t      *files;
+	double			opentime;	// seconds spent reading the directory
 } pack_t;
 
 
@@ -1101,13 +1121,56 @@ typedef struct
 
 #define MAX_FILES_IN_PACK       2048
 
+// zip / pk3 archives; only the records the central directory needs
+#define	ZIP_EOCD_SIG		0x06054b50	// end of central directory
+#define	ZIP_CDIR_SIG		0x02014b50	// central directory file header
+#define	ZIP_LOCAL_SIG		0x04034b50	// local file header
+#define	ZIP_EOCD_SIZE		22
+#define	ZIP_CDIR_SIZE		46
+#define	ZIP_LOCAL_SIZE		30
+#define	ZIP_MAX_COMMENT		65535
+#define	ZIP_STORED			0
+#define	ZIP_DEFLATED		8
+
+#define	MAX_ZIPS_IN_DIR		64
+
 char    com_cachedir[MAX_OSPATH];
 char    com_gamedir[MAX_OSPATH] = "";	// JPG 3.20 - added initialization
 
+// listing of one directory of a loose search path, so lookups of files
+// that aren't there don't have to stat them
+typedef struct dirlist_s
+{
+	char		subdir[MAX_QPATH];	// relative to the search path, "" for itself
+	int			mtime;				// of the directory when it was listed
+	double		checktime;			// when mtime was last compared
+	int			numnames;			// -1 if too many to keep
+	char		**names;			// sorted, case insensitive
+	int			size;				// of the zone block
+	struct dirlist_s	*next;
+} dirlist_t;
+
+#define	DIRLIST_RECHECK		1.0		// seconds between directory mtime checks
+
+// listings live in the zone, which is small on low memory systems; a
+// directory bigger than DIRLIST_MAXSIZE is stat'ed file by file instead,
+// and when the listings together would pass DIRLIST_MAXTOTAL they are
+// all dropped and made again as needed
+#ifdef PSP_LOW_MEMORY_SYSTEM
+#define	DIRLIST_MAXSIZE		(8*1024)
+#define	DIRLIST_MAXTOTAL	(24*1024)
+#else
+#define	DIRLIST_MAXSIZE		(64*1024)
+#define	DIRLIST_MAXTOTAL	(256*1024)
+#endif
+
+static	int		com_dirlistbytes;
+
 typedef struct searchpath_s
 {
 	char    filename[MAX_OSPATH];
 	pack_t  *pack;          // only one of filename / pack will be used
+	dirlist_t	*dirlists;	// directories listed so far, for filename
 	struct searchpath_s *next;
 } searchpath_t;
 
@@ -1116,6 +1179,24 @@ searchpath_t    *com_searchpaths = NULL;	// JPG 3.20 - added NULL
 searchpath_t	*com_verifypaths = NULL;	// JPG 3.20 - use original game directory for verify path
 #endif
 
+// every file of every pak, hashed by name; COM_FindFile still walks the
+// search path in order, but asks each pak through here instead of
+// comparing against its whole directory
+#define	PACK_HASH_SIZE		1024		// must be a power of two
+static packfile_t	*com_packhash[PACK_HASH_SIZE];
+
+static	int		com_findcount;
+static	double	com_findtime;
+static	int		com_statcount;		// loose file stats made
+static	int		com_negcount;		// loose file misses answered by a directory listing
+
+static	int		com_filecompressed;	// deflated size of the last file found, 0 if stored
+static	int		com_fileoffset;		// where the last file found starts in its handle
+static	char	com_filepath[MAX_OSPATH];	// and the pak, zip or loose file it is in
+
+static	int		com_copybytes;
+static	double	com_loadtime;
+
 /*
 ============
 COM_Path_f
@@ -1135,6 +1216,308 @@ void COM_Path_f (void)
 		else
 			Con_Printf ("%s\n", s->filename);
 	}
+
+	Con_Printf ("%i lookups, %.1f ms%s\n", com_findcount, com_findtime * 1000, com_hashpaks.value ? "" : " (unhashed)");
+	Con_Printf ("%i loose misses answered from listings, %i stats\n", com_negcount, com_statcount);
+	Con_Printf ("%i KB read, %.1f ms loading\n", com_copybytes >> 10, com_loadtime * 1000);
+	if (Cmd_Argc () > 1 && !strcmp (Cmd_Argv (1), "reset"))
+	{
+		com_findcount = 0;
+		com_findtime = 0;
+		com_statcount = com_negcount = 0;
+		com_copybytes = 0;
+		com_loadtime = 0;
+	}
+}
+
+/*
+============
+COM_HashFileName
+============
+*/
+static unsigned COM_HashFileName (char *name)
+{
+	unsigned	hash = 2166136261u;
+
+	while (*name)
+		hash = (hash ^ (byte)*name++) * 16777619u;
+
+	return hash & (PACK_HASH_SIZE-1);
+}
+
+/*
+============
+COM_FindPackFile
+============
+*/
+static packfile_t *COM_FindPackFile (pack_t *pak, char *filename, unsigned hash)
+{
+	packfile_t	*file;
+	int			i;
+
+	if (com_hashpaks.value)
+	{
+		for (file = com_packhash[hash] ; file ; file = file->hashnext)
+			if (file->pack == pak && !strcmp (file->name, filename))
+				return file;
+		return NULL;
+	}
+
+	for (i=0 ; i<pak->numfiles ; i++)
+		if (!strcmp (pak->files[i].name, filename))
+			return &pak->files[i];
+	return NULL;
+}
+
+/*
+============
+COM_FreeDirLists
+============
+*/
+static void COM_FreeDirLists (searchpath_t *search)
+{
+	dirlist_t	*list, *next;
+
+	for (list = search->dirlists ; list ; list = next)
+	{
+		next = list->next;
+		com_dirlistbytes -= list->size;
+		Z_Free (list);
+	}
+	search->dirlists = NULL;
+}
+
+/*
+============
+COM_PathRescan_f
+
+Drops every directory listing, for files added behind the game's back
+============
+*/
+void COM_PathRescan_f (void)
+{
+	searchpath_t	*s;
+
+	for (s=com_searchpaths ; s ; s=s->next)
+		COM_FreeDirLists (s);
+}
+
+/*
+============
+COM_GameDirWritten
+
+Drops the game directory's listings after the engine writes a file there.
+The directory time can't be relied on to show it: on the PSP it is the
+FAT creation time, and elsewhere it only has one second resolution.
+============
+*/
+void COM_GameDirWritten (void)
+{
+	searchpath_t	*s;
+
+	for (s=com_searchpaths ; s ; s=s->next)
+		if (!s->pack && !strcmp (s->filename, com_gamedir))
+			COM_FreeDirLists (s);
+}
+
+/*
+============
+COM_DirNameCompare
+============
+*/
+static int COM_DirNameCompare (const void *a, const void *b)
+{
+	return strcasecmp (*(char **)a, *(char **)b);
+}
+
+/*
+============
+COM_ListDirectory
+
+Lists the files of search->filename/subdir in one zone block; a
+directory that doesn't exist lists as empty, and one too big to keep
+lists as numnames -1.  The finds stat every entry.
+============
+*/
+static dirlist_t *COM_ListDirectory (searchpath_t *search, char *subdir)
+{
+	char		path[MAX_OSPATH];
+	char		*name, *text;
+	int			numnames, textlen, size, i;
+	qboolean	toobig;
+	dirlist_t	*list;
+	searchpath_t	*s;
+
+	if (subdir[0])
+		snprintf (path, sizeof(path), "%s/%s", search->filename, subdir);
+	else
+		strcpy (path, search->filename);
+
+// size it
+	numnames = textlen = 0;
+	for (name = Sys_FindFirstFile (path, "*") ; name ; name = Sys_FindNextFile ())
+	{
+		numnames++;
+		textlen += strlen (name) + 1;
+	}
+	Sys_FindClose ();
+	com_statcount += numnames;
+
+	toobig = sizeof(dirlist_t) + numnames * sizeof(char *) + textlen > DIRLIST_MAXSIZE;
+	if (toobig)
+		numnames = textlen = 0;
+	size = sizeof(dirlist_t) + numnames * sizeof(char *) + textlen;
+	if (com_dirlistbytes + size > DIRLIST_MAXTOTAL)
+		for (s=com_searchpaths ; s ; s=s->next)
+			COM_FreeDirLists (s);
+
+	list = Z_Malloc (size);
+	list->size = size;
+	com_dirlistbytes += size;
+	strcpy (list->subdir, subdir);
+	list->mtime = Sys_FileTime (path);
+	com_statcount++;
+	list->checktime = Sys_DoubleTime ();
+	list->names = (char **)(list + 1);
+	text = (char *)(list->names + numnames);
+
+// fill it; stop short if the directory grew in between
+	i = 0;
+	if (!toobig)
+	{
+		for (name = Sys_FindFirstFile (path, "*") ; name && i < numnames ; name = Sys_FindNextFile ())
+		{
+			if (strlen (name) + 1 > textlen)
+				break;
+			strcpy (text, name);
+			list->names[i++] = text;
+			textlen -= strlen (name) + 1;
+			text += strlen (name) + 1;
+		}
+		Sys_FindClose ();
+		com_statcount += i;
+	}
+	list->numnames = toobig ? -1 : i;
+
+	if (list->numnames > 0)
+		qsort (list->names, list->numnames, sizeof(char *), COM_DirNameCompare);
+
+	list->next = search->dirlists;
+	search->dirlists = list;
+	return list;
+}
+
+/*
+============
+COM_DirectoryHasFile
+
+Answers from the listing of the file's directory: 1 if it is there, 0 if
+it isn't, -1 if the name can't be answered that way and needs a stat
+============
+*/
+static int COM_DirectoryHasFile (searchpath_t *search, char *filename)
+{
+	char		subdir[MAX_QPATH];
+	char		name[MAX_QPATH];
+	char		path[MAX_OSPATH];
+	char		*base;
+	dirlist_t	*list, **prev;
+
+	if (!com_dircache.value || strstr (filename, "..") || strchr (filename, '\\') || strlen (filename) >= MAX_QPATH)
+		return -1;
+
+	// filename is often a va() string, which listing the directory reuses
+	strcpy (name, filename);
+
+	base = strrchr (name, '/');
+	if (base)
+	{
+		memcpy (subdir, name, base - name);
+		subdir[base - name] = 0;
+		base++;
+	}
+	else
+	{
+		subdir[0] = 0;
+		base = name;
+	}
+
+	for (prev = &search->dirlists ; *prev ; prev = &(*prev)->next)
+		if (!strcasecmp ((*prev)->subdir, subdir))
+			break;
+	list = *prev;
+
+// relist it if the directory changed since; this is for files added from
+// outside, the engine's own writes go through COM_GameDirWritten
+	if (list && Sys_DoubleTime () - list->checktime > DIRLIST_RECHECK)
+	{
+		list->checktime = Sys_DoubleTime ();
+		com_statcount++;
+		if (subdir[0])
+			snprintf (path, sizeof(path), "%s/%s", search->filename, subdir);
+		else
+			strcpy (path, search->filename);
+		if (Sys_FileTime (path) != list->mtime)
+		{
+			*prev = list->next;
+			com_dirlistbytes -= list->size;
+			Z_Free (list);
+			list = NULL;
+		}
+	}
+
+	if (!list)
+		list = COM_ListDirectory (search, subdir);
+	if (list->numnames < 0)
+		return -1;
+
+	return bsearch (&base, list->names, list->numnames, sizeof(char *), COM_DirNameCompare) != NULL;
+}
+
+/*
+============
+COM_ZipShort / COM_ZipLong
+
+Zip records are little endian and unaligned
+============
+*/
+static int COM_ZipShort (byte *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static int COM_ZipLong (byte *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+/*
+============
+COM_LocateZipFile
+
+The central directory only gives the offset of an entry's local header,
+whose extra field can differ from the central one.  Read it the first
+time the entry is opened and point filepos at the data itself.
+============
+*/
+static qboolean COM_LocateZipFile (packfile_t *file)
+{
+	byte	header[ZIP_LOCAL_SIZE];
+
+	if (!file->zipheader)
+		return true;
+
+	Sys_FileSeek (file->pack->handle, file->filepos);
+	if (Sys_FileRead (file->pack->handle, header, ZIP_LOCAL_SIZE) != ZIP_LOCAL_SIZE
+	|| COM_ZipLong (header) != ZIP_LOCAL_SIG)
+	{
+		Con_Printf ("%s: bad local header for %s\n", file->pack->filename, file->name);
+		return false;
+	}
+
+	file->filepos += ZIP_LOCAL_SIZE + COM_ZipShort (header + 26) + COM_ZipShort (header + 28);
+	file->zipheader = false;
+	return true;
 }
 
 /*
@@ -1163,6 +1546,7 @@ void COM_WriteFile (char *filename, void *data, int len)
 	Sys_Printf ("COM_WriteFile: %s\n", name);
 	Sys_FileWrite (handle, data, len);
 	Sys_FileClose (handle);
+	COM_GameDirWritten ();
 }
 
 /*
@@ -1222,19 +1606,21 @@ void COM_CopyFile (char *netpath, char *cachepath)
 
 /*
 ===========
-COM_FindFile
+COM_FindFileInPath
 
 Finds the file in the search path.
 Sets com_filesize and one of handle or file
 ===========
 */
-int COM_FindFile (char *filename, int *handle, int *file)
+static int COM_FindFileInPath (char *filename, int *handle, int *file)
 {
 	searchpath_t    *search;
 	char            netpath[MAX_OSPATH];
 	char            cachepath[MAX_OSPATH];
 	pack_t          *pak;
-	int                     i;
+	packfile_t		*pakfile;
+	unsigned		hash;
+	int                     i, listed;
 	int                     findtime, cachetime;
 
 	if (file && handle)
@@ -1252,31 +1638,44 @@ int COM_FindFile (char *filename, int *handle, int *file)
 			search = search->next;
 	}
 
+	hash = COM_HashFileName (filename);
+	com_filecompressed = 0;
+	com_fileoffset = 0;
+
 	for ( ; search ; search = search->next)
 	{
 	// is the element a pak file?
 		if (search->pack)
 		{
-		// look through all the pak file elements
 			pak = search->pack;
-			for (i=0 ; i<pak->numfiles ; i++)
-				if (!strcmp (pak->files[i].name, filename))
-				{       // found it!
-					Sys_Printf ("PackFile: %s : %s\n",pak->filename, filename);
-					if (handle)
-					{
-						*handle = pak->handle;
-						Sys_FileSeek (pak->handle, pak->files[i].filepos);
-					}
-					else
-					{       // open a new file on the pakfile
-						Sys_FileOpenRead(pak->filename, file);
-						if ((*file) >= 0)
-							Sys_FileSeek(*file, pak->files[i].filepos);
-					}
-					com_filesize = pak->files[i].filelen;
-					return com_filesize;
+			pakfile = COM_FindPackFile (pak, filename, hash);
+			if (pakfile)
+			{       // found it!
+				if (!COM_LocateZipFile (pakfile))
+					continue;
+				if (pakfile->complen && !handle)
+				{	// a deflated entry can only be inflated whole by COM_LoadFile
+					Con_Printf ("%s is compressed in %s, can't open it as a stream\n", filename, pak->filename);
+					break;
+				}
+				Sys_Printf ("PackFile: %s : %s\n",pak->filename, filename);
+				if (handle)
+				{
+					*handle = pak->handle;
+					Sys_FileSeek (pak->handle, pakfile->filepos);
+				}
+				else
+				{       // open a new file on the pakfile
+					Sys_FileOpenRead(pak->filename, file);
+					if ((*file) >= 0)
+						Sys_FileSeek(*file, pakfile->filepos);
 				}
+				com_filesize = pakfile->filelen;
+				com_filecompressed = pakfile->complen;
+				com_fileoffset = pakfile->filepos;
+				strcpy (com_filepath, pak->filename);
+				return com_filesize;
+			}
 		}
 		else
 		{
@@ -1287,11 +1686,22 @@ int COM_FindFile (char *filename, int *handle, int *file)
 					continue;
 			}
 
+			listed = COM_DirectoryHasFile (search, filename);
+			if (!listed)
+			{
+				com_negcount++;
+				continue;
+			}
+
 			snprintf(netpath, sizeof(netpath),  "%s/%s",search->filename, filename);
 
-			findtime = Sys_FileTime (netpath);
-			if (findtime == -1)
-				continue;
+			if (listed == -1 || com_cachedir[0])
+			{
+				com_statcount++;
+				findtime = Sys_FileTime (netpath);
+				if (findtime == -1)
+					continue;
+			}
 
 		// see if the file needs to be updated in the cache
 			if (!com_cachedir[0])
@@ -1317,6 +1727,9 @@ int COM_FindFile (char *filename, int *handle, int *file)
 
 			Sys_Printf ("FindFile: %s\n",netpath);
 			com_filesize = Sys_FileOpenRead (netpath, &i);
+			if (com_filesize == -1)
+				continue;		// listed, but gone since
+			strcpy (com_filepath, netpath);
 			if (handle)
 				*handle = i;
 			else
@@ -1339,6 +1752,24 @@ int COM_FindFile (char *filename, int *handle, int *file)
 	return -1;
 }
 
+/*
+===========
+COM_FindFile
+===========
+*/
+int COM_FindFile (char *filename, int *handle, int *file)
+{
+	double	start;
+	int		len;
+
+	start = Sys_DoubleTime ();
+	len = COM_FindFileInPath (filename, handle, file);
+	com_findtime += Sys_DoubleTime () - start;
+	com_findcount++;
+
+	return len;
+}
+
 
 /*
 ===========
@@ -1388,28 +1819,23 @@ void COM_CloseFile (int h)
 
 /*
 ============
-COM_LoadFile
+COM_ReadFile
 
-Filename are relative to the quake directory.
-Always appends a 0 byte.
+Reads the file COM_OpenFile just returned into memory of the requested
+kind, and closes it
 ============
 */
 static cache_user_t *loadcache;
 static byte    *loadbuf;
 static int             loadsize;
-byte *COM_LoadFile (char *path, int usehunk)
+static byte *COM_ReadFile (char *path, int h, int len, int usehunk)
 {
-	int             h;
 	byte    *buf;
 	char    base[32];
-	int             len;
+	int             complen;
 
 	buf = NULL;     // quiet compiler warning
-
-// look for it in the filesystem or pack files
-	len = COM_OpenFile (path, &h);
-	if (h == -1)
-		return NULL;
+	complen = com_filecompressed;
 
 // extract the filename base name for hunk tag
 	COM_FileBase (path, base);
@@ -1438,10 +1864,44 @@ byte *COM_LoadFile (char *path, int usehunk)
 	((byte *)buf)[len] = 0;
 
 	Draw_BeginDisc ();
-	Sys_FileRead (h, buf, len);
+	if (complen)
+	{	// deflated zip entry, decoded straight into its destination
+		if (!Inflate_File (h, complen, buf, len))
+			Sys_Error ("COM_LoadFile: %s is corrupt", path);
+	}
+	else
+		Sys_FileRead (h, buf, len);
 	COM_CloseFile (h);
 	Draw_EndDisc ();
 
+	com_copybytes += len;
+	return buf;
+}
+
+/*
+============
+COM_LoadFile
+
+Filename are relative to the quake directory.
+Always appends a 0 byte.
+============
+*/
+byte *COM_LoadFile (char *path, int usehunk)
+{
+	int             h, len;
+	byte    *buf;
+	double	start;
+
+	start = Sys_DoubleTime ();
+
+// look for it in the filesystem or pack files
+	len = COM_OpenFile (path, &h);
+	if (h == -1)
+		return NULL;
+
+	buf = COM_ReadFile (path, h, len, usehunk);
+	com_loadtime += Sys_DoubleTime () - start;
+
 	return buf;
 }
 
@@ -1473,6 +1933,348 @@ byte *COM_LoadStackFile (char *path, void *buffer, int bufsize)
 	return buf;
 }
 
+/*
+=============================================================================
+
+PREFETCH
+
+While a map loads its precache lists are known up front, but each file
+is only read once its loader asks for it.  The names queued here are read
+ahead in order through Sys_QueueRead, up to com_prefetch KB at a time, and
+COM_MapStackFile hands the buffer over when the loader gets there.  All
+parsing and hunk and cache allocation stays on the main thread, in the
+original order.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	char		name[MAX_QPATH];
+	qboolean	queued;			// has a buffer and is with the reader
+	sysread_t	read;
+} prefetch_t;
+
+static prefetch_t	*com_prefetchlist;
+static int			com_maxprefetch, com_numprefetch;
+static int			com_prefetchnext;	// next entry to queue
+static int			com_prefetchused;	// entries before this were taken or dropped
+static int			com_prefetchbytes;	// buffered or being read
+
+static byte			*com_prefetchview;	// buffer handed out by COM_MapStackFile
+
+static int			com_prefetchhits, com_prefetchfiles;
+static double		com_prefetchwait;	// spent waiting for the reader
+
+/*
+============
+COM_PumpPrefetch
+
+Queues entries until com_prefetch KB are buffered or in flight
+============
+*/
+static void COM_PumpPrefetch (void)
+{
+	prefetch_t	*p;
+	int			h, len;
+
+	while (com_prefetchnext < com_numprefetch && com_prefetchbytes < com_prefetch.value * 1024)
+	{
+		p = &com_prefetchlist[com_prefetchnext++];
+
+		len = COM_OpenFile (p->name, &h);
+		if (h == -1)
+			continue;
+		COM_CloseFile (h);
+		if (len <= 0 || com_filecompressed)
+			continue;		// nothing to read ahead, or only COM_LoadFile can inflate it
+
+		if (!(p->read.data = malloc (len + 1)))
+		{	// out of room outside the hunk; stop reading ahead
+			com_prefetchnext = com_numprefetch;
+			break;
+		}
+		p->read.data[len] = 0;
+		strcpy (p->read.path, com_filepath);
+		p->read.offset = com_fileoffset;
+		p->read.length = len;
+		p->queued = true;
+		com_prefetchbytes += len;
+		com_prefetchfiles++;
+
+		Sys_QueueRead (&p->read);
+	}
+}
+
+/*
+============
+COM_DropPrefetch
+============
+*/
+static void COM_DropPrefetch (prefetch_t *p)
+{
+	if (!p->queued)
+		return;
+
+	Sys_WaitRead (&p->read);		// the reader may still be writing to it
+	free (p->read.data);
+	com_prefetchbytes -= p->read.length;
+	p->queued = false;
+}
+
+/*
+============
+COM_TakePrefetch
+
+Returns the read-ahead buffer for path, with com_filesize set, or NULL
+if it wasn't read ahead.  Entries listed before it were skipped by their
+loaders (already resident), so they are dropped.
+============
+*/
+static byte *COM_TakePrefetch (char *path)
+{
+	prefetch_t	*p;
+	double		start;
+	byte		*data;
+	int			i;
+
+	if (!com_prefetchlist)
+		return NULL;
+
+	for (i=com_prefetchused ; i<com_numprefetch ; i++)
+		if (!strcmp (com_prefetchlist[i].name, path))
+			break;
+	if (i == com_numprefetch)
+		return NULL;
+
+	for ( ; com_prefetchused < i ; com_prefetchused++)
+		COM_DropPrefetch (&com_prefetchlist[com_prefetchused]);
+	com_prefetchused = i + 1;
+
+	p = &com_prefetchlist[i];
+	if (i >= com_prefetchnext)
+	{	// the reader never got this far
+		com_prefetchnext = i + 1;
+		COM_PumpPrefetch ();
+		return NULL;
+	}
+	if (!p->queued)
+		return NULL;
+
+	start = Sys_DoubleTime ();
+	Sys_WaitRead (&p->read);
+	com_prefetchwait += Sys_DoubleTime () - start;
+
+	data = p->read.data;
+	com_prefetchbytes -= p->read.length;
+	p->queued = false;
+	if (p->read.state != SYS_READ_DONE)
+	{
+		free (data);
+		COM_PumpPrefetch ();
+		return NULL;
+	}
+	com_prefetchhits++;
+
+	COM_PumpPrefetch ();
+	com_filesize = p->read.length;		// after the pump, which opens files
+	return data;
+}
+
+/*
+============
+COM_BeginPrefetch
+============
+*/
+void COM_BeginPrefetch (int maxfiles)
+{
+	COM_EndPrefetch ();
+
+	com_prefetchhits = com_prefetchfiles = 0;
+	com_prefetchwait = 0;
+
+	if (!com_prefetch.value || maxfiles <= 0)
+		return;
+	if (!(com_prefetchlist = malloc (maxfiles * sizeof(prefetch_t))))
+		return;
+	com_maxprefetch = maxfiles;
+}
+
+/*
+============
+COM_PrefetchFile
+
+Adds path to the files that will be read ahead, in the order the
+loaders will ask for them
+============
+*/
+void COM_PrefetchFile (char *path)
+{
+	prefetch_t	*p;
+
+	if (!com_prefetchlist || com_numprefetch == com_maxprefetch || strlen (path) >= MAX_QPATH)
+		return;
+
+	p = &com_prefetchlist[com_numprefetch++];
+	strcpy (p->name, path);
+	p->queued = false;
+
+	COM_PumpPrefetch ();
+}
+
+/*
+============
+COM_EndPrefetch
+
+Drops whatever wasn't asked for, and reports how the read-ahead went
+============
+*/
+void COM_EndPrefetch (void)
+{
+	int		i;
+
+	// the last buffer handed out would otherwise sit in the heap all level
+	if (com_prefetchview)
+	{
+		free (com_prefetchview);
+		com_prefetchview = NULL;
+	}
+
+	if (!com_prefetchlist)
+		return;
+
+	for (i=com_prefetchused ; i<com_prefetchnext ; i++)
+		COM_DropPrefetch (&com_prefetchlist[i]);
+
+	Con_DPrintf ("prefetch: %i of %i files used, %.1f ms waiting on reads\n",
+		com_prefetchhits, com_prefetchfiles, com_prefetchwait * 1000);
+
+	free (com_prefetchlist);
+	com_prefetchlist = NULL;
+	com_maxprefetch = com_numprefetch = 0;
+	com_prefetchnext = com_prefetchused = 0;
+	com_prefetchbytes = 0;
+}
+
+/*
+============
+COM_MapStackFile
+
+Like COM_LoadStackFile, but hands over the buffer of a finished prefetch
+instead of reading the file again.  For read-mostly consumers (models,
+sounds) that parse the buffer and drop it.  Only valid until the next
+call or COM_EndPrefetch, and not 0 terminated.
+============
+*/
+byte *COM_MapStackFile (char *path, void *buffer, int bufsize)
+{
+	int		h, len;
+	byte	*buf;
+	double	start;
+
+	if (com_prefetchview)
+	{
+		free (com_prefetchview);
+		com_prefetchview = NULL;
+	}
+
+	start = Sys_DoubleTime ();
+
+	com_prefetchview = COM_TakePrefetch (path);
+	if (com_prefetchview)
+	{
+		com_copybytes += com_filesize;
+		com_loadtime += Sys_DoubleTime () - start;
+		return com_prefetchview;
+	}
+
+	len = COM_OpenFile (path, &h);
+	if (h == -1)
+		return NULL;
+
+	loadbuf = (byte *)buffer;
+	loadsize = bufsize;
+	buf = COM_ReadFile (path, h, len, 4);
+
+	com_loadtime += Sys_DoubleTime () - start;
+	return buf;
+}
+
+/*
+=================
+COM_PakBench_f
+
+Reads every file of every pak and zip in the search path straight from
+its archive, and reports that next to how long the directory took to open
+=================
+*/
+void COM_PakBench_f (void)
+{
+	searchpath_t	*s;
+	pack_t			*pak;
+	packfile_t		*file;
+	byte			*buf;
+	int				i, bytes, inflated;
+	double			start, time;
+
+	for (s=com_searchpaths ; s ; s=s->next)
+	{
+		if (!s->pack)
+			continue;
+		pak = s->pack;
+
+		bytes = inflated = 0;
+		start = Sys_DoubleTime ();
+		for (i=0 ; i<pak->numfiles ; i++)
+		{
+			file = &pak->files[i];
+			if (!COM_LocateZipFile (file))
+				continue;
+
+			buf = Hunk_TempAlloc (file->filelen + 1);
+			Sys_FileSeek (pak->handle, file->filepos);
+			if (file->complen)
+			{
+				if (!Inflate_File (pak->handle, file->complen, buf, file->filelen))
+					Con_Printf ("%s: %s is corrupt\n", pak->filename, file->name);
+				inflated += file->filelen;
+			}
+			else
+				Sys_FileRead (pak->handle, buf, file->filelen);
+			bytes += file->filelen;
+		}
+		time = Sys_DoubleTime () - start;
+
+		Con_Printf ("%s: directory %.1f ms, %i files %.1f MB in %.0f ms (%.2f MB/s, %i%% inflated)\n",
+			pak->filename, pak->opentime * 1000, pak->numfiles, bytes / (1024.0*1024), time * 1000,
+			time > 0 ? bytes / (1024.0*1024) / time : 0, bytes ? (int)(100.0 * inflated / bytes) : 0);
+	}
+}
+
+/*
+=================
+COM_IndexPack
+
+Links every file of a new pak or zip into com_packhash; backwards, so a
+name the archive holds twice finds the first copy
+=================
+*/
+static void COM_IndexPack (pack_t *pack)
+{
+	packfile_t	*file;
+	unsigned	hash;
+	int			i;
+
+	for (i=pack->numfiles-1 ; i>=0 ; i--)
+	{
+		file = &pack->files[i];
+		hash = COM_HashFileName (file->name);
+		file->pack = pack;
+		file->hashnext = com_packhash[hash];
+		com_packhash[hash] = file;
+	}
+}
+
 /*
 =================
 COM_LoadPackFile
@@ -1492,7 +2294,9 @@ pack_t *COM_LoadPackFile (char *packfile)
 	int                             packhandle;
 	dpackfile_t             info[MAX_FILES_IN_PACK];
 	unsigned short          crc;
+	double					start;
 
+	start = Sys_DoubleTime ();
 	if (Sys_FileOpenRead (packfile, &packhandle) == -1)
 	{
 //              Con_Printf ("Couldn't open %s\n", packfile);
@@ -1537,6 +2341,8 @@ pack_t *COM_LoadPackFile (char *packfile)
 	pack->handle = packhandle;
 	pack->numfiles = numpackfiles;
 	pack->files = newfiles;
+	COM_IndexPack (pack);
+	pack->opentime = Sys_DoubleTime () - start;
 
 	// FitzQuake has this commented out
 
@@ -1544,6 +2350,189 @@ pack_t *COM_LoadPackFile (char *packfile)
 	return pack;
 }
 
+/*
+=================
+COM_LoadZipFile
+
+Takes an explicit path to a zip or pk3 archive.  The central directory is
+read once and kept as an ordinary pack directory; stored entries are then
+read in place like pak files, deflated ones are inflated by COM_LoadFile.
+=================
+*/
+pack_t *COM_LoadZipFile (char *zipfile)
+{
+	int				i, pos, filelen, taillen;
+	int				numentries, dirofs, dirlen, numfiles;
+	int				namelen, skiplen, method;
+	int				ziphandle;
+	byte			eocd[ZIP_EOCD_SIZE];
+	byte			*tail, *cdir, *p;
+	packfile_t		*newfiles, *file;
+	pack_t			*pack;
+	double			start;
+
+	start = Sys_DoubleTime ();
+	filelen = Sys_FileOpenRead (zipfile, &ziphandle);
+	if (filelen == -1)
+		return NULL;
+
+// the end of central directory record is last, unless the archive has a comment
+	if (filelen < ZIP_EOCD_SIZE)
+		goto notzip;
+	Sys_FileSeek (ziphandle, filelen - ZIP_EOCD_SIZE);
+	Sys_FileRead (ziphandle, eocd, ZIP_EOCD_SIZE);
+	if (COM_ZipLong (eocd) != ZIP_EOCD_SIG)
+	{
+		taillen = filelen;
+		if (taillen > ZIP_EOCD_SIZE + ZIP_MAX_COMMENT)
+			taillen = ZIP_EOCD_SIZE + ZIP_MAX_COMMENT;
+		tail = Hunk_TempAlloc (taillen);
+		Sys_FileSeek (ziphandle, filelen - taillen);
+		Sys_FileRead (ziphandle, tail, taillen);
+		for (pos = taillen - ZIP_EOCD_SIZE ; pos >= 0 ; pos--)
+			if (COM_ZipLong (tail + pos) == ZIP_EOCD_SIG)
+				break;
+		if (pos < 0)
+			goto notzip;
+		memcpy (eocd, tail + pos, ZIP_EOCD_SIZE);
+	}
+
+	numentries = COM_ZipShort (eocd + 10);
+	dirlen = COM_ZipLong (eocd + 12);
+	dirofs = COM_ZipLong (eocd + 16);
+	if (numentries == 0xffff || dirofs == -1)
+	{
+		Con_Printf ("%s: zip64 archives are not supported\n", zipfile);
+		Sys_FileClose (ziphandle);
+		return NULL;
+	}
+	if (dirofs < 0 || dirlen < 0 || dirofs + dirlen > filelen)
+		goto notzip;
+
+	cdir = Hunk_TempAlloc (dirlen + 1);
+	Sys_FileSeek (ziphandle, dirofs);
+	Sys_FileRead (ziphandle, cdir, dirlen);
+
+	newfiles = Hunk_AllocName ((numentries + 1) * sizeof(packfile_t), "packfile");
+
+// parse the directory, keeping the files Quake can open
+	numfiles = 0;
+	p = cdir;
+	for (i=0 ; i<numentries ; i++, p += ZIP_CDIR_SIZE + skiplen)
+	{
+		if (p + ZIP_CDIR_SIZE > cdir + dirlen || COM_ZipLong (p) != ZIP_CDIR_SIG)
+		{
+			Con_Printf ("%s: central directory is truncated\n", zipfile);
+			break;
+		}
+		namelen = COM_ZipShort (p + 28);
+		skiplen = namelen + COM_ZipShort (p + 30) + COM_ZipShort (p + 32);
+		if (p + ZIP_CDIR_SIZE + namelen > cdir + dirlen)
+		{
+			Con_Printf ("%s: central directory is truncated\n", zipfile);
+			break;
+		}
+
+		if (!namelen || p[ZIP_CDIR_SIZE + namelen - 1] == '/')
+			continue;		// directory
+		if (namelen >= MAX_QPATH)
+		{
+			Con_DPrintf ("%s: skipping %.*s, name too long\n", zipfile, namelen, p + ZIP_CDIR_SIZE);
+			continue;
+		}
+		method = COM_ZipShort (p + 10);
+		if ((COM_ZipShort (p + 8) & 1) || (method != ZIP_STORED && method != ZIP_DEFLATED))
+		{
+			Con_DPrintf ("%s: skipping %.*s, encrypted or unknown compression\n", zipfile, namelen, p + ZIP_CDIR_SIZE);
+			continue;
+		}
+
+		file = &newfiles[numfiles++];
+		memcpy (file->name, p + ZIP_CDIR_SIZE, namelen);
+		file->name[namelen] = 0;
+		file->filepos = COM_ZipLong (p + 42);
+		file->filelen = COM_ZipLong (p + 24);
+		file->complen = (method == ZIP_DEFLATED) ? COM_ZipLong (p + 20) : 0;
+		file->zipheader = true;
+	}
+
+	com_modified = true;    // not the original file
+
+	pack = Hunk_Alloc (sizeof (pack_t));
+	strcpy (pack->filename, zipfile);
+	pack->handle = ziphandle;
+	pack->numfiles = numfiles;
+	pack->files = newfiles;
+	COM_IndexPack (pack);
+	pack->opentime = Sys_DoubleTime () - start;
+
+	Con_Printf ("Added zipfile %s (%i files)\n", zipfile, numfiles);
+	return pack;
+
+notzip:
+	Con_Printf ("%s is not a zip file\n", zipfile);
+	Sys_FileClose (ziphandle);
+	return NULL;
+}
+
+/*
+=================
+COM_ZipNameCompare
+=================
+*/
+static int COM_ZipNameCompare (const void *a, const void *b)
+{
+	return strcmp (*(char **)a, *(char **)b);
+}
+
+/*
+=================
+COM_AddZipFiles
+
+Adds every *.pk3 in dir in alphabetical order, so later names override
+earlier ones; they all override the numbered paks
+=================
+*/
+static void COM_AddZipFiles (char *gamedir)
+{
+	char			*names[MAX_ZIPS_IN_DIR];
+	char			*name;
+	char			dir[MAX_OSPATH];
+	int				i, numnames;
+	searchpath_t	*search;
+	pack_t			*pak;
+
+	// Sys_FindNextFile calls va(), so work from a copy
+	strlcpy (dir, gamedir, sizeof(dir));
+
+	numnames = 0;
+	for (name = Sys_FindFirstFile (dir, "*.pk3") ; name ; name = Sys_FindNextFile ())
+	{
+		if (numnames == MAX_ZIPS_IN_DIR)
+		{
+			Con_Printf ("%s: more than %i pk3 files\n", dir, MAX_ZIPS_IN_DIR);
+			break;
+		}
+		names[numnames++] = CopyString (va("%s/%s", dir, name));
+	}
+	Sys_FindClose ();
+
+	qsort (names, numnames, sizeof(names[0]), COM_ZipNameCompare);
+
+	for (i=0 ; i<numnames ; i++)
+	{
+		pak = COM_LoadZipFile (names[i]);
+		Z_Free (names[i]);
+		if (!pak)
+			continue;
+
+		search = Hunk_Alloc (sizeof(searchpath_t));
+		search->pack = pak;
+		search->next = com_searchpaths;
+		com_searchpaths = search;
+	}
+}
+
 
 /*
 ================
@@ -1587,6 +2576,9 @@ void COM_AddGameDirectory (char *dir)
 		com_searchpaths = search;
 	}
 
+// then any pk3 archives; dir is usually a va() string, which COM_LoadPackFile may have reused
+	COM_AddZipFiles (com_gamedir);
+
 //
 // add the contents of the parms.txt file to the end of the command line
 //
@@ -1682,6 +2674,12 @@ void COM_InitFilesystem (void)
 				if (!search->pack)
 					Sys_Error ("Couldn't load packfile: %s", com_argv[i]);
 			}
+			else if ( !strcmp(COM_FileExtension(com_argv[i]), "pk3") || !strcmp(COM_FileExtension(com_argv[i]), "zip") )
+			{
+				search->pack = COM_LoadZipFile (com_argv[i]);
+				if (!search->pack)
+					Sys_Error ("Couldn't load zipfile: %s", com_argv[i]);
+			}
 			else
 				strcpy (search->filename, com_argv[i]);
 			search->next = com_searchpaths;
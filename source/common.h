@@ -262,6 +262,7 @@ extern char	com_basedir[MAX_OSPATH];
 void COM_ForceExtension (char *path, char *extension);	// by joe
 
 void COM_WriteFile (char *filename, void *data, int len);
+void COM_GameDirWritten (void);
 
 void COM_CreatePath (char *path);
 int COM_OpenFile (char *filename, int *hndl);
@@ -269,6 +270,24 @@ int COM_FOpenFile (char *filename, int *file);
 void COM_CloseFile (int h);
 
 byte *COM_LoadStackFile (char *path, void *buffer, int bufsize);
+byte *COM_MapStackFile (char *path, void *buffer, int bufsize);
+
+void COM_BeginPrefetch (int maxfiles);
+void COM_PrefetchFile (char *path);
+void COM_EndPrefetch (void);
+
+// a read for Sys_QueueRead; state is set from the reader's thread
+#define	SYS_READ_QUEUED		0
+#define	SYS_READ_DONE		1
+#define	SYS_READ_FAILED		2
+
+typedef struct sysread_s
+{
+	char			path[MAX_OSPATH];
+	int				offset, length;
+	byte			*data;			// length bytes, allocated by the caller
+	volatile int	state;
+} sysread_t;
 byte *COM_LoadTempFile (char *path);
 byte *COM_LoadHunkFile (char *path);
 void COM_LoadCacheFile (char *path, struct cache_user_s *cu);
@@ -22,8 +22,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 
 cvar_t	*cvar_vars;
+int		cvar_servergeneration;
 char	*cvar_null_string = "";
 
+#define	CVAR_HASH_SIZE	256		// must be a power of two
+
+static cvar_t	*cvar_hash[CVAR_HASH_SIZE];
+
 void Cvar_SetStringByName (char *var_name, char *value);
 void Cvar_SetValueByName (char *var_name, float value);
 
@@ -238,6 +243,21 @@ void Cvar_Init (void)
 
 // 2000-01-09 CvarList command by Maddes  end
 
+/*
+============
+Cvar_HashName
+============
+*/
+static unsigned Cvar_HashName (char *name)
+{
+	unsigned	hash = 2166136261u;
+
+	while (*name)
+		hash = (hash ^ (byte)*name++) * 16777619u;
+
+	return hash & (CVAR_HASH_SIZE-1);
+}
+
 /*
 ============
 Cvar_FindVar
@@ -247,7 +267,7 @@ cvar_t *Cvar_FindVar (char *var_name)
 {
 	cvar_t	*var;
 
-	for (var=cvar_vars ; var ; var=var->next)
+	for (var=cvar_hash[Cvar_HashName (var_name)] ; var ; var=var->hash_next)
 		if (!strcmp (var_name, var->name))
 			return var;
 
@@ -266,7 +286,7 @@ float	Cvar_VariableValue (char *var_name)
 	var = Cvar_FindVar (var_name);
 	if (!var)
 		return 0;
-	return atof (var->string);
+	return var->value;	// kept in step with the string by every set
 }
 
 
@@ -333,7 +353,6 @@ Cvar_SetStringByName
 void Cvar_SetStringByName (char *var_name, char *value)
 {
 	cvar_t	*var;
-	qboolean changed;
 
 	var = Cvar_FindVar (var_name);
 	if (!var)
@@ -342,6 +361,24 @@ void Cvar_SetStringByName (char *var_name, char *value)
 		return;
 	}
 
+	Cvar_SetStringByRef (var, value);
+}
+
+/*
+============
+Cvar_SetStringByRef
+============
+*/
+void Cvar_SetStringByRef (cvar_t *var, char *value)
+{
+	qboolean changed;
+
+	if (!var->default_string)
+	{	// never registered, so the string isn't ours to free
+		Con_Printf ("Cvar_SetStringByRef: variable %s not registered\n", var->name);
+		return;
+	}
+
 	changed = strcmp(var->string, value);
 
 	Z_Free (var->string);	// free the old value string
@@ -359,6 +396,9 @@ void Cvar_SetStringByName (char *var_name, char *value)
 	}
 	//johnfitz
 
+	if (var->server && changed)
+		cvar_servergeneration++;
+
 	if ((var->server == 1) && changed)  // JPG - so that server = 2 will mute the variable
 	{
 		if (sv.active)
@@ -379,7 +419,7 @@ void Cvar_SetStringByName (char *var_name, char *value)
 	}
 #ifdef PROQUAKE_EXTENSION
 	// JPG - there's probably a better place for this, but it works.
-	if (!strcmp(var_name, "pq_lag"))
+	if (!strcmp(var->name, "pq_lag"))
 	{
 
 		if (var->value < 0)
@@ -403,11 +443,6 @@ void Cvar_SetStringByName (char *var_name, char *value)
 }
 
 
-void Cvar_SetStringByRef (cvar_t *var, char *value) 
-{
-	Cvar_SetStringByName (var->name, value);
-}
-
 /*
 ============
 Cvar_SetValueByRef
@@ -415,7 +450,13 @@ Cvar_SetValueByRef
 */
 void Cvar_SetValueByRef (cvar_t *var, float value) 
 {
-	Cvar_SetValueByName (var->name, value);
+	char	val[32];
+
+	if (value == (int)value)
+		snprintf(val, sizeof(val),  "%d", (int)value);
+	else
+	snprintf (val, sizeof(val), "%f",value);
+	Cvar_SetStringByRef (var, val);
 }
 
 
@@ -426,13 +467,16 @@ Cvar_SetValueByName
 */
 void Cvar_SetValueByName (char *var_name, float value)
 {
-	char	val[32];
+	cvar_t	*var;
 
-	if (value == (int)value)
-		snprintf(val, sizeof(val),  "%d", (int)value);
-	else
-	snprintf (val, sizeof(val), "%f",value);
-	Cvar_SetStringByName (var_name, val);
+	var = Cvar_FindVar (var_name);
+	if (!var)
+	{	// there is an error in C code if this happens
+		Con_Printf ("Cvar_SetValueByName: variable %s not found\n", var_name);
+		return;
+	}
+
+	Cvar_SetValueByRef (var, value);
 }
 
 /*
@@ -446,6 +490,7 @@ void Cvar_RegisterVariable (cvar_t *variable, void *function)
 {
 	char	*oldstr;
 	cvar_t	*cursor,*prev; //johnfitz -- sorted list insert
+	unsigned	hash;
 
 // first check to see if it has already been defined
 	if (Cvar_FindVar (variable->name))
@@ -494,6 +539,13 @@ void Cvar_RegisterVariable (cvar_t *variable, void *function)
 	//johnfitz
 
 	variable->callback = function; //johnfitz
+
+	hash = Cvar_HashName (variable->name);
+	variable->hash_next = cvar_hash[hash];
+	cvar_hash[hash] = variable;
+
+	if (variable->server)
+		cvar_servergeneration++;
 }
 
 
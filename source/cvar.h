@@ -67,6 +67,7 @@ typedef struct cvar_s
 	struct cvar_s *next;
 	char	*default_string; //Baker 3.76 - johnfitz -- remember defaults for reset function
 	void (*callback) (void); //johnfitz
+	struct cvar_s *hash_next;	// chain in the name hash
 } cvar_t;
 
 void 	Cvar_RegisterVariable (cvar_t *variable, void *function); //johnfitz -- cvar callback
@@ -80,7 +81,8 @@ void 	Cvar_RegisterVariable (cvar_t *variable, void *function); //johnfitz -- cv
 void 	Cvar_SetValueByRef (cvar_t *var, float value);
 void Cvar_SetStringByRef (cvar_t *var, char *value);
 
-// returns 0 if not defined or non numeric
+// returns 0 if not defined or non numeric; C code holding the cvar_t
+// should read ->value instead
 float	Cvar_VariableValue (char *var_name);
 
 // returns an empty string if not defined
@@ -106,3 +108,4 @@ void Cvar_Init (void);
 
 
 extern cvar_t	*cvar_vars;
+extern int		cvar_servergeneration;	// bumped whenever a server cvar is added or changes
@@ -402,6 +402,7 @@ void Host_WriteConfiguration (void)
 		Cvar_WriteVariables (f);
 
 		fclose (f);
+		COM_GameDirWritten ();
 	}
 }
 
@@ -629,6 +630,7 @@ void Host_ClearMemory (void)
 	Mod_ClearAll ();
 	if (host_hunklevel)
 		Hunk_FreeToLowMark (host_hunklevel);
+	Memory_ClearMap ();
 
 	cls.signon = 0;
 	memset (&sv, 0, sizeof(sv));
@@ -658,9 +660,9 @@ qboolean Host_FilterTime (double time)
 	fps = QMAX(10, pq_maxfps.value);
 
 #ifdef SUPPORTS_AVI_CAPTURE
-	if (!cls.capturedemo && !cls.timedemo && realtime - oldrealtime < 1.0 / fps)
+	if (!cls.capturedemo && !cls.timedemo && !loop_benchframes && realtime - oldrealtime < 1.0 / fps)
 #else
-	if (!cls.timedemo && realtime - oldrealtime < 1.0 / fps)
+	if (!cls.timedemo && !loop_benchframes && realtime - oldrealtime < 1.0 / fps)
 #endif
 	{
 #ifdef SUPPORTS_SYSSLEEP
@@ -774,6 +776,9 @@ void _Host_Frame (double time)
 // keep the random time dependent
 	rand ();
 
+// nothing holds a cache pointer between frames
+	Cache_CompactPending ();
+
 // decide the simulation time
 	if (!Host_FilterTime (time))
 	{
@@ -997,6 +1002,9 @@ Host_Init
 */
 void Host_Init (quakeparms_t *parms)
 {
+	double	start, mark;
+	double	fstime, gametime, nettime, vidtime = 0, sndtime = 0;
+
 	#if defined(_WIN32) && defined(GLQUAKE)
 	FILE *fp = fopen("opengl32.dll","r");
 	if (fp) {
@@ -1030,6 +1038,7 @@ void Host_Init (quakeparms_t *parms)
 #endif
 #endif
 
+	start = Sys_DoubleTime ();
 	Memory_Init (parms->membase, parms->memsize);
 	Cbuf_Init ();
 	Cmd_Init ();
@@ -1037,9 +1046,12 @@ void Host_Init (quakeparms_t *parms)
 	V_Init ();
 	Chase_Init ();
 	Host_InitVCR (parms);
+	mark = Sys_DoubleTime ();
 	COM_Init (parms->basedir);
+	fstime = Sys_DoubleTime () - mark;
 	Host_InitLocal ();
 
+	mark = Sys_DoubleTime ();
 	W_LoadWadFile ("gfx.wad");
 	Key_Init ();
 
@@ -1047,11 +1059,14 @@ void Host_Init (quakeparms_t *parms)
 	M_Init ();
 	PR_Init ();
 	Mod_Init ();
+	gametime = Sys_DoubleTime () - mark;
 #ifdef PROQUAKE_EXTENSION
 	Security_Init ();	// JPG 3.20 - cheat free
 #endif
+	mark = Sys_DoubleTime ();
 	NET_Init ();
 	SV_Init ();
+	nettime = Sys_DoubleTime () - mark;
 #ifdef PROQUAKE_EXTENSION
 	IPLog_Init ();	// JPG 1.05 - ip address logging
 
@@ -1091,6 +1106,7 @@ void Host_Init (quakeparms_t *parms)
 
 	if (cls.state != ca_dedicated)
 	{
+		mark = Sys_DoubleTime ();
 		host_basepal = (byte *)COM_LoadHunkFile ("gfx/palette.lmp");
 		if (!host_basepal)
 			Sys_Error ("Couldn't load gfx/palette.lmp");
@@ -1106,6 +1122,9 @@ void Host_Init (quakeparms_t *parms)
         Draw_Init ();
 		SCR_Init ();
 		R_Init ();
+		vidtime = Sys_DoubleTime () - mark;
+
+		mark = Sys_DoubleTime ();
 #ifndef	_WIN32
 	// on Win32, sound initialization has to come before video initialization, so we
 	// can put up a popup if the sound hardware is in use
@@ -1119,6 +1138,7 @@ void Host_Init (quakeparms_t *parms)
 
 #endif	// _WIN32
 		CDAudio_Init ();
+		sndtime = Sys_DoubleTime () - mark;
 		Sbar_Init ();
 		CL_Init ();
 #ifdef _WIN32 // on non win32, mouse comes before video for security reasons
@@ -1182,6 +1202,8 @@ void Host_Init (quakeparms_t *parms)
 
 	host_initialized = true;
 
+	Con_Printf ("Startup %.0f ms: filesystem %.0f, game data %.0f, net %.0f, video %.0f, sound %.0f\n",
+		(Sys_DoubleTime () - start) * 1000, fstime * 1000, gametime * 1000, nettime * 1000, vidtime * 1000, sndtime * 1000);
 	Con_Printf ("Host Initialized\n");
 	Sys_Printf ("========Quake Initialized=========\n");
 }
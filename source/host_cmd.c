@@ -166,9 +166,12 @@ void Host_Status_f (void)
 		print ("#%-2u %-16.16s  %3i  %2i:%02i:%02i\n", j+1, client->name, (int)client->edict->v.frags, hours, minutes, seconds);
 
 		if (cmd_source != src_command && sscanf(client->netconnection->address, "%d.%d.%d", &a, &b, &c) == 3 && sv_ipmasking.value )  // Baker 3.60 - engine side ip masking from RocketGuy's ProQuake-r
-         print ("   %d.%d.%d.xxx\n", a, b, c);  // Baker 3.60 - engine side ip masking from RocketGuy's ProQuake-r
-         else  // Baker 3.60 - engine side ip masking from RocketGuy's ProQuake-r
-		print ("   %s\n", client->netconnection->address);
+			print ("   %d.%d.%d.xxx\n", a, b, c);  // Baker 3.60 - engine side ip masking from RocketGuy's ProQuake-r
+		else  // Baker 3.60 - engine side ip masking from RocketGuy's ProQuake-r
+			print ("   %s\n", client->netconnection->address);
+
+		if (client->ent_overflows)
+			print ("   starved %i ents (%.1fs), %i overflows\n", client->ent_starved, client->ent_starvetime, client->ent_overflows);
 	}
 }
 
@@ -764,6 +767,7 @@ void Host_Savegame_f (void)
 		Con_Printf ("ERROR: couldn't open save file for writing.\n");
 		return;
 	}
+	COM_GameDirWritten ();
 
 	//fprintf (f, "%i\n", SAVEGAME_VERSION);
 	//Host_SavegameComment (comment);
@@ -1372,6 +1376,94 @@ void Host_PreSpawn_f (void)
 #endif
 }
 
+/*
+==================
+Host_DeltaUpdates_f
+
+The client can take svc_deltapacket entity updates
+==================
+*/
+void Host_DeltaUpdates_f (void)
+{
+	if (cmd_source == src_command)
+	{
+		Con_Printf ("deltaupdates is not valid from the console\n");
+		return;
+	}
+
+	host_client->delta_enabled = sv_deltaupdates.value && Cmd_Argc () > 1 && atoi (Cmd_Argv (1));
+	if (host_client->delta_enabled && !host_client->delta_frames)
+		host_client->delta_frames = Hunk_AllocName (UPDATE_BACKUP*sizeof(delta_frame_t), "deltafrm");
+	SV_ResetDeltaFrames (host_client);
+}
+
+/*
+==================
+Host_Predict_f
+
+The client predicts its own movement and wants svc_moveack
+==================
+*/
+void Host_Predict_f (void)
+{
+	if (cmd_source == src_command)
+	{
+		Con_Printf ("predict is not valid from the console\n");
+		return;
+	}
+
+	host_client->predict_enabled = sv_predict.value && Cmd_Argc () > 1 && atoi (Cmd_Argv (1));
+	host_client->movevars_sent = -1;
+}
+
+/*
+==================
+Host_InterpDelay_f
+
+How far behind its newest update the client draws the other entities, so
+lag compensation rewinds to what it saw
+==================
+*/
+void Host_InterpDelay_f (void)
+{
+	if (cmd_source == src_command)
+	{
+		Con_Printf ("interpdelay is not valid from the console\n");
+		return;
+	}
+
+	if (Cmd_Argc () < 2)
+		return;
+
+	host_client->interp_delay = bound(0, atof (Cmd_Argv (1)), 1);
+}
+
+/*
+==================
+Host_Rate_f
+
+The client's bytes a second, and optionally the largest datagram it takes
+==================
+*/
+void Host_Rate_f (void)
+{
+	if (cmd_source == src_command)
+	{
+		Con_Printf ("rate is not valid from the console\n");
+		return;
+	}
+
+	if (Cmd_Argc () < 2)
+		return;
+
+	host_client->rate = atoi (Cmd_Argv (1));
+	if (host_client->rate)
+		host_client->rate = QMAX(host_client->rate, SV_MINRATE);
+	if (Cmd_Argc () > 2)
+		host_client->maxdatagram = bound(MAX_DATAGRAM, atoi (Cmd_Argv (2)), MAX_EXTDATAGRAM);
+	host_client->rate_limit = 0;
+}
+
 /*
 ==================
 Host_Spawn_f
@@ -2316,6 +2408,10 @@ void Host_InitCommands (void)
 	Cmd_AddCommand ("kill", Host_Kill_f);
 	Cmd_AddCommand ("pause", Host_Pause_f);
 	Cmd_AddCommand ("spawn", Host_Spawn_f);
+	Cmd_AddCommand ("deltaupdates", Host_DeltaUpdates_f);
+	Cmd_AddCommand ("rate", Host_Rate_f);
+	Cmd_AddCommand ("predict", Host_Predict_f);
+	Cmd_AddCommand ("interpdelay", Host_InterpDelay_f);
 	Cmd_AddCommand ("begin", Host_Begin_f);
 	Cmd_AddCommand ("prespawn", Host_PreSpawn_f);
 	Cmd_AddCommand ("kick", Host_Kick_f);
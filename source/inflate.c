@@ -0,0 +1,451 @@
+/*
+Based on puff.c
+Copyright (C) 2002-2013 Mark Adler, all rights reserved
+version 2.3, 21 Jan 2013
+
+This software is provided 'as-is', without any express or implied
+warranty.  In no event will the author be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+
+Mark Adler    madler@alumni.caltech.edu
+
+Altered for this engine: input is read from a file handle a block at a
+time, output goes straight into a buffer of the final size that doubles
+as the window, and errors are reported as a qboolean.
+*/
+// inflate.c -- deflate stream decoder for zip archives
+
+// The whole file is always decoded into one buffer that is already the
+// right size, so that buffer doubles as the 32k history window and no
+// separate window or output copy is needed.  Compressed input is read
+// from the file a block at a time.  Codes are decoded canonically from
+// the per-length counts (RFC 1951), which keeps the tables small enough
+// to sit on the stack.
+
+#include "quakedef.h"
+#include "inflate.h"
+
+#define	MAXBITS		15			// longest code
+#define	MAXLCODES	286			// literal/length codes
+#define	MAXDCODES	30			// distance codes
+#define	MAXCODES	(MAXLCODES+MAXDCODES)
+#define	FIXLCODES	288			// literal/length codes in the fixed table
+
+#define	INFLATE_BLOCK	4096	// compressed bytes read per Sys_FileRead
+
+typedef struct
+{
+	int			handle;
+	int			inleft;			// compressed bytes still in the file
+	int			inpos, inlen;
+	byte		in[INFLATE_BLOCK];
+
+	unsigned	bitbuf;
+	int			bitcnt;
+
+	byte		*out;
+	int			outpos, outlen;
+
+	jmp_buf		abort;
+} inflate_t;
+
+typedef struct
+{
+	short		count[MAXBITS+1];	// number of codes of each length
+	short		symbol[FIXLCODES];	// symbols ordered by code
+} huffman_t;
+
+static const short	lbase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const short	lext[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const short	dbase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577};
+static const short	dext[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const short	order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+/*
+===============
+Inflate_Byte
+===============
+*/
+static int Inflate_Byte (inflate_t *s)
+{
+	if (s->inpos == s->inlen)
+	{
+		if (s->inleft <= 0)
+			longjmp (s->abort, 1);		// ran off the end of the entry
+		s->inlen = s->inleft < INFLATE_BLOCK ? s->inleft : INFLATE_BLOCK;
+		if (Sys_FileRead (s->handle, s->in, s->inlen) != s->inlen)
+			longjmp (s->abort, 1);
+		s->inleft -= s->inlen;
+		s->inpos = 0;
+	}
+	return s->in[s->inpos++];
+}
+
+/*
+===============
+Inflate_Bits
+===============
+*/
+static int Inflate_Bits (inflate_t *s, int need)
+{
+	unsigned	val;
+
+	val = s->bitbuf;
+	while (s->bitcnt < need)
+	{
+		val |= (unsigned)Inflate_Byte (s) << s->bitcnt;
+		s->bitcnt += 8;
+	}
+
+	s->bitbuf = val >> need;
+	s->bitcnt -= need;
+
+	return val & ((1u << need) - 1);
+}
+
+/*
+===============
+Inflate_Decode
+
+Walks the code one bit at a time; codes of each length are consecutive,
+so a code is found as soon as it falls inside the range for its length.
+===============
+*/
+static int Inflate_Decode (inflate_t *s, huffman_t *h)
+{
+	int			len, left;
+	int			code, first, count, index;
+	unsigned	bitbuf;
+	short		*next;
+
+	bitbuf = s->bitbuf;
+	left = s->bitcnt;
+	code = first = index = 0;
+	len = 1;
+	next = h->count + 1;
+
+	while (1)
+	{
+		while (left--)
+		{
+			code |= bitbuf & 1;
+			bitbuf >>= 1;
+			count = *next++;
+			if (code - count < first)
+			{
+				s->bitbuf = bitbuf;
+				s->bitcnt = (s->bitcnt - len) & 7;
+				return h->symbol[index + (code - first)];
+			}
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+			len++;
+		}
+
+		left = (MAXBITS+1) - len;
+		if (left == 0)
+			break;
+		bitbuf = Inflate_Byte (s);
+		if (left > 8)
+			left = 8;
+	}
+
+	longjmp (s->abort, 1);		// ran out of codes
+	return -1;
+}
+
+/*
+===============
+Inflate_Construct
+
+Builds the decoding tables from a list of code lengths.  Returns 0 for a
+complete code, a positive number for an incomplete one, negative if the
+lengths are over-subscribed.
+===============
+*/
+static int Inflate_Construct (huffman_t *h, const short *length, int n)
+{
+	int		symbol, len, left;
+	short	offs[MAXBITS+1];
+
+	for (len=0 ; len<=MAXBITS ; len++)
+		h->count[len] = 0;
+	for (symbol=0 ; symbol<n ; symbol++)
+		h->count[length[symbol]]++;
+	if (h->count[0] == n)
+		return 0;				// no codes at all
+
+	left = 1;
+	for (len=1 ; len<=MAXBITS ; len++)
+	{
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return left;
+	}
+
+	offs[1] = 0;
+	for (len=1 ; len<MAXBITS ; len++)
+		offs[len+1] = offs[len] + h->count[len];
+	for (symbol=0 ; symbol<n ; symbol++)
+		if (length[symbol] != 0)
+			h->symbol[offs[length[symbol]]++] = symbol;
+
+	return left;
+}
+
+/*
+===============
+Inflate_Codes
+===============
+*/
+static void Inflate_Codes (inflate_t *s, huffman_t *lencode, huffman_t *distcode)
+{
+	int		symbol, len, dist;
+	byte	*out;
+
+	do
+	{
+		symbol = Inflate_Decode (s, lencode);
+		if (symbol < 256)
+		{	// literal
+			if (s->outpos == s->outlen)
+				longjmp (s->abort, 1);
+			s->out[s->outpos++] = symbol;
+		}
+		else if (symbol > 256)
+		{	// length / distance pair
+			symbol -= 257;
+			if (symbol >= 29)
+				longjmp (s->abort, 1);
+			len = lbase[symbol] + Inflate_Bits (s, lext[symbol]);
+
+			symbol = Inflate_Decode (s, distcode);
+			if (symbol >= 30)
+				longjmp (s->abort, 1);
+			dist = dbase[symbol] + Inflate_Bits (s, dext[symbol]);
+
+			if (dist > s->outpos || len > s->outlen - s->outpos)
+				longjmp (s->abort, 1);
+
+			out = s->out + s->outpos;
+			s->outpos += len;
+			while (len--)
+			{
+				*out = *(out - dist);
+				out++;
+			}
+		}
+	} while (symbol != 256);
+}
+
+/*
+===============
+Inflate_Stored
+===============
+*/
+static void Inflate_Stored (inflate_t *s)
+{
+	int		len, nlen, count;
+
+	// stored blocks start on a byte boundary
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+
+	len = Inflate_Byte (s);
+	len |= Inflate_Byte (s) << 8;
+	nlen = Inflate_Byte (s);
+	nlen |= Inflate_Byte (s) << 8;
+	if (len != (~nlen & 0xffff) || len > s->outlen - s->outpos)
+		longjmp (s->abort, 1);
+
+	while (len)
+	{
+		if (s->inpos == s->inlen)
+		{
+			s->out[s->outpos++] = Inflate_Byte (s);	// refills
+			len--;
+			continue;
+		}
+		count = s->inlen - s->inpos;
+		if (count > len)
+			count = len;
+		memcpy (s->out + s->outpos, s->in + s->inpos, count);
+		s->inpos += count;
+		s->outpos += count;
+		len -= count;
+	}
+}
+
+/*
+===============
+Inflate_Fixed
+===============
+*/
+static void Inflate_Fixed (inflate_t *s)
+{
+	static qboolean		built;
+	static huffman_t	lencode, distcode;
+	short				lengths[FIXLCODES];
+	int					i;
+
+	if (!built)
+	{
+		for (i=0 ; i<144 ; i++)
+			lengths[i] = 8;
+		for ( ; i<256 ; i++)
+			lengths[i] = 9;
+		for ( ; i<280 ; i++)
+			lengths[i] = 7;
+		for ( ; i<FIXLCODES ; i++)
+			lengths[i] = 8;
+		Inflate_Construct (&lencode, lengths, FIXLCODES);
+
+		for (i=0 ; i<MAXDCODES ; i++)
+			lengths[i] = 5;
+		Inflate_Construct (&distcode, lengths, MAXDCODES);
+
+		built = true;
+	}
+
+	Inflate_Codes (s, &lencode, &distcode);
+}
+
+/*
+===============
+Inflate_Dynamic
+===============
+*/
+static void Inflate_Dynamic (inflate_t *s)
+{
+	int			nlen, ndist, ncode;
+	int			index, symbol, len, err;
+	short		lengths[MAXCODES];
+	huffman_t	lencode, distcode;
+
+	nlen = Inflate_Bits (s, 5) + 257;
+	ndist = Inflate_Bits (s, 5) + 1;
+	ncode = Inflate_Bits (s, 4) + 4;
+	if (nlen > MAXLCODES || ndist > MAXDCODES)
+		longjmp (s->abort, 1);
+
+// code length code lengths
+	for (index=0 ; index<ncode ; index++)
+		lengths[order[index]] = Inflate_Bits (s, 3);
+	for ( ; index<19 ; index++)
+		lengths[order[index]] = 0;
+	if (Inflate_Construct (&lencode, lengths, 19) != 0)
+		longjmp (s->abort, 1);
+
+// literal/length and distance code lengths
+	index = 0;
+	while (index < nlen + ndist)
+	{
+		symbol = Inflate_Decode (s, &lencode);
+		if (symbol < 16)
+		{
+			lengths[index++] = symbol;
+			continue;
+		}
+
+		len = 0;
+		if (symbol == 16)
+		{	// repeat the last length
+			if (index == 0)
+				longjmp (s->abort, 1);
+			len = lengths[index-1];
+			symbol = 3 + Inflate_Bits (s, 2);
+		}
+		else if (symbol == 17)
+			symbol = 3 + Inflate_Bits (s, 3);
+		else
+			symbol = 11 + Inflate_Bits (s, 7);
+
+		if (index + symbol > nlen + ndist)
+			longjmp (s->abort, 1);
+		while (symbol--)
+			lengths[index++] = len;
+	}
+
+	if (lengths[256] == 0)
+		longjmp (s->abort, 1);		// no end-of-block code
+
+// incomplete codes are only allowed when there is a single code
+	err = Inflate_Construct (&lencode, lengths, nlen);
+	if (err && (err < 0 || nlen != lencode.count[0] + lencode.count[1]))
+		longjmp (s->abort, 1);
+	err = Inflate_Construct (&distcode, lengths + nlen, ndist);
+	if (err && (err < 0 || ndist != distcode.count[0] + distcode.count[1]))
+		longjmp (s->abort, 1);
+
+	Inflate_Codes (s, &lencode, &distcode);
+}
+
+/*
+===============
+Inflate_File
+===============
+*/
+qboolean Inflate_File (int handle, int complen, byte *out, int outlen)
+{
+	inflate_t	s;
+	int			last, type;
+
+	s.handle = handle;
+	s.inleft = complen;
+	s.inpos = s.inlen = 0;
+	s.bitbuf = 0;
+	s.bitcnt = 0;
+	s.out = out;
+	s.outpos = 0;
+	s.outlen = outlen;
+
+	if (setjmp (s.abort))
+		return false;
+
+	do
+	{
+		last = Inflate_Bits (&s, 1);
+		type = Inflate_Bits (&s, 2);
+		switch (type)
+		{
+		case 0:
+			Inflate_Stored (&s);
+			break;
+		case 1:
+			Inflate_Fixed (&s);
+			break;
+		case 2:
+			Inflate_Dynamic (&s);
+			break;
+		default:
+			return false;
+		}
+	} while (!last);
+
+	return s.outpos == outlen;
+}
@@ -0,0 +1,32 @@
+/*
+Based on puff.c
+Copyright (C) 2002-2013 Mark Adler, all rights reserved
+version 2.3, 21 Jan 2013
+
+This software is provided 'as-is', without any express or implied
+warranty.  In no event will the author be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+
+Mark Adler    madler@alumni.caltech.edu
+
+Altered for this engine: input is read from a file handle a block at a
+time, output goes straight into a buffer of the final size that doubles
+as the window, and errors are reported as a qboolean.
+*/
+// inflate.h -- deflate stream decoder for zip archives
+
+// reads complen bytes of raw deflate data from the current position of
+// handle and decodes exactly outlen bytes into out
+qboolean Inflate_File (int handle, int complen, byte *out, int outlen);
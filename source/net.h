@@ -40,7 +40,21 @@ struct qsockaddr
 #define NET_MAXMESSAGE		8192
 #endif
 #define NET_HEADERSIZE		(2 * sizeof(unsigned int))
-#define NET_DATAGRAMSIZE	(MAX_DATAGRAM + NET_HEADERSIZE)
+#define NET_DATAGRAMSIZE	(MAX_EXTDATAGRAM + NET_HEADERSIZE)
+
+// room for NET_SendToAll messages still waiting on a connection
+#define NET_MAXBROADCAST	256
+
+// reliable messages are split into this many datagrams at most
+#define NET_MAXFRAGMENTS	((NET_MAXMESSAGE + MAX_DATAGRAM - 1) / MAX_DATAGRAM)
+
+// fragments of one reliable message that may be unacknowledged at once;
+// the receiver buffers the same number of out-of-order fragments
+#ifdef PSP_LOW_MEMORY_SYSTEM
+#define NET_WINDOW			4
+#else
+#define NET_WINDOW			8
+#endif
 
 // NetHeader flags
 #define NETFLAG_LENGTH_MASK	0x0000ffff
@@ -49,6 +63,7 @@ struct qsockaddr
 #define NETFLAG_NAK			0x00040000
 #define NETFLAG_EOM			0x00080000
 #define NETFLAG_UNRELIABLE	0x00100000
+#define NETFLAG_SACK		0x00200000	// on an ACK: receiver buffers as many out-of-order fragments as the long after the header says
 #define NETFLAG_CTL			0x80000000
 
 
@@ -104,6 +119,15 @@ struct qsockaddr
 // CCREP_RULE_INFO
 //		string	rule
 //		string	value
+//
+// CCREP_CHALLENGE
+//		long	cookie
+//
+//	The server may answer CCREQ_CONNECT with CCREP_CHALLENGE instead of
+//	accepting it.  The client then repeats the request with a CCREP_CHALLENGE
+//	byte and the cookie as a long after everything else, which proves it can
+//	receive at its address before the server commits a socket to it.  Only a
+//	request of 17 (plain) or 24 (ProQuake) bytes carries a cookie.
 
 //	note:
 //		There are two address forms used above.  The short form is just a
@@ -127,6 +151,7 @@ struct qsockaddr
 #define CCREP_PLAYER_INFO	0x84
 #define CCREP_RULE_INFO		0x85
 #define CCREP_RCON			0x86
+#define CCREP_CHALLENGE		0x87
 
 // JPG - support for mods
 #define MOD_NONE			0x00
@@ -140,6 +165,28 @@ struct qsockaddr
 extern sizebuf_t	rcon_message;
 extern qboolean		rcon_active;
 
+// per connection telemetry, see net_stats
+#define NET_HISTOGRAM		8		// buckets, each twice as wide as the one before
+
+typedef struct
+{
+	unsigned int	bytesSent, bytesReceived;
+	int				packetsSent, packetsReceived;
+	int				messagesSent, messagesReceived;
+	int				unreliableSent, unreliableReceived;
+	int				resent;				// reliable fragments sent again
+	int				dropped;			// unreliable datagrams never seen
+	int				duplicates;
+	int				sendSizes[NET_HISTOGRAM];		// from 32 bytes
+	int				receiveSizes[NET_HISTOGRAM];
+	int				rttSamples;
+	double			rttMin, rttMax;
+	double			lastRtt;
+	double			jitter;				// smoothed RTT variation, as in RFC 3550
+	int				rttHistogram[NET_HISTOGRAM];	// from 10 ms
+	int				jitterHistogram[NET_HISTOGRAM];	// from 2 ms
+} netstats_t;
+
 typedef struct qsocket_s
 {
 	struct qsocket_s	*next;
@@ -177,6 +224,42 @@ typedef struct qsocket_s
 	int				client_port;
 	qboolean		net_wait;		// JPG 3.40 - wait for the client to send a packet to the private port
 	byte			encrypt;		// JPG 3.50
+
+	// sliding window reliable transfer, used once the peer has sent an
+	// ACK carrying NETFLAG_SACK.  sendFragments == 0 means the message in
+	// flight (if any) goes out one datagram at a time the old way.
+	qboolean		windowed;
+	int				sendWindow;		// fragments in flight: ours or the peer's NET_WINDOW, whichever is smaller
+	unsigned int	sendFirstSequence;
+	int				sendFragments;
+	unsigned int	sendSent;		// bitmasks indexed by fragment number
+	unsigned int	sendAcked;
+	unsigned int	sendResent;
+	double			sendFragmentTime[NET_MAXFRAGMENTS];
+	double			rtt;			// smoothed round trip time, 0 until sampled
+
+	struct
+	{
+		unsigned int	sequence;
+		int				length;		// 0 = slot empty
+		qboolean		eom;
+		byte			data[MAX_DATAGRAM];
+	} receiveWindow[NET_WINDOW];
+
+	struct net_rxring_s	*rxring;	// filled by the receive thread, NULL if not in use
+	double			receiveTime;	// when the last message's final datagram arrived
+	double			receiveDelay;	// summed time messages waited before being read
+	int				receiveDelayCount;
+
+	// NET_SendToAll message not yet handed to the reliable channel
+	int				broadcastLength;
+	byte			broadcast[NET_MAXBROADCAST];
+	double			broadcastStart;
+	double			broadcastDeadline;	// nonzero until it has been acknowledged
+	qboolean		broadcastFailed;	// missed the deadline, connection is dropped
+	qboolean		lingering;			// closed, but still delivering a broadcast
+
+	netstats_t		stats;
 } qsocket_t;
 
 extern qsocket_t	*net_activeSockets;
@@ -246,6 +329,9 @@ extern int		messagesSent;
 extern int		messagesReceived;
 extern int		unreliableMessagesSent;
 extern int		unreliableMessagesReceived;
+extern int		broadcastTimeouts;
+extern double	broadcastStall;
+extern double	broadcastComplete;
 
 qsocket_t *NET_NewQSocket (void);
 void NET_FreeQSocket(qsocket_t *);
@@ -292,6 +378,7 @@ extern unsigned short ntohs (unsigned short netshort);
 
 extern	double		net_time;
 extern	sizebuf_t	net_message;
+extern	int			loop_benchframes;		// loop_bench running, frames uncapped
 extern	int			net_activeconnections;
 
 void		NET_Init (void);
@@ -322,7 +409,12 @@ int			NET_SendUnreliableMessage (struct qsocket_s *sock, sizebuf_t *data);
 // returns -1 if the connection died
 
 int			NET_SendToAll(sizebuf_t *data, int blocktime);
-// This is a reliable *blocking* send to all attached clients.
+// Queues a reliable message for all attached clients.  Each connection
+// sends it ahead of anything else over the following frames; a client
+// that hasn't acknowledged it within blocktime seconds is dropped.
+// Returns the number of clients it couldn't be queued for.
+// With net_syncbroadcast 1 it blocks until delivered, returning the
+// number of clients that missed it.
 
 
 void		NET_Close (struct qsocket_s *sock);
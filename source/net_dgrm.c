@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 #include "net_dgrm.h"
+#include "net_sim.h"
 
 // This is enables a simple IP banning mechanism
 #ifdef PSP_NETWORKING_CODE
@@ -86,7 +87,7 @@ struct
 {
 	unsigned int	length;
 	unsigned int	sequence;
-	byte			data[MAX_DATAGRAM];
+	byte			data[MAX_EXTDATAGRAM];
 } packetBuffer;
 
 extern int m_return_state;
@@ -174,6 +175,430 @@ void NET_Ban_f (void)
 #endif
 
 
+/*
+=============================================================================
+
+RECEIVE THREAD
+
+With net_rxthread 1 a thread reads the connected sockets, so packets leave
+the system's buffers even while the main thread is stuck in a long frame.
+Each qsocket gets a single producer / single consumer ring: the thread only
+advances head, the main thread only advances tail, and a full barrier sits
+between touching a packet and moving either index past it.  rx_lock just
+guards the list of rings against sockets coming and going.
+
+The only socket call made off the main thread is the lan driver's Read, on
+the socket of a connected qsocket that Datagram_Read has handed over.  The
+main thread keeps making every other call, Write included, on that same
+socket, so a driver's Read must be safe alongside its Write on one socket
+(the PSP inet and adhoc calls are).
+Control, accept and connect-time reads, opening and closing all stay on
+the main thread, and a socket is only closed after its ring is unlinked.
+=============================================================================
+*/
+
+#ifdef PSP_LOW_MEMORY_SYSTEM
+#define NET_RXRING		16		// must be a power of two
+#else
+#define NET_RXRING		64
+#endif
+
+typedef struct
+{
+	double				time;		// when the thread read it
+	int					length;		// -1 passes a read error on
+	struct qsockaddr	addr;
+	byte				data[NET_DATAGRAMSIZE];
+} net_rxpacket_t;
+
+typedef struct net_rxring_s
+{
+	struct net_rxring_s	*next;
+	int					landriver;
+	int					socket;
+	qboolean			failed;
+	qboolean			detached;	// off the list, the main thread is draining what's left
+	volatile unsigned int	head;
+	volatile unsigned int	tail;
+	net_rxpacket_t		packets[NET_RXRING];
+} net_rxring_t;
+
+cvar_t	net_rxthread = {"net_rxthread", "0"};
+
+static net_rxring_t		*rx_rings;
+static volatile qboolean rx_quit;
+static qboolean			rx_running;
+
+#ifdef PSP_NETWORKING_CODE
+static SceUID	rx_thread;
+static SceUID	rx_lock;
+#define RX_Lock()	sceKernelWaitSema (rx_lock, 1, NULL)
+#define RX_Unlock()	sceKernelSignalSema (rx_lock, 1)
+#else
+#include <pthread.h>
+#include <unistd.h>
+static pthread_t		rx_thread;
+static pthread_mutex_t	rx_lock = PTHREAD_MUTEX_INITIALIZER;
+#define RX_Lock()	pthread_mutex_lock (&rx_lock)
+#define RX_Unlock()	pthread_mutex_unlock (&rx_lock)
+#endif
+
+static void Datagram_RX_Drain (void)
+{
+	net_rxring_t	*r;
+	net_rxpacket_t	*p;
+	int				len;
+
+	for (r = rx_rings ; r ; r = r->next)
+	{
+		while (!r->failed && r->head - r->tail < NET_RXRING)
+		{
+			p = &r->packets[r->head & (NET_RXRING - 1)];
+			len = net_landrivers[r->landriver].Read (r->socket, p->data, NET_DATAGRAMSIZE, &p->addr);
+			if (len == 0)
+				break;
+			p->length = len;
+			p->time = Sys_DoubleTime ();
+			if (len == -1)
+				r->failed = true;
+			__sync_synchronize ();	// packet contents before head
+			r->head++;
+		}
+	}
+}
+
+#ifdef PSP_NETWORKING_CODE
+static int Datagram_RX_Thread (SceSize args, void *argp)
+#else
+static void *Datagram_RX_Thread (void *arg)
+#endif
+{
+	while (!rx_quit)
+	{
+		RX_Lock ();
+		Datagram_RX_Drain ();
+		RX_Unlock ();
+#ifdef PSP_NETWORKING_CODE
+		sceKernelDelayThread (1000);
+#else
+		usleep (1000);
+#endif
+	}
+	return 0;
+}
+
+static qboolean Datagram_RX_Start (void)
+{
+	rx_quit = false;
+#ifdef PSP_NETWORKING_CODE
+	if ((rx_lock = sceKernelCreateSema ("net_rx_lock", 0, 1, 1, NULL)) < 0)
+		return false;
+	// above the main thread (0x20), so a long frame can't starve it
+	rx_thread = sceKernelCreateThread ("net_rx_thread", Datagram_RX_Thread, 0x1c, 0x4000, PSP_THREAD_ATTR_USER, NULL);
+	if (rx_thread < 0 || sceKernelStartThread (rx_thread, 0, NULL) < 0)
+	{
+		sceKernelDeleteSema (rx_lock);
+		return false;
+	}
+#else
+	if (pthread_create (&rx_thread, NULL, Datagram_RX_Thread, NULL))
+		return false;
+#endif
+	rx_running = true;
+	return true;
+}
+
+static void Datagram_RX_Stop (void)
+{
+	if (!rx_running)
+		return;
+
+	rx_quit = true;
+#ifdef PSP_NETWORKING_CODE
+	sceKernelWaitThreadEnd (rx_thread, NULL);
+	sceKernelDeleteThread (rx_thread);
+	sceKernelDeleteSema (rx_lock);
+#else
+	pthread_join (rx_thread, NULL);
+#endif
+	rx_running = false;
+}
+
+static void Datagram_RX_Register (qsocket_t *sock)
+{
+	net_rxring_t	*r;
+
+	if (!rx_running && !Datagram_RX_Start ())
+	{
+		Con_Printf ("Couldn't start the network receive thread\n");
+		Cvar_SetValueByRef (&net_rxthread, 0);
+		return;
+	}
+
+	if (!(r = malloc (sizeof(net_rxring_t))))
+		return;
+	r->landriver = sock->landriver;
+	r->socket = sock->socket;
+	r->failed = false;
+	r->detached = false;
+	r->head = r->tail = 0;
+
+	RX_Lock ();
+	r->next = rx_rings;
+	rx_rings = r;
+	RX_Unlock ();
+
+	sock->rxring = r;
+}
+
+static void Datagram_RX_Unlink (net_rxring_t *r)
+{
+	net_rxring_t	**link;
+
+	RX_Lock ();
+	for (link = &rx_rings ; *link ; link = &(*link)->next)
+		if (*link == r)
+		{
+			*link = r->next;
+			break;
+		}
+	r->detached = true;
+	RX_Unlock ();
+}
+
+static void Datagram_RX_Unregister (qsocket_t *sock)
+{
+	if (!sock->rxring->detached)
+		Datagram_RX_Unlink (sock->rxring);
+	free (sock->rxring);
+	sock->rxring = NULL;
+}
+
+/*
+==================
+Datagram_Read
+
+Reads the next datagram for a connected socket, from its ring when the
+receive thread is running.  *time is when the datagram was taken off the
+socket.
+==================
+*/
+static int Datagram_Read (qsocket_t *sock, byte *buf, int len, struct qsockaddr *addr, double *time)
+{
+	net_rxring_t	*r;
+	net_rxpacket_t	*p;
+
+	if (net_rxthread.value && !sock->rxring)
+		Datagram_RX_Register (sock);
+
+	if ((r = sock->rxring))
+	{
+		// turned off: stop the thread filling it, drain it, then go back
+		// to reading directly
+		if (!net_rxthread.value && !r->detached)
+			Datagram_RX_Unlink (r);
+
+		if (r->tail != r->head)
+		{
+			__sync_synchronize ();	// head before packet contents
+			p = &r->packets[r->tail & (NET_RXRING - 1)];
+			if ((len = p->length) > 0)
+			{
+				if (len > NET_DATAGRAMSIZE)
+					len = NET_DATAGRAMSIZE;
+				memcpy (buf, p->data, len);
+				*addr = p->addr;
+				*time = p->time;
+			}
+			__sync_synchronize ();	// packet copied out before tail frees the slot
+			r->tail++;
+			return len;
+		}
+
+		if (!r->detached)
+			return 0;
+
+		Datagram_RX_Unregister (sock);
+	}
+
+	*time = net_time;
+	return sfunc.Read (sock->socket, buf, len, addr);
+}
+
+//=============================================================================
+
+#ifndef PSP_NETWORKING_CODE	// the PSP build never resends
+/*
+==================
+Datagram_RTO
+
+How long an unacknowledged fragment waits before it is sent again
+==================
+*/
+static double Datagram_RTO (qsocket_t *sock)
+{
+	double	rto;
+
+	if (!sock->rtt)
+		return 1.0;
+
+	rto = sock->rtt * 2;
+	if (rto < 0.2)
+		rto = 0.2;
+	else if (rto > 1.0)
+		rto = 1.0;
+	return rto;
+}
+#endif
+
+
+static int Datagram_Bucket (double value, double base)
+{
+	int		i;
+
+	for (i = 0 ; i < NET_HISTOGRAM - 1 && value >= base ; i++)
+		base *= 2;
+	return i;
+}
+
+
+/*
+==================
+Datagram_SampleRTT
+
+Folds the time from a datagram to its ACK into the smoothed RTT and the
+connection's telemetry
+==================
+*/
+static void Datagram_SampleRTT (qsocket_t *sock, double sample)
+{
+	netstats_t	*st = &sock->stats;
+	double		delta;
+
+	if (sock->rtt)
+		sock->rtt = sock->rtt * 0.875 + sample * 0.125;
+	else
+		sock->rtt = sample;
+
+	if (st->rttSamples)
+	{
+		delta = sample - st->lastRtt;
+		if (delta < 0)
+			delta = -delta;
+		st->jitter += (delta - st->jitter) / 16;
+		st->jitterHistogram[Datagram_Bucket (delta, 0.002)]++;
+		if (sample < st->rttMin)
+			st->rttMin = sample;
+		if (sample > st->rttMax)
+			st->rttMax = sample;
+	}
+	else
+		st->rttMin = st->rttMax = sample;
+	st->lastRtt = sample;
+	st->rttSamples++;
+	st->rttHistogram[Datagram_Bucket (sample, 0.010)]++;
+}
+
+
+/*
+==================
+Datagram_LanWrite
+
+Every datagram the connections and the control path send goes through
+here, so the impairment simulator can hold on to it
+==================
+*/
+static int Datagram_LanWrite (int landriver, int socket, byte *data, int len, struct qsockaddr *addr)
+{
+	if (Sim_Active ())
+		return Sim_Write (landriver, socket, data, len, addr);
+	return net_landrivers[landriver].Write (socket, data, len, addr);
+}
+
+
+static int Datagram_SocketWrite (qsocket_t *sock, byte *data, int len, struct qsockaddr *addr)
+{
+	int		ret;
+
+	ret = Datagram_LanWrite (sock->landriver, sock->socket, data, len, addr);
+	if (ret != -1)
+	{
+		sock->stats.packetsSent++;
+		sock->stats.bytesSent += len;
+	}
+	return ret;
+}
+
+
+/*
+==================
+Datagram_SendWindow
+
+Sends every fragment of the current message that lies inside the window
+and has not been sent yet, or whose ACK is overdue.
+==================
+*/
+static int Datagram_SendWindow (qsocket_t *sock)
+{
+	unsigned int	packetLen, dataLen, eom, bit;
+	int				k, first, limit;
+
+	sock->sendNext = false;
+
+	first = sock->ackSequence - sock->sendFirstSequence;
+	limit = first + sock->sendWindow;
+	if (limit > sock->sendFragments)
+		limit = sock->sendFragments;
+
+	for (k = first ; k < limit ; k++)
+	{
+		bit = 1 << k;
+		if (sock->sendAcked & bit)
+			continue;
+
+		if (sock->sendSent & bit)
+		{
+#ifdef PSP_NETWORKING_CODE
+			continue;
+#else
+			if ((net_time - sock->sendFragmentTime[k]) < Datagram_RTO (sock))
+				continue;
+			sock->sendResent |= bit;
+			packetsReSent++;
+			sock->stats.resent++;
+#endif
+		}
+		else
+		{
+			sock->sendSent |= bit;
+			packetsSent++;
+		}
+
+		dataLen = sock->sendMessageLength - k * MAX_DATAGRAM;
+		if (dataLen <= MAX_DATAGRAM)
+			eom = NETFLAG_EOM;
+		else
+		{
+			dataLen = MAX_DATAGRAM;
+			eom = 0;
+		}
+		packetLen = NET_HEADERSIZE + dataLen;
+
+		packetBuffer.length = BigLong(packetLen | (NETFLAG_DATA | eom));
+		packetBuffer.sequence = BigLong(sock->sendFirstSequence + k);
+		memcpy (packetBuffer.data, sock->sendMessage + k * MAX_DATAGRAM, dataLen);
+
+		if (Datagram_SocketWrite (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+			return -1;
+
+		sock->sendFragmentTime[k] = net_time;
+		sock->lastSendTime = net_time;
+	}
+
+	return 1;
+}
+
+
 int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 {
 	unsigned int	packetLen, dataLen, eom;
@@ -191,6 +616,18 @@ int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 
 	memcpy(sock->sendMessage, data->data, data->cursize);
 	sock->sendMessageLength = data->cursize;
+	sock->stats.messagesSent++;
+	sock->stats.sendSizes[Datagram_Bucket (data->cursize, 32)]++;
+
+	if (sock->windowed)
+	{
+		sock->sendFragments = (data->cursize + MAX_DATAGRAM - 1) / MAX_DATAGRAM;
+		sock->sendFirstSequence = sock->sendSequence;
+		sock->sendSequence += sock->sendFragments;
+		sock->sendSent = sock->sendAcked = sock->sendResent = 0;
+		sock->canSend = false;
+		return Datagram_SendWindow (sock);
+	}
 
 	if (data->cursize <= MAX_DATAGRAM)
 	{
@@ -209,8 +646,9 @@ int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 	memcpy (packetBuffer.data, sock->sendMessage, dataLen);
 
 	sock->canSend = false;
+	sock->sendResent = 0;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_SocketWrite (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -223,6 +661,9 @@ int SendMessageNext (qsocket_t *sock)
 {
 	unsigned int	packetLen, dataLen, eom;
 
+	if (sock->sendFragments)
+		return Datagram_SendWindow (sock);
+
 	if (sock->sendMessageLength <= MAX_DATAGRAM)
 	{
 		dataLen = sock->sendMessageLength;
@@ -240,8 +681,9 @@ int SendMessageNext (qsocket_t *sock)
 	memcpy (packetBuffer.data, sock->sendMessage, dataLen);
 
 	sock->sendNext = false;
+	sock->sendResent = 0;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_SocketWrite (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -254,6 +696,9 @@ int ReSendMessage (qsocket_t *sock)
 {
 	unsigned int	packetLen, dataLen, eom;
 
+	if (sock->sendFragments)
+		return Datagram_SendWindow (sock);
+
 	if (sock->sendMessageLength <= MAX_DATAGRAM)
 	{
 		dataLen = sock->sendMessageLength;
@@ -271,12 +716,14 @@ int ReSendMessage (qsocket_t *sock)
 	memcpy (packetBuffer.data, sock->sendMessage, dataLen);
 
 	sock->sendNext = false;
+	sock->sendResent = 1;		// its ACK can't be timed
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_SocketWrite (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
 	packetsReSent++;
+	sock->stats.resent++;
 	return 1;
 }
 
@@ -304,7 +751,7 @@ int Datagram_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 	if (data->cursize == 0)
 		Sys_Error("Datagram_SendUnreliableMessage: zero length message\n");
 
-	if (data->cursize > MAX_DATAGRAM)
+	if (data->cursize > MAX_EXTDATAGRAM)
 		Sys_Error("Datagram_SendUnreliableMessage: message too big %u\n", data->cursize);
 #endif
 
@@ -313,8 +760,10 @@ int Datagram_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 	packetBuffer.length = BigLong(packetLen | NETFLAG_UNRELIABLE);
 	packetBuffer.sequence = BigLong(sock->unreliableSendSequence++);
 	memcpy (packetBuffer.data, data->data, data->cursize);
+	sock->stats.unreliableSent++;
+	sock->stats.sendSizes[Datagram_Bucket (data->cursize, 32)]++;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_SocketWrite (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	packetsSent++;
@@ -322,22 +771,75 @@ int Datagram_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 }
 
 
+/*
+==================
+Datagram_ReceiveFragment
+
+Appends the in-sequence fragment to the message being assembled.
+Returns true when it completed a message, which is then in net_message.
+==================
+*/
+static qboolean Datagram_ReceiveFragment (qsocket_t *sock, byte *data, int length, qboolean eom)
+{
+	sock->receiveSequence++;
+
+	if (eom)
+	{
+		SZ_Clear(&net_message);
+		SZ_Write(&net_message, sock->receiveMessage, sock->receiveMessageLength);
+		SZ_Write(&net_message, data, length);
+		sock->receiveMessageLength = 0;
+		return true;
+	}
+
+	memcpy(sock->receiveMessage + sock->receiveMessageLength, data, length);
+	sock->receiveMessageLength += length;
+	return false;
+}
+
+
 int	Datagram_GetMessage (qsocket_t *sock)
 {
 	unsigned int	length, flags;
-	int				ret = 0;
+	int				ret = 0, readlength, window;
 	struct qsockaddr readaddr;
-	unsigned int	sequence, count;
+	unsigned int	sequence, count, bit;
+	unsigned int	ack[3];
+	double			packettime;
+
+	Sim_Run ();
+
+	packettime = sock->receiveTime;
 
 #if !defined(PSP_NETWORKING_CODE)
 	if (!sock->canSend)
-		if ((net_time - sock->lastSendTime) > 1.0)
+	{
+		if (sock->sendFragments)
+			Datagram_SendWindow (sock);
+		else if ((net_time - sock->lastSendTime) > 1.0)
 			ReSendMessage (sock);
+	}
 #endif
 
 	while(1)
 	{
-		length = sfunc.Read (sock->socket, (byte *)&packetBuffer, NET_DATAGRAMSIZE, &readaddr);
+		// fragments that arrived ahead of a lost one go first
+		if (sock->receiveWindow[sock->receiveSequence % NET_WINDOW].length
+		 && sock->receiveWindow[sock->receiveSequence % NET_WINDOW].sequence == sock->receiveSequence)
+		{
+			int		slot = sock->receiveSequence % NET_WINDOW;
+
+			length = sock->receiveWindow[slot].length;
+			sock->receiveWindow[slot].length = 0;
+			if (Datagram_ReceiveFragment (sock, sock->receiveWindow[slot].data, length, sock->receiveWindow[slot].eom))
+			{
+				ret = 1;
+				break;
+			}
+			continue;
+		}
+
+		length = Datagram_Read (sock, (byte *)&packetBuffer, NET_DATAGRAMSIZE, &readaddr, &packettime);
 
 //	if ((rand() & 255) > 220)
 //		continue;
@@ -350,6 +852,7 @@ int	Datagram_GetMessage (qsocket_t *sock)
 			Con_Printf("Read error\n");
 			return -1;
 		}
+		readlength = length;
 #ifdef PROQUAKE_EXTENSION
 		// JPG 3.40 - added !sock->net_wait (NAT fix)
 		if (!sock->net_wait && sfunc.AddrCompare(&readaddr, &sock->addr) != 0)
@@ -365,139 +868,741 @@ int	Datagram_GetMessage (qsocket_t *sock)
 			continue;
 		}
 
+		sock->stats.packetsReceived++;
+		sock->stats.bytesReceived += length;
+
 		if (length < NET_HEADERSIZE)
 		{
 			shortPacketCount++;
 			continue;
 		}
 
-		length = BigLong(packetBuffer.length);
-		flags = length & (~NETFLAG_LENGTH_MASK);
-		length &= NETFLAG_LENGTH_MASK;
+		length = BigLong(packetBuffer.length);
+		flags = length & (~NETFLAG_LENGTH_MASK);
+		length &= NETFLAG_LENGTH_MASK;
+
+		// JPG 3.20 - fix for attack that crashes server
+		if (length > NET_DATAGRAMSIZE)
+		{
+			Con_Printf("Invalid length\n");
+			return -1;
+		}
+
+		if (flags & NETFLAG_CTL)
+			continue;
+
+		// the header's length is trusted from here on, so it must fit
+		// what was actually read
+		if (length < NET_HEADERSIZE || length > readlength)
+		{
+			shortPacketCount++;
+			continue;
+		}
+
+		sequence = BigLong(packetBuffer.sequence);
+		packetsReceived++;
+#ifdef PROQUAKE_EXTENSION
+		// JPG 3.40 - NAT fix
+		if (sock->net_wait)
+		{
+			sock->addr = readaddr;
+			strcpy(sock->address, sfunc.AddrToString(&readaddr));
+			sock->net_wait = false;
+		}
+#endif
+		if (flags & NETFLAG_UNRELIABLE)
+		{
+			if (sequence < sock->unreliableReceiveSequence)
+			{
+				Con_DPrintf("Got a stale datagram\n");
+				ret = 0;
+				break;
+			}
+			if (sequence != sock->unreliableReceiveSequence)
+			{
+				count = sequence - sock->unreliableReceiveSequence;
+				droppedDatagrams += count;
+				sock->stats.dropped += count;
+				Con_DPrintf("Dropped %u datagram(s)\n", count);
+			}
+			sock->unreliableReceiveSequence = sequence + 1;
+
+			length -= NET_HEADERSIZE;
+
+			SZ_Clear (&net_message);
+			SZ_Write (&net_message, packetBuffer.data, length);
+
+			ret = 2;
+			break;
+		}
+
+		if (flags & NETFLAG_ACK)
+		{
+			// the window is what both ends can handle; a SACK without
+			// a size is treated as no window at all
+			if ((flags & NETFLAG_SACK) && readlength >= NET_HEADERSIZE + 4)
+			{
+				window = BigLong (*(int *)packetBuffer.data);
+				if (window > NET_WINDOW)
+					window = NET_WINDOW;
+				if (window > 1)
+				{
+					sock->sendWindow = window;
+					sock->windowed = true;
+				}
+			}
+
+			if (sock->sendFragments)
+			{
+				if (sequence < sock->sendFirstSequence || sequence >= sock->sendSequence)
+				{
+					Con_DPrintf("Stale ACK received\n");
+					continue;
+				}
+				bit = 1 << (sequence - sock->sendFirstSequence);
+				if (sock->sendAcked & bit)
+				{
+					Con_DPrintf("Duplicate ACK received\n");
+					continue;
+				}
+				sock->sendAcked |= bit;
+
+				// Karn: a resent fragment's ACK is ambiguous, so don't time it
+				if (!(sock->sendResent & bit))
+					Datagram_SampleRTT (sock, net_time - sock->sendFragmentTime[sequence - sock->sendFirstSequence]);
+
+				while (sock->ackSequence != sock->sendSequence
+				 && (sock->sendAcked & (1 << (sock->ackSequence - sock->sendFirstSequence))))
+					sock->ackSequence++;
+
+				if (sock->ackSequence == sock->sendSequence)
+				{
+					sock->sendFragments = 0;
+					sock->sendMessageLength = 0;
+					sock->canSend = true;
+				}
+				else
+					sock->sendNext = true;	// the window may have moved
+				continue;
+			}
+
+			if (sequence != (sock->sendSequence - 1))
+			{
+				Con_DPrintf("Stale ACK received\n");
+				continue;
+			}
+			if (sequence == sock->ackSequence)
+			{
+				if (!sock->sendResent)
+					Datagram_SampleRTT (sock, net_time - sock->lastSendTime);
+				sock->ackSequence++;
+				if (sock->ackSequence != sock->sendSequence)
+					Con_DPrintf("ack sequencing error\n");
+			}
+			else
+			{
+				Con_DPrintf("Duplicate ACK received\n");
+				continue;
+			}
+			sock->sendMessageLength -= MAX_DATAGRAM;
+			if (sock->sendMessageLength > 0)
+			{
+				memcpy(sock->sendMessage, sock->sendMessage+MAX_DATAGRAM, sock->sendMessageLength);
+				sock->sendNext = true;
+			}
+			else
+			{
+				sock->sendMessageLength = 0;
+				sock->canSend = true;
+			}
+			continue;
+		}
+
+		if (flags & NETFLAG_DATA)
+		{
+			// only unreliable datagrams may be larger
+			if (length > MAX_DATAGRAM + NET_HEADERSIZE)
+			{
+				shortPacketCount++;
+				continue;
+			}
+
+			// beyond what we can buffer; the sender will try again
+			if (sequence - sock->receiveSequence < 0x80000000 && sequence - sock->receiveSequence >= NET_WINDOW)
+				continue;
+
+			length -= NET_HEADERSIZE;
+
+			// hold on to a fragment that arrived ahead of a lost one
+			if (sequence != sock->receiveSequence && sequence - sock->receiveSequence < NET_WINDOW)
+			{
+				int		slot = sequence % NET_WINDOW;
+
+				sock->receiveWindow[slot].sequence = sequence;
+				sock->receiveWindow[slot].length = length;
+				sock->receiveWindow[slot].eom = (flags & NETFLAG_EOM) != 0;
+				memcpy (sock->receiveWindow[slot].data, packetBuffer.data, length);
+			}
+
+			// old engines skip what follows an ACK's header
+			ack[0] = BigLong((NET_HEADERSIZE + 4) | NETFLAG_ACK | NETFLAG_SACK);
+			ack[1] = BigLong(sequence);
+			ack[2] = BigLong(NET_WINDOW);
+			Datagram_SocketWrite (sock, (byte *)ack, NET_HEADERSIZE + 4, &readaddr);
+
+			if (sequence != sock->receiveSequence)
+			{
+				if (sequence - sock->receiveSequence >= NET_WINDOW)
+				{
+					receivedDuplicateCount++;
+					sock->stats.duplicates++;
+				}
+				continue;
+			}
+
+			if (Datagram_ReceiveFragment (sock, packetBuffer.data, length, (flags & NETFLAG_EOM) != 0))
+			{
+				ret = 1;
+				break;
+			}
+			continue;
+		}
+	}
+
+	if (sock->sendNext)
+		SendMessageNext (sock);
+
+	if (ret > 0)
+	{
+		if (ret == 1)
+			sock->stats.messagesReceived++;
+		else
+			sock->stats.unreliableReceived++;
+		sock->stats.receiveSizes[Datagram_Bucket (net_message.cursize, 32)]++;
+		sock->receiveTime = packettime;
+		sock->receiveDelay += net_time - packettime;
+		sock->receiveDelayCount++;
+	}
+
+	return ret;
+}
+
+
+void PrintTelemetry(qsocket_t *s);
+
+void PrintStats(qsocket_t *s)
+{
+	Con_Printf("canSend = %4u   \n", s->canSend);
+	Con_Printf("sendSeq = %4u   ", s->sendSequence);
+	Con_Printf("recvSeq = %4u   \n", s->receiveSequence);
+	Con_Printf("window  = %4i   ", s->windowed ? s->sendWindow : 0);
+	Con_Printf("rtt     = %4i ms\n", (int)(s->rtt * 1000));
+	if (s->receiveDelayCount)
+		Con_Printf("rxdelay = %4.1f ms avg over %i messages\n", s->receiveDelay * 1000 / s->receiveDelayCount, s->receiveDelayCount);
+	if (s->driver)
+		PrintTelemetry(s);
+	Con_Printf("\n");
+}
+
+/*
+=============================================================================
+
+TELEMETRY
+
+Every datagram connection keeps its own counters and histograms, shown by
+net_stats <address> or net_stats *.  Set net_statslog to a number of
+seconds, and they are appended to net_statsfile in the game directory at
+that interval.  The file is JSON lines if its name ends in .json, and CSV
+otherwise.
+=============================================================================
+*/
+
+cvar_t	net_statslog = {"net_statslog", "0"};
+cvar_t	net_statsfile = {"net_statsfile", "netstats.csv"};
+
+static void PrintHistogram (char *name, int *buckets, int base, char *unit)
+{
+	int		i;
+
+	Con_Printf("%-7s", name);
+	for (i = 0 ; i < NET_HISTOGRAM - 1 ; i++, base *= 2)
+		Con_Printf(" <%i%s %i", base, unit, buckets[i]);
+	Con_Printf(" more %i\n", buckets[i]);
+}
+
+void PrintTelemetry(qsocket_t *s)
+{
+	netstats_t	*st = &s->stats;
+
+	Con_Printf("bytes   = %u out, %u in\n", st->bytesSent, st->bytesReceived);
+	Con_Printf("packets = %i out, %i in\n", st->packetsSent, st->packetsReceived);
+	Con_Printf("reliable   %i out, %i in, %i resent, %i duplicates\n", st->messagesSent, st->messagesReceived, st->resent, st->duplicates);
+	Con_Printf("unreliable %i out, %i in, %i dropped\n", st->unreliableSent, st->unreliableReceived, st->dropped);
+	if (st->rttSamples)
+		Con_Printf("rtt     = %i-%i ms, jitter %.1f ms over %i samples\n", (int)(st->rttMin * 1000), (int)(st->rttMax * 1000), st->jitter * 1000, st->rttSamples);
+	PrintHistogram("rtt", st->rttHistogram, 10, "ms");
+	PrintHistogram("jitter", st->jitterHistogram, 2, "ms");
+	PrintHistogram("sent", st->sendSizes, 32, "b");
+	PrintHistogram("recv", st->receiveSizes, 32, "b");
+}
+
+static void Datagram_LogHistogram (FILE *f, int *buckets, qboolean json)
+{
+	int		i;
+
+	if (json)
+		fprintf (f, "[");
+	for (i = 0 ; i < NET_HISTOGRAM ; i++)
+		fprintf (f, i ? ",%i" : "%i", buckets[i]);
+	if (json)
+		fprintf (f, "]");
+}
+
+static void Datagram_LogStats (void);
+static PollProcedure	statsPollProcedure = {NULL, 0.0, Datagram_LogStats};
+
+static void Datagram_LogStats (void)
+{
+	static double	lastlog;
+	char			name[MAX_OSPATH];
+	FILE			*f;
+	qsocket_t		*s;
+	netstats_t		*st;
+	qboolean		json;
+	int				i, len;
+
+	SchedulePollProcedure (&statsPollProcedure, 1.0);
+
+	if (net_statslog.value <= 0 || net_time - lastlog < net_statslog.value || !net_activeSockets)
+		return;
+	lastlog = net_time;
+
+	len = strlen (net_statsfile.string);
+	json = (len > 5 && !strcasecmp (net_statsfile.string + len - 5, ".json"));
+	snprintf (name, sizeof(name), "%s/%s", com_gamedir, net_statsfile.string);
+	if (!(f = fopen (name, "a")))
+	{
+		Con_Printf ("Couldn't append to %s, net_statslog disabled\n", name);
+		Cvar_SetValueByRef (&net_statslog, 0);
+		return;
+	}
+
+	fseek (f, 0, SEEK_END);
+	if (!json && !ftell (f))
+	{
+		fprintf (f, "time,address,seconds,bytes_out,bytes_in,packets_out,packets_in,reliable_out,reliable_in,resent,duplicates,"
+			"unreliable_out,unreliable_in,dropped,rtt_ms,rtt_min_ms,rtt_max_ms,jitter_ms");
+		for (i = 0 ; i < NET_HISTOGRAM ; i++)
+			fprintf (f, ",rtt%i", i);
+		for (i = 0 ; i < NET_HISTOGRAM ; i++)
+			fprintf (f, ",jitter%i", i);
+		for (i = 0 ; i < NET_HISTOGRAM ; i++)
+			fprintf (f, ",sent%i", i);
+		for (i = 0 ; i < NET_HISTOGRAM ; i++)
+			fprintf (f, ",recv%i", i);
+		fprintf (f, "\n");
+	}
+
+	for (s = net_activeSockets ; s ; s = s->next)
+	{
+		if (!s->driver || s->disconnected)
+			continue;	// loopback
+		st = &s->stats;
+
+		if (json)
+			fprintf (f, "{\"time\":%.1f,\"address\":\"%s\",\"seconds\":%.1f,\"bytes_out\":%u,\"bytes_in\":%u,"
+				"\"packets_out\":%i,\"packets_in\":%i,\"reliable_out\":%i,\"reliable_in\":%i,\"resent\":%i,\"duplicates\":%i,"
+				"\"unreliable_out\":%i,\"unreliable_in\":%i,\"dropped\":%i,\"rtt_ms\":%.1f,\"rtt_min_ms\":%.1f,\"rtt_max_ms\":%.1f,\"jitter_ms\":%.1f,",
+				net_time, s->address, net_time - s->connecttime, st->bytesSent, st->bytesReceived,
+				st->packetsSent, st->packetsReceived, st->messagesSent, st->messagesReceived, st->resent, st->duplicates,
+				st->unreliableSent, st->unreliableReceived, st->dropped, s->rtt * 1000, st->rttMin * 1000, st->rttMax * 1000, st->jitter * 1000);
+		else
+			fprintf (f, "%.1f,%s,%.1f,%u,%u,%i,%i,%i,%i,%i,%i,%i,%i,%i,%.1f,%.1f,%.1f,%.1f,",
+				net_time, s->address, net_time - s->connecttime, st->bytesSent, st->bytesReceived,
+				st->packetsSent, st->packetsReceived, st->messagesSent, st->messagesReceived, st->resent, st->duplicates,
+				st->unreliableSent, st->unreliableReceived, st->dropped, s->rtt * 1000, st->rttMin * 1000, st->rttMax * 1000, st->jitter * 1000);
+
+		fprintf (f, json ? "\"rtt\":" : "");
+		Datagram_LogHistogram (f, st->rttHistogram, json);
+		fprintf (f, json ? ",\"jitter\":" : ",");
+		Datagram_LogHistogram (f, st->jitterHistogram, json);
+		fprintf (f, json ? ",\"sent\":" : ",");
+		Datagram_LogHistogram (f, st->sendSizes, json);
+		fprintf (f, json ? ",\"recv\":" : ",");
+		Datagram_LogHistogram (f, st->receiveSizes, json);
+		fprintf (f, json ? "}\n" : "\n");
+	}
+
+	fclose (f);
+}
+
+/*
+=============================================================================
+
+CONTROL PATH
+
+Connectionless requests (browser queries, connects, rcon) arrive on the
+accept socket.  Every source address gets a token bucket, and a frame
+handles at most NET_MAXCONTROLPACKETS of them, so a query flood can cost
+only so much.  Server and rule info replies are cached, and rebuilt only
+when what they report has changed; player info carries a clock, so it is
+built every time.  With net_challenge, connects must echo a cookie first,
+so spoofed sources can't tie up qsockets.
+=============================================================================
+*/
+
+#define NET_MAXCONTROLPACKETS	64		// per frame
+#define NET_CONTROLSOURCES		256		// token buckets, a power of two
+#define NET_CONNECTFLOOD		8		// connects a second that turn on net_challenge 2
+#define NET_MAXRULES			64
+
+cvar_t	net_ctlrate = {"net_ctlrate", "10"};		// connects and server info requests a second per source, 0 = unlimited
+cvar_t	net_challenge = {"net_challenge", "2"};		// 0 = never, 1 = always, 2 = during a connect flood
+
+int		controlPacketsDropped = 0;
+
+typedef struct
+{
+	struct qsockaddr	addr;		// port cleared
+	float				tokens;
+	double				time;
+} ctlsource_t;
+
+static ctlsource_t	ctl_sources[NET_CONTROLSOURCES];
+static int			ctl_frame = -1;
+static int			ctl_budget;
+static unsigned int	ctl_secret;
+static double		ctl_connecttime;
+static int			ctl_connects, ctl_lastconnects;
+
+typedef struct
+{
+	int			len;
+	byte		data[MAX_DATAGRAM];
+	char		hostname[256];		// as sent, cheat-free tag and all
+	char		map[MAX_QPATH];
+	int			users;
+	int			maxusers;
+} ctlserverinfo_t;
+
+static ctlserverinfo_t	ctl_serverinfo[MAX_NET_DRIVERS];	// reply holds the accept socket's address
+
+static struct
+{
+	cvar_t	*var;
+	int		ofs, len;
+} ctl_rules[NET_MAXRULES];
+static int			ctl_numrules;
+static qboolean		ctl_rulescomplete;		// false if the cache ran out of room
+static int			ctl_rulegeneration = -1;
+static byte			ctl_rulebuf[4096];
+static byte			ctl_ruleend[8];
+static int			ctl_ruleendlen;
+
+static unsigned int Datagram_Hash (unsigned int h, byte *data, int len)
+{
+	while (len--)
+	{
+		h ^= *data++;
+		h *= 16777619;		// FNV-1a
+	}
+	return h;
+}
+
+/*
+==================
+Datagram_AllowControl
+
+Takes a token from the source's bucket; false if it has none left
+==================
+*/
+static qboolean Datagram_AllowControl (struct qsockaddr *addr)
+{
+	struct qsockaddr	key;
+	ctlsource_t			*src, *oldest = NULL;
+	unsigned int		h;
+	float				rate = net_ctlrate.value;
+	int					i;
+
+	if (rate <= 0)
+		return true;
+
+	memcpy (&key, addr, sizeof(key));
+	dfunc.SetSocketPort (&key, 0);
+	h = Datagram_Hash (2166136261u, (byte *)&key, sizeof(key));
+
+	for (i = 0 ; i < 4 ; i++)
+	{
+		src = &ctl_sources[(h + i) & (NET_CONTROLSOURCES - 1)];
+		if (!memcmp (&src->addr, &key, sizeof(key)))
+			break;
+		if (!oldest || src->time < oldest->time)
+			oldest = src;
+	}
+
+	if (i == 4)
+	{
+		src = oldest;
+		memcpy (&src->addr, &key, sizeof(key));
+		src->tokens = rate * 3;
+	}
+	else
+	{
+		src->tokens += (net_time - src->time) * rate;
+		if (src->tokens > rate * 3)
+			src->tokens = rate * 3;
+	}
+	src->time = net_time;
+
+	if (src->tokens < 1)
+		return false;
+	src->tokens--;
+	return true;
+}
+
+/*
+==================
+Datagram_Cookie
+
+Stateless connect cookie for an address, good for 16 to 32 seconds
+==================
+*/
+static int Datagram_Cookie (struct qsockaddr *addr, int age)
+{
+	int		period = (int)(net_time / 16) - age;
+
+	return Datagram_Hash (Datagram_Hash (ctl_secret, (byte *)addr, sizeof(*addr)), (byte *)&period, sizeof(period));
+}
+
+static qboolean Datagram_ChallengeRequired (void)
+{
+	if (net_time - ctl_connecttime >= 1.0)
+	{
+		ctl_lastconnects = ctl_connects;
+		ctl_connects = 0;
+		ctl_connecttime = net_time;
+	}
+	ctl_connects++;
+
+	if (net_challenge.value == 1)
+		return true;
+	if (net_challenge.value == 2)
+		return ctl_lastconnects + ctl_connects > NET_CONNECTFLOOD;
+	return false;
+}
 
-		// JPG 3.20 - fix for attack that crashes server
-		if (length > NET_DATAGRAMSIZE)
-		{
-			Con_Printf("Invalid length\n");
-			return -1;
-		}
+static void Datagram_SendControl (int acceptsock, byte *data, int len, struct qsockaddr *addr)
+{
+	Datagram_LanWrite (net_landriverlevel, acceptsock, data, len, addr);
+}
 
-		if (flags & NETFLAG_CTL)
-			continue;
+static void Datagram_ServerInfoReply (int acceptsock, struct qsockaddr *clientaddr)
+{
+	ctlserverinfo_t		*c = &ctl_serverinfo[net_landriverlevel];
+	struct qsockaddr	newaddr;
+	sizebuf_t			buf;
+	// JPG 3.50
+	char name[sizeof(c->hostname)];
 
-		sequence = BigLong(packetBuffer.sequence);
-		packetsReceived++;
+	strlcpy (name, hostname.string, sizeof(name));
 #ifdef PROQUAKE_EXTENSION
-		// JPG 3.40 - NAT fix
-		if (sock->net_wait)
-		{
-			sock->addr = readaddr;
-			strcpy(sock->address, sfunc.AddrToString(&readaddr));
-			sock->net_wait = false;
-		}
+	if (pq_cheatfree)
+		strlcat (name, " (cheat-free)", sizeof(name));
 #endif
-		if (flags & NETFLAG_UNRELIABLE)
-		{
-			if (sequence < sock->unreliableReceiveSequence)
-			{
-				Con_DPrintf("Got a stale datagram\n");
-				ret = 0;
-				break;
-			}
-			if (sequence != sock->unreliableReceiveSequence)
-			{
-				count = sequence - sock->unreliableReceiveSequence;
-				droppedDatagrams += count;
-				Con_DPrintf("Dropped %u datagram(s)\n", count);
-			}
-			sock->unreliableReceiveSequence = sequence + 1;
 
-			length -= NET_HEADERSIZE;
+	if (!c->len || strcmp (c->hostname, name) || strcmp (c->map, sv.name)
+	 || c->users != net_activeconnections || c->maxusers != svs.maxclients)
+	{
+		strlcpy (c->hostname, name, sizeof(c->hostname));
+		strlcpy (c->map, sv.name, sizeof(c->map));
+		c->users = net_activeconnections;
+		c->maxusers = svs.maxclients;
 
-			SZ_Clear (&net_message);
-			SZ_Write (&net_message, packetBuffer.data, length);
+		buf.data = c->data;
+		buf.maxsize = sizeof(c->data);
+		buf.cursize = 0;
+		buf.allowoverflow = true;
+		buf.overflowed = false;
+		// save space for the header, filled in later
+		MSG_WriteLong(&buf, 0);
+		MSG_WriteByte(&buf, CCREP_SERVER_INFO);
+		dfunc.GetSocketAddr(acceptsock, &newaddr);
+		MSG_WriteString(&buf, dfunc.AddrToString(&newaddr));
+		MSG_WriteString(&buf, name);	// JPG 3.50 changed hostname.string to name
+		MSG_WriteString(&buf, sv.name);
+		MSG_WriteByte(&buf, net_activeconnections);
+		MSG_WriteByte(&buf, svs.maxclients);
+		MSG_WriteByte(&buf, NET_PROTOCOL_VERSION);
+		*((int *)buf.data) = BigLong(NETFLAG_CTL | (buf.cursize & NETFLAG_LENGTH_MASK));
+		c->len = buf.cursize;
+	}
 
-			ret = 2;
-			break;
-		}
+	Datagram_SendControl (acceptsock, c->data, c->len, clientaddr);
+}
 
-		if (flags & NETFLAG_ACK)
+static void Datagram_PlayerInfoReply (int acceptsock, struct qsockaddr *clientaddr, int playerNumber)
+{
+	int					activeNumber, clientNumber;
+	int					a, b, c;
+	char				address[16];
+	client_t			*client;
+	byte				data[128];
+	sizebuf_t			buf;
+
+	activeNumber = -1;
+	for (clientNumber = 0, client = svs.clients; clientNumber < svs.maxclients; clientNumber++, client++)
+	{
+		if (client->active)
 		{
-			if (sequence != (sock->sendSequence - 1))
-			{
-				Con_DPrintf("Stale ACK received\n");
-				continue;
-			}
-			if (sequence == sock->ackSequence)
-			{
-				sock->ackSequence++;
-				if (sock->ackSequence != sock->sendSequence)
-					Con_DPrintf("ack sequencing error\n");
-			}
-			else
-			{
-				Con_DPrintf("Duplicate ACK received\n");
-				continue;
-			}
-			sock->sendMessageLength -= MAX_DATAGRAM;
-			if (sock->sendMessageLength > 0)
-			{
-				memcpy(sock->sendMessage, sock->sendMessage+MAX_DATAGRAM, sock->sendMessageLength);
-				sock->sendNext = true;
-			}
-			else
-			{
-				sock->sendMessageLength = 0;
-				sock->canSend = true;
-			}
-			continue;
+			activeNumber++;
+			if (activeNumber == playerNumber)
+				break;
 		}
+	}
+	if (clientNumber == svs.maxclients)
+		return;
 
-		if (flags & NETFLAG_DATA)
-		{
-			packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
-			packetBuffer.sequence = BigLong(sequence);
-			sfunc.Write (sock->socket, (byte *)&packetBuffer, NET_HEADERSIZE, &readaddr);
+	// the connect time changes every second, so this one isn't cached
+	buf.data = data;
+	buf.maxsize = sizeof(data);
+	buf.cursize = 0;
+	buf.allowoverflow = true;
+	buf.overflowed = false;
+	// save space for the header, filled in later
+	MSG_WriteLong(&buf, 0);
+	MSG_WriteByte(&buf, CCREP_PLAYER_INFO);
+	MSG_WriteByte(&buf, playerNumber);
+	MSG_WriteString(&buf, client->name);
+	MSG_WriteLong(&buf, client->colors);
+	MSG_WriteLong(&buf, (int)client->edict->v.frags);
+	MSG_WriteLong(&buf, (int)(net_time - client->netconnection->connecttime));
+
+	if (!sv_ipmasking.value) {
+	MSG_WriteString(&buf, client->netconnection->address);
+	} else {
+		if (sscanf(client->netconnection->address, "%d.%d.%d", &a, &b, &c) == 3) // Baker 3.60 - engine side IP masking
+		snprintf(address, sizeof(address), "%d.%d.%d.xxx", a, b, c);
+		else
+			strcpy (address, "private");
+		MSG_WriteString(&buf, address);
+	}
 
-			if (sequence != sock->receiveSequence)
-			{
-				receivedDuplicateCount++;
-				continue;
-			}
-			sock->receiveSequence++;
+	if (buf.overflowed)
+		return;
+	*((int *)buf.data) = BigLong(NETFLAG_CTL | (buf.cursize & NETFLAG_LENGTH_MASK));
 
-			length -= NET_HEADERSIZE;
+	Datagram_SendControl (acceptsock, buf.data, buf.cursize, clientaddr);
+}
 
-			if (flags & NETFLAG_EOM)
-			{
-				SZ_Clear(&net_message);
-				SZ_Write(&net_message, sock->receiveMessage, sock->receiveMessageLength);
-				SZ_Write(&net_message, packetBuffer.data, length);
-				sock->receiveMessageLength = 0;
+static void Datagram_BuildRules (void)
+{
+	cvar_t		*var;
+	sizebuf_t	buf;
 
-				ret = 1;
-				break;
-			}
+	ctl_numrules = 0;
+	ctl_rulescomplete = true;
+	buf.data = ctl_rulebuf;
+	buf.maxsize = sizeof(ctl_rulebuf);
+	buf.cursize = 0;
+	buf.allowoverflow = true;
+	buf.overflowed = false;
 
-			memcpy(sock->receiveMessage + sock->receiveMessageLength, packetBuffer.data, length);
-			sock->receiveMessageLength += length;
+	for (var = cvar_vars ; var ; var = var->next)
+	{
+		if (!var->server)
 			continue;
+		if (ctl_numrules == NET_MAXRULES || buf.cursize + 7 + strlen(var->name) + strlen(var->string) > buf.maxsize)
+		{
+			ctl_rulescomplete = false;
+			break;
 		}
+		ctl_rules[ctl_numrules].var = var;
+		ctl_rules[ctl_numrules].ofs = buf.cursize;
+		// save space for the header, filled in later
+		MSG_WriteLong(&buf, 0);
+		MSG_WriteByte(&buf, CCREP_RULE_INFO);
+		MSG_WriteString(&buf, var->name);
+		MSG_WriteString(&buf, var->string);
+		ctl_rules[ctl_numrules].len = buf.cursize - ctl_rules[ctl_numrules].ofs;
+		*((int *)(buf.data + ctl_rules[ctl_numrules].ofs)) = BigLong(NETFLAG_CTL | ctl_rules[ctl_numrules].len);
+		ctl_numrules++;
+	}
+
+	// the reply after the last rule carries none
+	buf.data = ctl_ruleend;
+	buf.maxsize = sizeof(ctl_ruleend);
+	buf.cursize = 0;
+	MSG_WriteLong(&buf, 0);
+	MSG_WriteByte(&buf, CCREP_RULE_INFO);
+	*((int *)buf.data) = BigLong(NETFLAG_CTL | buf.cursize);
+	ctl_ruleendlen = buf.cursize;
+
+	ctl_rulegeneration = cvar_servergeneration;
+}
+
+static void Datagram_RuleInfoReply (int acceptsock, struct qsockaddr *clientaddr, char *prevCvarName)
+{
+	cvar_t	*var;
+	int		i;
+
+	if (ctl_rulegeneration != cvar_servergeneration)
+		Datagram_BuildRules ();
+
+	// find the search start location
+	if (!*prevCvarName)
+		i = 0;
+	else
+	{
+		for (i = 0 ; i < ctl_numrules ; i++)
+			if (!strcmp (ctl_rules[i].var->name, prevCvarName))
+				break;
+		i = (i < ctl_numrules) ? i + 1 : -1;
 	}
 
-	if (sock->sendNext)
-		SendMessageNext (sock);
+	if (i >= 0 && i < ctl_numrules)
+	{
+		Datagram_SendControl (acceptsock, ctl_rulebuf + ctl_rules[i].ofs, ctl_rules[i].len, clientaddr);
+		return;
+	}
+	if (i == ctl_numrules && ctl_rulescomplete)
+	{
+		Datagram_SendControl (acceptsock, ctl_ruleend, ctl_ruleendlen, clientaddr);
+		return;
+	}
 
-	return ret;
-}
+	// not a cached rule: walk the cvars like before
+	if (*prevCvarName)
+	{
+		var = Cvar_FindVar (prevCvarName);
+		if (!var)
+			return;
+		var = var->next;
+	}
+	else
+		var = cvar_vars;
+
+	// search for the next server cvar
+	while (var)
+	{
+		if (var->server)
+			break;
+		var = var->next;
+	}
 
+	// send the response
 
-void PrintStats(qsocket_t *s)
-{
-	Con_Printf("canSend = %4u   \n", s->canSend);
-	Con_Printf("sendSeq = %4u   ", s->sendSequence);
-	Con_Printf("recvSeq = %4u   \n", s->receiveSequence);
-	Con_Printf("\n");
+	SZ_Clear(&net_message);
+	// save space for the header, filled in later
+	MSG_WriteLong(&net_message, 0);
+	MSG_WriteByte(&net_message, CCREP_RULE_INFO);
+	if (var)
+	{
+		MSG_WriteString(&net_message, var->name);
+		MSG_WriteString(&net_message, var->string);
+	}
+	*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
+	Datagram_SendControl (acceptsock, net_message.data, net_message.cursize, clientaddr);
+	SZ_Clear(&net_message);
 }
 
 void NET_Stats_f (void)
@@ -516,6 +1621,19 @@ void NET_Stats_f (void)
 		Con_Printf("receivedDuplicateCount     = %i\n", receivedDuplicateCount);
 		Con_Printf("shortPacketCount           = %i\n", shortPacketCount);
 		Con_Printf("droppedDatagrams           = %i\n", droppedDatagrams);
+		Con_Printf("controlPacketsDropped      = %i\n", controlPacketsDropped);
+		if (simDropped || simDuplicated || simReordered || simQueued)
+		{
+			Con_Printf("simulator dropped          = %i\n", simDropped);
+			Con_Printf("simulator duplicated       = %i\n", simDuplicated);
+			Con_Printf("simulator reordered        = %i\n", simReordered);
+			Con_Printf("simulator holding          = %i\n", simQueued);
+		}
+		Con_Printf("broadcastTimeouts          = %i\n", broadcastTimeouts);
+		Con_Printf("last broadcast stall       = %.1f ms\n", broadcastStall * 1000);
+		Con_Printf("last broadcast completed   = %.1f ms\n", broadcastComplete * 1000);
+		if (cls.connect_time)
+			Con_Printf("last connect time          = %.2f s\n", cls.connect_time);
 	}
 	else if (strcmp(Cmd_Argv(1), "*") == 0)
 	{
@@ -1009,7 +2127,17 @@ int Datagram_Init (void)
 #ifdef PSP_NETWORKING_CODE
 	if(!host_initialized)
 #endif
+	{
 		Cmd_AddCommand ("net_stats", NET_Stats_f);
+		Cvar_RegisterVariable (&net_rxthread, NULL);
+		Cvar_RegisterVariable (&net_ctlrate, NULL);
+		Cvar_RegisterVariable (&net_challenge, NULL);
+		Cvar_RegisterVariable (&net_statslog, NULL);
+		Cvar_RegisterVariable (&net_statsfile, NULL);
+		Sim_Init ();
+		SchedulePollProcedure (&statsPollProcedure, 1.0);
+		ctl_secret = (unsigned int)(Sys_DoubleTime () * 1000) ^ (rand () << 16) ^ rand ();
+	}
 
 	if (COM_CheckParm("-nolan"))
 		return -1;
@@ -1053,6 +2181,9 @@ void Datagram_Shutdown (void)
 {
 	int i;
 
+	Datagram_RX_Stop ();
+	Sim_Shutdown ();
+
 // shutdown the lan drivers
 	for (i = 0; i < net_numlandrivers; i++)
 	{
@@ -1067,6 +2198,9 @@ void Datagram_Shutdown (void)
 
 void Datagram_Close (qsocket_t *sock)
 {
+	if (sock->rxring)
+		Datagram_RX_Unregister (sock);
+	Sim_CloseSocket (sock->landriver, sock->socket);
 	sfunc.CloseSocket(sock->socket);
 }
 
@@ -1089,7 +2223,7 @@ qsocket_t *Datagram_Reject (char *message, int acceptsock, struct qsockaddr *add
 	MSG_WriteByte(&net_message, CCREP_REJECT);
 	MSG_WriteString(&net_message, message);
 	*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-	dfunc.Write (acceptsock, net_message.data, net_message.cursize, addr);
+	Datagram_SendControl (acceptsock, net_message.data, net_message.cursize, addr);
 	SZ_Clear(&net_message);
 
 	return NULL;
@@ -1100,29 +2234,31 @@ extern cvar_t pq_password;			// JPG 3.00 - password protection
 extern unsigned long qsmackAddr;	// JPG 3.02 - allow qsmack bots to connect to server
 #endif
 
-static qsocket_t *_Datagram_CheckNewConnections (void)
+static qsocket_t *_Datagram_ReadControl (int acceptsock, qboolean *more)
 {
 	struct qsockaddr clientaddr;
 	struct qsockaddr newaddr;
 	int			newsock;
-	int			acceptsock;
 	qsocket_t	*sock;
-	qsocket_t	*s;
+	qsocket_t	*s, *next;
 	int			len;
 	int			command;
 	int			control;
 	int			ret;
+	int			cookie = 0;
+	qboolean	hascookie;
 #ifdef PROQUAKE_EXTENSION
 	byte		mod, mod_version, mod_flags;	// JPG 3.02 - bugfix!
 #endif
 
-	acceptsock = dfunc.CheckNewConnections();
-	if (acceptsock == -1)
-		return NULL;
-
 	SZ_Clear(&net_message);
 
 	len = dfunc.Read (acceptsock, net_message.data, net_message.maxsize, &clientaddr);
+	if (len <= 0)
+	{
+		*more = false;
+		return NULL;
+	}
 	if (len < sizeof(int))
 		return NULL;
 	net_message.cursize = len;
@@ -1138,123 +2274,33 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		return NULL;
 
 	command = MSG_ReadByte();
+
+	// a browser walks the player and rule lists right after the server
+	// info, so only that and connects are charged
+	if ((command == CCREQ_CONNECT || command == CCREQ_SERVER_INFO) && !Datagram_AllowControl (&clientaddr))
+	{
+		controlPacketsDropped++;
+		return NULL;
+	}
+
 	if (command == CCREQ_SERVER_INFO)
 	{
-		// JPG 3.50
-		char name[256];
-		strcpy(name, hostname.string);
-#ifdef PROQUAKE_EXTENSION
-		if (pq_cheatfree)
-			strlcat (name, " (cheat-free)", sizeof(name));
-#endif
 		if (strcmp(MSG_ReadString(), "QUAKE") != 0)
 			return NULL;
 
-		SZ_Clear(&net_message);
-		// save space for the header, filled in later
-		MSG_WriteLong(&net_message, 0);
-		MSG_WriteByte(&net_message, CCREP_SERVER_INFO);
-		dfunc.GetSocketAddr(acceptsock, &newaddr);
-		MSG_WriteString(&net_message, dfunc.AddrToString(&newaddr));
-		MSG_WriteString(&net_message, name);	// JPG 3.50 changed hostname.string to name
-		MSG_WriteString(&net_message, sv.name);
-		MSG_WriteByte(&net_message, net_activeconnections);
-		MSG_WriteByte(&net_message, svs.maxclients);
-		MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
-		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
-		SZ_Clear(&net_message);
-
+		Datagram_ServerInfoReply (acceptsock, &clientaddr);
 		return NULL;
 	}
 
 	if (command == CCREQ_PLAYER_INFO)
 	{
-		int			playerNumber, activeNumber, clientNumber;
-		int         a, b, c;
-		char        address[16];
-		client_t	*client;
-
-		playerNumber = MSG_ReadByte();
-		activeNumber = -1;
-		for (clientNumber = 0, client = svs.clients; clientNumber < svs.maxclients; clientNumber++, client++)
-		{
-			if (client->active)
-			{
-				activeNumber++;
-				if (activeNumber == playerNumber)
-					break;
-			}
-		}
-		if (clientNumber == svs.maxclients)
-			return NULL;
-
-		SZ_Clear(&net_message);
-		// save space for the header, filled in later
-		MSG_WriteLong(&net_message, 0);
-		MSG_WriteByte(&net_message, CCREP_PLAYER_INFO);
-		MSG_WriteByte(&net_message, playerNumber);
-		MSG_WriteString(&net_message, client->name);
-		MSG_WriteLong(&net_message, client->colors);
-		MSG_WriteLong(&net_message, (int)client->edict->v.frags);
-		MSG_WriteLong(&net_message, (int)(net_time - client->netconnection->connecttime));
-
-		if (!sv_ipmasking.value) {
-		MSG_WriteString(&net_message, client->netconnection->address);
-		} else {
-			if (sscanf(client->netconnection->address, "%d.%d.%d", &a, &b, &c) == 3) // Baker 3.60 - engine side IP masking
-			snprintf(address, sizeof(address), "%d.%d.%d.xxx", a, b, c);
-			MSG_WriteString(&net_message, address);
-		}
-
-
-		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
-		SZ_Clear(&net_message);
-
+		Datagram_PlayerInfoReply (acceptsock, &clientaddr, MSG_ReadByte());
 		return NULL;
 	}
 
 	if (command == CCREQ_RULE_INFO)
 	{
-		char	*prevCvarName;
-		cvar_t	*var;
-
-		// find the search start location
-		prevCvarName = MSG_ReadString();
-		if (*prevCvarName)
-		{
-			var = Cvar_FindVar (prevCvarName);
-			if (!var)
-				return NULL;
-			var = var->next;
-		}
-		else
-			var = cvar_vars;
-
-		// search for the next server cvar
-		while (var)
-		{
-			if (var->server)
-				break;
-			var = var->next;
-		}
-
-		// send the response
-
-		SZ_Clear(&net_message);
-		// save space for the header, filled in later
-		MSG_WriteLong(&net_message, 0);
-		MSG_WriteByte(&net_message, CCREP_RULE_INFO);
-		if (var)
-		{
-			MSG_WriteString(&net_message, var->name);
-			MSG_WriteString(&net_message, var->string);
-		}
-		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
-		SZ_Clear(&net_message);
-
+		Datagram_RuleInfoReply (acceptsock, &clientaddr, MSG_ReadString());
 		return NULL;
 	}
 
@@ -1312,12 +2358,50 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	}
 #endif
 
+	// a cookie goes last, after any mod extensions, behind a CCREP_CHALLENGE
+	// byte, and only ever makes a request one of two lengths no older
+	// client sends; take it off so the mod extensions parse as before
+	hascookie = false;
+	if ((len == 17 || len == 24) && net_message.data[len - 5] == CCREP_CHALLENGE)
+	{
+		memcpy (&cookie, net_message.data + len - 4, 4);
+		cookie = LittleLong(cookie);
+		hascookie = true;
+		len -= 5;
+	}
+
+	// make him prove he's really at that address before committing
+	// anything to him
+	if (Datagram_ChallengeRequired ())
+	{
+		if (!hascookie || (cookie != Datagram_Cookie (&clientaddr, 0) && cookie != Datagram_Cookie (&clientaddr, 1)))
+		{
+			SZ_Clear(&net_message);
+			// save space for the header, filled in later
+			MSG_WriteLong(&net_message, 0);
+			MSG_WriteByte(&net_message, CCREP_CHALLENGE);
+			MSG_WriteLong(&net_message, Datagram_Cookie (&clientaddr, 0));
+			*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
+			Datagram_SendControl (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+			SZ_Clear(&net_message);
+			return NULL;
+		}
+	}
+
 	// see if this guy is already connected
-	for (s = net_activeSockets; s; s = s->next)
+	for (s = net_activeSockets; s; s = next)
 	{
+		next = s->next;
 		if (s->driver != net_driverlevel)
 			continue;
 		ret = dfunc.AddrCompare(&clientaddr, &s->addr);
+		if (ret >= 0 && s->lingering)
+		{
+			// the old connection only stayed for its disconnect, and the
+			// client has clearly moved on
+			NET_Close (s);
+			continue;
+		}
 		if (ret >= 0)
 		{
 			// is this a duplicate connection request?
@@ -1425,12 +2509,39 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		MSG_WriteByte(&net_message, 0);
 #endif
 	*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-	dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+	Datagram_SendControl (acceptsock, net_message.data, net_message.cursize, &clientaddr);
 	SZ_Clear(&net_message);
 
 	return sock;
 }
 
+static qsocket_t *_Datagram_CheckNewConnections (void)
+{
+	qsocket_t	*sock;
+	int			acceptsock;
+	qboolean	more;
+
+	Sim_Run ();
+
+	acceptsock = dfunc.CheckNewConnections();
+	if (acceptsock == -1)
+		return NULL;
+
+	// drain the queue up to a per-frame budget, instead of one packet a
+	// frame, so floods neither back up nor eat the frame
+	if (ctl_frame != host_framecount)
+	{
+		ctl_frame = host_framecount;
+		ctl_budget = NET_MAXCONTROLPACKETS;
+	}
+
+	for (more = true ; more && ctl_budget > 0 ; ctl_budget--)
+		if ((sock = _Datagram_ReadControl (acceptsock, &more)))
+			return sock;
+
+	return NULL;
+}
+
 qsocket_t *Datagram_CheckNewConnections (void)
 {
 	qsocket_t *ret = NULL;
@@ -1571,6 +2682,9 @@ static qsocket_t *_Datagram_Connect (char *host)
 	double		start_time;
 	int			control;
 	char		*reason;
+	int			cookie = 0;
+	int			challenges = 0;
+	qboolean	challenged = false;
 
 	// see if we can resolve the host name
 	if (dfunc.GetAddrFromName(host, &sendaddr) == -1)
@@ -1613,11 +2727,18 @@ static qsocket_t *_Datagram_Connect (char *host)
 		MSG_WriteByte(&net_message, 0);						// JPG 3.00 - added this (flags)
 		MSG_WriteLong(&net_message, pq_password.value);		// JPG 3.00 - password protected servers
 #endif
+		if (challenges)
+		{
+			MSG_WriteByte(&net_message, CCREP_CHALLENGE);	// always last
+			MSG_WriteLong(&net_message, cookie);
+		}
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (newsock, net_message.data, net_message.cursize, &sendaddr);
+		Datagram_LanWrite (net_landriverlevel, newsock, net_message.data, net_message.cursize, &sendaddr);
+		Sim_Run ();
 		SZ_Clear(&net_message);
 		do
 		{
+			Sim_Run ();
 			ret = dfunc.Read (newsock, net_message.data, net_message.maxsize, &readaddr);
 
 
@@ -1683,6 +2804,16 @@ static qsocket_t *_Datagram_Connect (char *host)
 					ret = 0;
 					continue;
 				}
+
+				// the server wants its cookie back before it accepts us
+				if (ret >= 9 && net_message.data[4] == CCREP_CHALLENGE)
+				{
+					MSG_ReadByte();
+					cookie = MSG_ReadLong();
+					challenged = true;
+					ret = 0;
+					break;
+				}
 			}
 #ifdef PSP_NETWORKING_CODE
 			sceKernelDelayThread(10);
@@ -1693,6 +2824,15 @@ static qsocket_t *_Datagram_Connect (char *host)
 		} while (ret == 0 && (SetNetTime() - start_time) < NETWORK_CONNECT_TIMEOUT);
 		if (ret)
 			break;
+		if (challenged && challenges < 3)
+		{
+			// answer right away, without using up a try
+			challenged = false;
+			challenges++;
+			reps--;
+			start_time = SetNetTime();
+			continue;
+		}
 		Con_Printf("still trying...\n");
 		SCR_UpdateScreen ();
 		start_time = SetNetTime();
@@ -1791,6 +2931,7 @@ static qsocket_t *_Datagram_Connect (char *host)
 		clientsock = dfunc.OpenSocket (0);
 		if (clientsock == -1)
 			goto ErrorReturn;
+		Sim_CloseSocket (net_landriverlevel, newsock);
 		dfunc.CloseSocket(newsock);
 		newsock = clientsock;
 		sock->socket = newsock;
@@ -1816,6 +2957,7 @@ ErrorReturn:
 	NET_FreeQSocket(sock);
 
 ErrorReturn2:
+	Sim_CloseSocket (net_landriverlevel, newsock);
 	dfunc.CloseSocket(newsock);
 	if (m_return_onerror)
 	{
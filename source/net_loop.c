@@ -26,10 +26,112 @@ qboolean	localconnectpending = false;
 qsocket_t	*loop_client = NULL;
 qsocket_t	*loop_server = NULL;
 
+/*
+Each direction is a ring of message buffers, all NET_MAXMESSAGE long.  A
+send copies into the next free buffer, and a read hands that buffer to
+net_message and takes net_message's old one in its place, so a message is
+copied once instead of three times.  One slot per direction is kept for
+reliable messages, of which only one is ever in flight.
+
+Both ends drain their queue every frame, and a frame sends at most one
+reliable and one unreliable message each way, so three slots leave room
+for a frame's traffic plus one unreliable message the reader hasn't got
+to yet.  An unreliable message that finds no room is dropped like a lost
+datagram.  A reliable one is never dropped: senders that skip
+NET_CanSendMessage (NET_SendToAll, reconnect and disconnect) can find the
+queue full, and then the newest unreliable message waiting gives up its
+slot.  A queue full of reliables is a Sys_Error, as it always was.  Each
+slot holds NET_MAXMESSAGE, so the six of them are 192KB of hunk under
+FITZQUAKE_PROTOCOL.
+*/
+#define LOOP_QUEUE	3
+
+typedef struct
+{
+	int		type;		// 1 reliable, 2 unreliable
+	int		length;
+	byte	*data;
+} loopmessage_t;
+
+typedef struct
+{
+	loopmessage_t	messages[LOOP_QUEUE];
+	int				head;		// next to read
+	int				count;
+} loopqueue_t;
+
+static loopqueue_t	loop_queues[2];		// to the client, to the server
+
+int			loopMessages, loopBytes;
+int			loop_benchframes;
+static int	loop_benchstart;
+static double	loop_benchtime, loop_benchloop;
+
+static loopqueue_t *Loop_Queue (qsocket_t *sock)
+{
+	return &loop_queues[sock == loop_client ? 0 : 1];
+}
+
+static void Loop_ClearQueues (void)
+{
+	loop_queues[0].head = loop_queues[0].count = 0;
+	loop_queues[1].head = loop_queues[1].count = 0;
+}
+
+/*
+====================
+Loop_Bench_f
+
+timedemo for listen servers: runs frames uncapped and reports how much of
+them went to the loopback
+====================
+*/
+static void Loop_Bench_f (void)
+{
+	if (Cmd_Argc() != 2)
+	{
+		Con_Printf ("loop_bench <frames> : times listen server frames\n");
+		return;
+	}
+	if (!loop_client || !sv.active)
+	{
+		Con_Printf ("loop_bench: not running a listen server\n");
+		return;
+	}
+
+	loop_benchframes = atoi(Cmd_Argv(1));
+	if (loop_benchframes < 1)
+		loop_benchframes = 1;
+	loop_benchstart = host_framecount;
+	loop_benchtime = Sys_DoubleTime ();
+	loop_benchloop = 0;
+	loopMessages = loopBytes = 0;
+}
+
+static void Loop_FinishBench (void)
+{
+	int		frames = host_framecount - loop_benchstart;
+	double	time = Sys_DoubleTime () - loop_benchtime;
+
+	loop_benchframes = 0;
+	if (frames < 1 || time <= 0)
+		return;
+	Con_Printf ("%i frames %5.1f seconds %5.1f fps\n", frames, time, frames / time);
+	Con_Printf ("%i messages, %i bytes, %5.1f usec a frame in the loopback\n", loopMessages, loopBytes, loop_benchloop * 1000000 / frames);
+}
+
 int Loop_Init (void)
 {
+	int		i, j;
+
 	if (cls.state == ca_dedicated)
 		return -1;
+
+	for (i = 0 ; i < 2 ; i++)
+		for (j = 0 ; j < LOOP_QUEUE ; j++)
+			loop_queues[i].messages[j].data = Hunk_AllocName (NET_MAXMESSAGE, "loopback");
+
+	Cmd_AddCommand ("loop_bench", Loop_Bench_f);
 	return 0;
 }
 
@@ -105,6 +207,7 @@ qsocket_t *Loop_Connect (char *host)
 
 	loop_client->driverdata = (void *)loop_server;
 	loop_server->driverdata = (void *)loop_client;
+	Loop_ClearQueues ();
 
 	return loop_client;
 }
@@ -122,72 +225,116 @@ qsocket_t *Loop_CheckNewConnections (void)
 	loop_client->sendMessageLength = 0;
 	loop_client->receiveMessageLength = 0;
 	loop_client->canSend = true;
+	Loop_ClearQueues ();
 	return loop_server;
 }
 
 
-static int IntAlign(int value)
-{
-	return (value + (sizeof(int) - 1)) & (~(sizeof(int) - 1));
-}
-
-
 int Loop_GetMessage (qsocket_t *sock)
 {
-	int		ret;
-	int		length;
+	loopqueue_t		*q = Loop_Queue (sock);
+	loopmessage_t	*m;
+	byte			*data;
+	double			time = 0;
+	int				ret;
 
-	if (sock->receiveMessageLength == 0)
-		return 0;
+	if (loop_benchframes)
+	{
+		if (host_framecount - loop_benchstart >= loop_benchframes)
+			Loop_FinishBench ();
+		else
+			time = Sys_DoubleTime ();
+	}
 
-	ret = sock->receiveMessage[0];
-	length = sock->receiveMessage[1] + (sock->receiveMessage[2] << 8);
-	// alignment byte skipped here
-	SZ_Clear (&net_message);
-	SZ_Write (&net_message, &sock->receiveMessage[4], length);
+	if (!q->count)
+		return 0;
 
-	length = IntAlign(length + 4);
-	sock->receiveMessageLength -= length;
+	m = &q->messages[q->head];
+	q->head = (q->head + 1) % LOOP_QUEUE;
+	q->count--;
 
-	if (sock->receiveMessageLength)
-		memcpy(sock->receiveMessage, &sock->receiveMessage[length], sock->receiveMessageLength);
+	// trade buffers with net_message instead of copying out
+	data = net_message.data;
+	net_message.data = m->data;
+	net_message.cursize = m->length;
+	m->data = data;
+	ret = m->type;
 
 	if (sock->driverdata && ret == 1)
 		((qsocket_t *)sock->driverdata)->canSend = true;
 
+	if (time)
+		loop_benchloop += Sys_DoubleTime () - time;
 	return ret;
 }
 
 
-int Loop_SendMessage (qsocket_t *sock, sizebuf_t *data)
+static int Loop_Write (qsocket_t *sock, sizebuf_t *data, int type)
 {
-	byte *buffer;
-	int  *bufferLength;
+	loopqueue_t		*q = Loop_Queue ((qsocket_t *)sock->driverdata);
+	loopmessage_t	*m;
+	double			time = 0;
+
+	if (loop_benchframes)
+		time = Sys_DoubleTime ();
+
+	m = &q->messages[(q->head + q->count) % LOOP_QUEUE];
+	m->type = type;
+	m->length = data->cursize;
+	memcpy(m->data, data->data, data->cursize);
+	q->count++;
+
+	loopMessages++;
+	loopBytes += data->cursize;
+	if (time)
+		loop_benchloop += Sys_DoubleTime () - time;
+	return 1;
+}
 
-	if (!sock->driverdata)
-		return -1;
 
-	bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
+/*
+====================
+Loop_DropUnreliable
 
-	if ((*bufferLength + data->cursize + 4) > NET_MAXMESSAGE)
+Makes room for a reliable message by throwing out the newest unreliable
+one still queued
+====================
+*/
+static void Loop_DropUnreliable (loopqueue_t *q)
+{
+	loopmessage_t	m;
+	int				i, j;
+
+	for (i = q->count - 1 ; i >= 0 ; i--)
+		if (q->messages[(q->head + i) % LOOP_QUEUE].type == 2)
+			break;
+	if (i < 0)
 		Sys_Error("Loop_SendMessage: overflow\n");
 
-	buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
+	// slide it to the tail, keeping every slot's buffer
+	for (j = i ; j < q->count - 1 ; j++)
+	{
+		m = q->messages[(q->head + j) % LOOP_QUEUE];
+		q->messages[(q->head + j) % LOOP_QUEUE] = q->messages[(q->head + j + 1) % LOOP_QUEUE];
+		q->messages[(q->head + j + 1) % LOOP_QUEUE] = m;
+	}
+	q->count--;
+}
 
-	// message type
-	*buffer++ = 1;
 
-	// length
-	*buffer++ = data->cursize & 0xff;
-	*buffer++ = data->cursize >> 8;
+int Loop_SendMessage (qsocket_t *sock, sizebuf_t *data)
+{
+	if (!sock->driverdata)
+		return -1;
 
-	// align
-	buffer++;
+	if (data->cursize > NET_MAXMESSAGE)
+		Sys_Error("Loop_SendMessage: overflow\n");
 
-	// message
-	memcpy(buffer, data->data, data->cursize);
-	*bufferLength = IntAlign(*bufferLength + data->cursize + 4);
+	// only a sender that skipped NET_CanSendMessage can find it full
+	if (Loop_Queue ((qsocket_t *)sock->driverdata)->count == LOOP_QUEUE)
+		Loop_DropUnreliable (Loop_Queue ((qsocket_t *)sock->driverdata));
 
+	Loop_Write (sock, data, 1);
 	sock->canSend = false;
 	return 1;
 }
@@ -195,33 +342,14 @@ int Loop_SendMessage (qsocket_t *sock, sizebuf_t *data)
 
 int Loop_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 {
-	byte *buffer;
-	int  *bufferLength;
-
 	if (!sock->driverdata)
 		return -1;
 
-	bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
-
-	if ((*bufferLength + data->cursize + sizeof(byte) + sizeof(short)) > NET_MAXMESSAGE)
+	// leave a slot for a reliable message
+	if (Loop_Queue ((qsocket_t *)sock->driverdata)->count >= LOOP_QUEUE - 1 || data->cursize > NET_MAXMESSAGE)
 		return 0;
 
-	buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
-
-	// message type
-	*buffer++ = 2;
-
-	// length
-	*buffer++ = data->cursize & 0xff;
-	*buffer++ = data->cursize >> 8;
-
-	// align
-	buffer++;
-
-	// message
-	memcpy(buffer, data->data, data->cursize);
-	*bufferLength = IntAlign(*bufferLength + data->cursize + 4);
-	return 1;
+	return Loop_Write (sock, data, 2);
 }
 
 
@@ -246,6 +374,7 @@ void Loop_Close (qsocket_t *sock)
 	sock->receiveMessageLength = 0;
 	sock->sendMessageLength = 0;
 	sock->canSend = true;
+	Loop_Queue (sock)->count = 0;
 	if (sock == loop_client)
 		loop_client = NULL;
 	else
@@ -66,8 +66,14 @@ int messagesReceived = 0;
 int unreliableMessagesSent = 0;
 int unreliableMessagesReceived = 0;
 
+// NET_SendToAll measurements
+int		broadcastTimeouts = 0;
+double	broadcastStall;			// seconds the last NET_SendToAll held up the caller
+double	broadcastComplete;		// seconds until the last client acknowledged it
+
 cvar_t	net_messagetimeout = {"net_messagetimeout","300"};
 cvar_t	net_connecttimeout = {"net_connecttimeout","10"};	// JPG 2.01 - qkick/qflood protection
+cvar_t	net_syncbroadcast = {"net_syncbroadcast","0"};	// 1 = NET_SendToAll waits for every client
 cvar_t	hostname = {"hostname", "UNNAMED"};
 #ifdef PROQUAKE_EXTENSION
 cvar_t	pq_password = {"pq_password", ""};					// JPG 3.00 - password protection
@@ -172,6 +178,20 @@ qsocket_t *NET_NewQSocket (void)
 	sock->receiveSequence = 0;
 	sock->unreliableReceiveSequence = 0;
 	sock->receiveMessageLength = 0;
+	sock->windowed = false;
+	sock->sendWindow = 0;
+	sock->sendFragments = 0;
+	sock->rtt = 0;
+	memset (sock->receiveWindow, 0, sizeof(sock->receiveWindow));
+	sock->rxring = NULL;
+	sock->receiveTime = net_time;
+	sock->receiveDelay = 0;
+	sock->receiveDelayCount = 0;
+	sock->broadcastLength = 0;
+	sock->broadcastDeadline = 0;
+	sock->broadcastFailed = false;
+	sock->lingering = false;
+	memset (&sock->stats, 0, sizeof(sock->stats));
 
 	return sock;
 }
@@ -554,6 +574,59 @@ qsocket_t *NET_CheckNewConnections (void)
 NET_Close
 ===================
 */
+/*
+==================
+NET_RunBroadcast
+
+Hands the connection's queued broadcast to the reliable channel once it
+is free.  Returns true when nothing is left pending: the broadcast was
+acknowledged, or it missed its deadline and the connection is marked
+failed so the server drops it.
+==================
+*/
+static qboolean NET_RunBroadcast (qsocket_t *sock)
+{
+	sizebuf_t	buf;
+
+	if (!sock->broadcastDeadline)
+		return true;
+
+	if (net_time > sock->broadcastDeadline)
+	{
+		Con_Printf ("%s didn't acknowledge a broadcast in time\n", sock->address);
+		broadcastTimeouts++;
+		sock->broadcastLength = 0;
+		sock->broadcastDeadline = 0;
+		sock->broadcastFailed = true;
+		return true;
+	}
+
+	if (!sfunc.CanSendMessage (sock))
+		return false;
+
+	if (sock->broadcastLength)
+	{
+		buf.data = sock->broadcast;
+		buf.cursize = sock->broadcastLength;
+		buf.maxsize = NET_MAXBROADCAST;
+		sock->broadcastLength = 0;
+		if (NET_SendMessage (sock, &buf) == -1)
+		{
+			sock->broadcastDeadline = 0;
+			sock->broadcastFailed = true;
+			return true;
+		}
+		return false;
+	}
+
+	// delivered and acknowledged
+	sock->broadcastDeadline = 0;
+	if (net_time - sock->broadcastStart > broadcastComplete)
+		broadcastComplete = net_time - sock->broadcastStart;
+	return true;
+}
+
+
 void NET_Close (qsocket_t *sock)
 {
 	if (!sock)
@@ -564,6 +637,15 @@ void NET_Close (qsocket_t *sock)
 
 	SetNetTime();
 
+	// let a pending broadcast (like the svc_disconnect from a server
+	// shutdown) finish over the next frames before letting go; closing a
+	// connection that is already lingering lets go of it at once
+	if (!sock->lingering && sock->broadcastDeadline && !sock->broadcastFailed && !NET_RunBroadcast (sock))
+	{
+		sock->lingering = true;
+		return;
+	}
+
 	// call the driver_Close function
 	sfunc.Close (sock);
 
@@ -607,6 +689,9 @@ int	NET_GetMessage (qsocket_t *sock)
 		return -1;
 	}
 
+	if (sock->broadcastFailed)
+		return -1;
+
 	SetNetTime();
 
 	ret = sfunc.QGetMessage(sock);
@@ -819,6 +904,14 @@ qboolean NET_CanSendMessage (qsocket_t *sock)
 
 	SetNetTime();
 
+	// a queued broadcast goes out ahead of anything else
+	if (sock->broadcastDeadline)
+	{
+		NET_RunBroadcast (sock);
+		if (sock->broadcastLength || sock->broadcastFailed)
+			return false;
+	}
+
 	r = sfunc.CanSendMessage(sock);
 
 	if (recording)
@@ -834,7 +927,16 @@ qboolean NET_CanSendMessage (qsocket_t *sock)
 }
 
 
-int NET_SendToAll(sizebuf_t *data, int blocktime)
+/*
+==================
+NET_SendToAllBlocking
+
+The original NET_SendToAll: spins until every client has acknowledged the
+message or blocktime runs out.  Kept behind net_syncbroadcast 1 so the
+stall can be compared.
+==================
+*/
+static int NET_SendToAllBlocking (sizebuf_t *data, int blocktime)
 {
 	double		start;
 	int		i, count = 0;
@@ -904,6 +1006,120 @@ int NET_SendToAll(sizebuf_t *data, int blocktime)
 }
 
 
+/*
+==================
+NET_SendToAll
+==================
+*/
+int NET_SendToAll (sizebuf_t *data, int blocktime)
+{
+	double		start;
+	int			i, failed = 0;
+	qsocket_t	*sock;
+
+	start = Sys_DoubleTime();
+
+	if (net_syncbroadcast.value)
+	{
+		failed = NET_SendToAllBlocking (data, blocktime);
+		broadcastStall = broadcastComplete = Sys_DoubleTime() - start;
+		return failed;
+	}
+
+	SetNetTime();
+	broadcastComplete = 0;
+
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (!host_client->active || !(sock = host_client->netconnection))
+			continue;
+
+		if (sock->driver == 0)
+		{
+			NET_SendMessage(sock, data);
+			continue;
+		}
+
+		// consecutive broadcasts just run together, like any reliable data
+		if (sock->broadcastLength + data->cursize > NET_MAXBROADCAST)
+		{
+			Con_Printf ("NET_SendToAll: no room to queue %i bytes for %s\n", data->cursize, sock->address);
+			failed++;
+			continue;
+		}
+		memcpy (sock->broadcast + sock->broadcastLength, data->data, data->cursize);
+		sock->broadcastLength += data->cursize;
+		if (!sock->broadcastDeadline)
+			sock->broadcastStart = net_time;
+		sock->broadcastDeadline = net_time + blocktime;
+
+		NET_RunBroadcast (sock);
+	}
+
+	broadcastStall = Sys_DoubleTime() - start;
+	return failed;
+}
+
+
+/*
+==================
+NET_RunBroadcasts
+
+Moves every queued broadcast along, and finishes closing connections
+that were only waiting for theirs.  Called once a frame from NET_Poll.
+==================
+*/
+static byte	*linger_data;		// NET_MAXMESSAGE, allocated the first time a connection lingers
+
+static void NET_DrainLingering (qsocket_t *sock)
+{
+	sizebuf_t	saved;
+	int			readcount;
+	qboolean	badread;
+
+	if (!linger_data && !(linger_data = malloc (NET_MAXMESSAGE)))
+		return;
+
+	// whatever the peer still sends lands in a buffer of its own, so the
+	// net_message a caller of NET_Poll may be parsing is left alone
+	saved = net_message;
+	readcount = msg_readcount;
+	badread = msg_badread;
+
+	net_message.data = linger_data;
+	net_message.maxsize = NET_MAXMESSAGE;
+	net_message.cursize = 0;
+	while (sfunc.QGetMessage (sock) > 0)
+		;
+
+	net_message = saved;
+	msg_readcount = readcount;
+	msg_badread = badread;
+}
+
+static void NET_RunBroadcasts (void)
+{
+	qsocket_t	*sock, *next;
+
+	for (sock = net_activeSockets ; sock ; sock = next)
+	{
+		next = sock->next;
+		if (!sock->broadcastDeadline)
+			continue;
+
+		// nobody else reads a lingering connection, so collect its ACKs here
+		if (sock->lingering)
+			NET_DrainLingering (sock);
+
+		if (NET_RunBroadcast (sock) && sock->lingering)
+		{
+			sfunc.Close (sock);
+			NET_FreeQSocket (sock);
+		}
+	}
+}
+
+
 //=============================================================================
 
 /*
@@ -961,6 +1177,7 @@ void NET_Init (void)
 	SZ_Alloc (&net_message, NET_MAXMESSAGE);
 
 	Cvar_RegisterVariable (&net_messagetimeout, NULL);
+	Cvar_RegisterVariable (&net_syncbroadcast, NULL);
 	Cvar_RegisterVariable (&net_connecttimeout, NULL);	// JPG 2.01 - qkick/qflood protection
 	Cvar_RegisterVariable (&hostname, NULL);
 #ifdef PROQUAKE_EXTENSION
@@ -1029,12 +1246,26 @@ NET_Shutdown
 
 void		NET_Shutdown (void)
 {
-	qsocket_t	*sock;
-
-	SetNetTime();
+	qsocket_t	*sock, *next;
+	qboolean	lingering;
 
-	for (sock = net_activeSockets; sock; sock = sock->next)
+	// the drivers are going away, so this is the last chance for queued
+	// broadcasts (the server's svc_disconnect); each has its own deadline
+	do
+	{
+		SetNetTime();
+		NET_RunBroadcasts ();
+		for (lingering = false, sock = net_activeSockets; sock; sock = sock->next)
+			if (sock->lingering)
+				lingering = true;
+	} while (lingering);
+
+	for (sock = net_activeSockets; sock; sock = next)
+	{
+		next = sock->next;
+		sock->broadcastDeadline = 0;
 		NET_Close(sock);
+	}
 
 // shutdown the drivers
 	for (net_driverlevel = 0; net_driverlevel < net_numdrivers; net_driverlevel++)
@@ -1046,6 +1277,9 @@ void		NET_Shutdown (void)
 		}
 	}
 
+	free (linger_data);
+	linger_data = NULL;
+
 	if (vcrFile != -1)
 	{
 		Con_Printf ("Closing vcrfile.\n");
@@ -1077,6 +1311,8 @@ void NET_Poll(void)
 
 	SetNetTime();
 
+	NET_RunBroadcasts ();
+
 	for (pp = pollProcedureList; pp; pp = pp->next)
 	{
 		if (pp->nextTime > net_time)
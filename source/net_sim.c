@@ -0,0 +1,258 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// net_sim.c -- network impairment simulator for net_dgrm
+//
+// Sits between net_dgrm.c and the lan drivers and holds on to outgoing
+// datagrams to fake a worse network: added latency and jitter, loss,
+// duplication and reordering.  Run a dedicated server and a client on
+// one machine over 127.0.0.1, set the net_sim cvars on either or both
+// ends, and the same net_simseed gives the same fate to the same stream
+// of datagrams, so runs can be compared.  Held datagrams go out from
+// Sim_Run, which net_dgrm calls whenever it polls, so delivery times are
+// only as fine as the frame rate.
+
+#include "quakedef.h"
+#include "net_sim.h"
+
+#define SIM_QUEUE		256
+
+typedef struct
+{
+	double				time;		// when it goes out
+	int					landriver;
+	int					socket;
+	int					length;
+	struct qsockaddr	addr;
+	byte				data[NET_DATAGRAMSIZE];
+} simpacket_t;
+
+cvar_t	net_simlatency = {"net_simlatency", "0"};		// ms, one way
+cvar_t	net_simjitter = {"net_simjitter", "0"};			// ms, +/- on top of the latency
+cvar_t	net_simloss = {"net_simloss", "0"};				// percent
+cvar_t	net_simdup = {"net_simdup", "0"};				// percent
+cvar_t	net_simreorder = {"net_simreorder", "0"};		// percent held back behind later ones
+cvar_t	net_simseed = {"net_simseed", "1"};
+
+int		simDropped = 0;
+int		simDuplicated = 0;
+int		simReordered = 0;
+int		simQueued = 0;
+
+static simpacket_t	*sim_packets;			// allocated the first time it's needed
+static simpacket_t	*sim_queue[SIM_QUEUE];	// sorted by time
+static simpacket_t	*sim_free[SIM_QUEUE];
+static int			sim_numfree;
+static unsigned int	sim_random;
+static int			sim_seed = -1;
+static double		sim_last;				// latest time given to an in-order datagram
+
+/*
+==================
+Sim_Random
+
+xorshift, so a seed always plays out the same whatever else calls rand()
+==================
+*/
+static float Sim_Random (void)
+{
+	sim_random ^= sim_random << 13;
+	sim_random ^= sim_random >> 17;
+	sim_random ^= sim_random << 5;
+	return (sim_random & 0xffffff) / (float)0x1000000;
+}
+
+
+static qboolean Sim_Enabled (void)
+{
+	return net_simlatency.value > 0 || net_simjitter.value > 0 || net_simloss.value > 0
+		|| net_simdup.value > 0 || net_simreorder.value > 0;
+}
+
+/*
+==================
+Sim_Active
+
+True while datagrams should go through Sim_Write: when any impairment is
+set, and after that until the held ones have gone, so nothing overtakes them
+==================
+*/
+qboolean Sim_Active (void)
+{
+	return Sim_Enabled () || simQueued;
+}
+
+
+static void Sim_Queue (int landriver, int socket, byte *buf, int len, struct qsockaddr *addr, double time)
+{
+	simpacket_t	*p;
+	int			i;
+
+	if (!sim_numfree || len > NET_DATAGRAMSIZE)
+	{
+		simDropped++;
+		return;
+	}
+
+	p = sim_free[--sim_numfree];
+	p->time = time;
+	p->landriver = landriver;
+	p->socket = socket;
+	p->length = len;
+	memcpy (&p->addr, addr, sizeof(p->addr));
+	memcpy (p->data, buf, len);
+
+	for (i = simQueued ; i > 0 && sim_queue[i - 1]->time > time ; i--)
+		sim_queue[i] = sim_queue[i - 1];
+	sim_queue[i] = p;
+	simQueued++;
+}
+
+
+int Sim_Write (int landriver, int socket, byte *buf, int len, struct qsockaddr *addr)
+{
+	double	time;
+	int		i;
+
+	if (!sim_packets)
+	{
+		if (!(sim_packets = malloc (SIM_QUEUE * sizeof(simpacket_t))))
+			return net_landrivers[landriver].Write (socket, buf, len, addr);
+		for (i = 0 ; i < SIM_QUEUE ; i++)
+			sim_free[i] = &sim_packets[i];
+		sim_numfree = SIM_QUEUE;
+	}
+
+	if (sim_seed != (int)net_simseed.value)
+	{
+		sim_seed = (int)net_simseed.value;
+		sim_random = sim_seed ? sim_seed : 1;
+	}
+
+	if (Sim_Random () * 100 < net_simloss.value)
+	{
+		simDropped++;
+		return len;
+	}
+
+	time = net_time + (net_simlatency.value + (Sim_Random () * 2 - 1) * net_simjitter.value) * 0.001;
+	if (Sim_Random () * 100 < net_simreorder.value)
+	{
+		// held back so datagrams sent after it overtake it
+		if (time < sim_last)
+			time = sim_last;
+		time += 0.02 + Sim_Random () * 0.03;
+		simReordered++;
+	}
+	else
+	{
+		// jitter alone doesn't reorder
+		if (time < sim_last)
+			time = sim_last;
+		sim_last = time;
+	}
+	Sim_Queue (landriver, socket, buf, len, addr, time);
+
+	if (Sim_Random () * 100 < net_simdup.value)
+	{
+		Sim_Queue (landriver, socket, buf, len, addr, time + Sim_Random () * net_simjitter.value * 0.001);
+		simDuplicated++;
+	}
+
+	return len;
+}
+
+
+/*
+==================
+Sim_Run
+
+Sends the held datagrams that are due, or all of them once the simulator
+is turned off
+==================
+*/
+void Sim_Run (void)
+{
+	simpacket_t	*p;
+	qboolean	all;
+	int			sent;
+
+	if (!simQueued)
+		return;
+
+	all = !Sim_Enabled ();
+	for (sent = 0 ; sent < simQueued ; sent++)
+	{
+		p = sim_queue[sent];
+		if (!all && p->time > net_time)
+			break;
+		net_landrivers[p->landriver].Write (p->socket, p->data, p->length, &p->addr);
+		sim_free[sim_numfree++] = p;
+	}
+
+	if (!sent)
+		return;
+	simQueued -= sent;
+	memmove (sim_queue, sim_queue + sent, simQueued * sizeof(sim_queue[0]));
+}
+
+
+/*
+==================
+Sim_CloseSocket
+
+Forgets what is held for a socket that is going away, so it can't go out
+later from whatever socket is given the same number
+==================
+*/
+void Sim_CloseSocket (int landriver, int socket)
+{
+	int		i, kept;
+
+	for (i = kept = 0 ; i < simQueued ; i++)
+	{
+		if (sim_queue[i]->landriver == landriver && sim_queue[i]->socket == socket)
+			sim_free[sim_numfree++] = sim_queue[i];
+		else
+			sim_queue[kept++] = sim_queue[i];
+	}
+	simQueued = kept;
+}
+
+
+void Sim_Init (void)
+{
+	Cvar_RegisterVariable (&net_simlatency, NULL);
+	Cvar_RegisterVariable (&net_simjitter, NULL);
+	Cvar_RegisterVariable (&net_simloss, NULL);
+	Cvar_RegisterVariable (&net_simdup, NULL);
+	Cvar_RegisterVariable (&net_simreorder, NULL);
+	Cvar_RegisterVariable (&net_simseed, NULL);
+}
+
+
+void Sim_Shutdown (void)
+{
+	simQueued = 0;
+	if (sim_packets)
+	{
+		free (sim_packets);
+		sim_packets = NULL;
+	}
+}
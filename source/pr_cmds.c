@@ -626,7 +626,7 @@ void PF_traceline (void)
 	nomonsters = G_FLOAT(OFS_PARM2);
 	ent = G_EDICT(OFS_PARM3);
 
-	trace = SV_Move (v1, vec3_origin, vec3_origin, v2, nomonsters, ent);
+	trace = SV_MoveLagged (v1, vec3_origin, vec3_origin, v2, nomonsters, ent);
 
 	pr_global_struct->trace_allsolid = trace.allsolid;
 	pr_global_struct->trace_startsolid = trace.startsolid;
@@ -849,13 +849,34 @@ PF_cvar
 float cvar (string)
 =================
 */
+#define	PR_CVAR_CACHE	64		// must be a power of two
+
+static struct
+{
+	char	*name;
+	cvar_t	*var;
+} pr_cvar_cache[PR_CVAR_CACHE];
+
 void PF_cvar (void)
 {
 	char	*str;
+	cvar_t	*var;
+	int		slot;
 
+// progs pass the same string constant on every call, so remember the
+// cvar it named; temp strings reuse their buffer, hence the name check
 	str = G_STRING(OFS_PARM0);
+	slot = ((unsigned long)str >> 2) & (PR_CVAR_CACHE-1);
+	var = pr_cvar_cache[slot].var;
+
+	if (pr_cvar_cache[slot].name != str || !var || strcmp (var->name, str))
+	{
+		var = Cvar_FindVar (str);
+		pr_cvar_cache[slot].name = str;
+		pr_cvar_cache[slot].var = var;
+	}
 
-	G_FLOAT(OFS_RETURN) = Cvar_VariableValue (str);
+	G_FLOAT(OFS_RETURN) = var ? var->value : 0;
 }
 
 /*
@@ -39,6 +39,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	U_SKIN		(1<<12)
 #define	U_EFFECTS	(1<<13)
 #define	U_LONGENTITY	(1<<14)
+#define	U_REMOVE		(1<<15)		// svc_deltapacket only: entity left the client's view
 
 #ifdef SUPPORTS_KUROK_PROTOCOL
 // Tomaz - QC Alpha Scale Glow Control Begin
@@ -73,6 +74,53 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	SU_ARMOR		(1<<13)
 #define	SU_WEAPON		(1<<14)
 
+// delta compressed entity updates
+//
+// A client that sends the "deltaupdates 1" string command gets its entities
+// in a single svc_deltapacket per datagram instead of one fast update each.
+// Every packet is numbered and the client acknowledges the newest one it has
+// with clc_deltaack.  The server then encodes each entity against the state
+// the client already holds for it in that acknowledged frame: unchanged
+// entities are not sent at all, entities that left the view are sent with
+// U_REMOVE, and everything else carries only the fields that differ.  With a
+// delta base of 0 the packet is complete and encoded against the baselines.
+#define	UPDATE_BACKUP		16			// copies of entity frames kept, must be a power of two
+#define	UPDATE_MASK			(UPDATE_BACKUP-1)
+#define	MAX_DELTA_ENTITIES	128			// entities a single delta frame can hold
+
+typedef struct
+{
+	unsigned short	number;
+	short			origin[3];			// as sent by MSG_WriteCoord
+	byte			angles[3];			// as sent by MSG_WriteAngle
+	byte			modelindex;
+	byte			frame;
+	byte			colormap;
+	byte			skin;
+	byte			effects;
+	byte			step;				// sent as U_STEP
+} entity_delta_t;
+
+typedef struct
+{
+	int				sequence;
+	int				num_entities;
+	entity_delta_t	entities[MAX_DELTA_ENTITIES];
+} delta_frame_t;
+
+// client-side movement prediction
+//
+// A client that sends the "predict 1" string command numbers its moves: a
+// clc_movesequence ahead of each clc_move.  Every datagram the server sends
+// back then starts with an svc_moveack naming the last move it has run and
+// the player's origin, velocity and flags after it, so the client can start
+// from that state and replay the moves the server hasn't seen yet.  The
+// movement cvars the replay needs come in svc_movevars, sent reliably when
+// prediction is agreed and again whenever one of them changes.
+#define	MA_ONGROUND			(1<<0)
+#define	MA_JUMPRELEASED		(1<<1)
+#define	MA_NOPREDICT		(1<<2)		// swimming, flying, dead... the client just follows the server
+
 // a sound with no channel is a local only sound
 #define	SND_VOLUME		(1<<0)		// a byte
 #define	SND_ATTENUATION	(1<<1)		// a byte
@@ -145,6 +193,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define svc_cutscene		34
 
+#define	svc_deltapacket		42	// [long] sequence [long] delta base, then entity updates ending in a 0 byte
+#define	svc_moveack			43	// [long] move sequence [byte] flags [coord3] origin [short3] velocity
+#define	svc_movevars		44	// [float] gravity friction edgefriction stopspeed maxspeed accelerate
+
 #ifdef PSP_FIXME
 //johnfitz -- new server messages
 #define	svc_skybox			37		// [string] name
@@ -165,6 +217,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	clc_disconnect	2
 #define	clc_move		3			// [usercmd_t]
 #define	clc_stringcmd	4		// [string] message
+#define	clc_deltaack	5		// [long] last svc_deltapacket sequence received
+#define	clc_movesequence	6	// [long] number of the clc_move that follows
 
 
 // JPG - added ProQuake commands
@@ -265,14 +265,17 @@ Mod_TouchModel
 
 ==================
 */
-void Mod_TouchModel (char *name)
+qboolean Mod_TouchModel (char *name)
 {
 	model_t	*mod;
 
 	mod = Mod_FindName (name);
 
-	if (!mod->needload && (mod->type == mod_alias))
-		Cache_Check (&mod->cache);
+	if (mod->needload)
+		return qfalse;
+	if (mod->type == mod_alias)
+		return Cache_Check (&mod->cache) != NULL;
+	return qtrue;
 }
 
 /*
@@ -307,7 +310,7 @@ model_t *Mod_LoadModel (model_t *mod, qboolean crash)
 	}
 
 // load the file
-	if (!(buf = (unsigned *)COM_LoadStackFile (mod->name, stackbuf, sizeof(stackbuf))))
+	if (!(buf = (unsigned *)COM_MapStackFile (mod->name, stackbuf, sizeof(stackbuf))))
 	{
 		if (crash)
 			Host_Error ("Mod_LoadModel: %s not found", mod->name);
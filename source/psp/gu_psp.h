@@ -37,6 +37,9 @@ int  GL_LoadLightmapTexture (const char *identifier, int width, int height, cons
 int  GL_LoadPalettedTexture (const char *identifier, int width, int height, const byte *data, qboolean stretch_to_power_of_two, int filter, int mipmap_level, unsigned char* palette);
 void GL_UnloadTexture (const int texture_index);
 
+// VRAM allocator totals, in bytes
+void VRAM_Stats (int *size, int *used, int *peak);
+
 extern	int glx, gly, glwidth, glheight;
 
 // r_local.h -- private refresh defs
@@ -255,6 +255,78 @@ int Sys_FileRead (int handle, void *dest, int count)
 	return fread(dest, 1, count, file.handle);
 }
 
+// Background reads for COM_PrefetchFile.  One reader thread, a step above
+// the main thread's priority so it gets the CPU back as soon as a read
+// completes, working through a ring of queued reads with its own IO
+// handles; the file slots above aren't shared with it.  A read that fails
+// (e.g. across a suspend) just leaves the loader to read the file itself.
+#define	MAX_QUEUED_READS	64
+
+static sysread_t	*read_queue[MAX_QUEUED_READS];
+static volatile int	read_head, read_tail;	// next to read, next free
+static SceUID		read_sema = -1;
+static SceUID		read_thread = -1;
+
+static void Sys_DoRead (sysread_t *read)
+{
+	SceUID	fd;
+	int		got;
+
+	got = -1;
+	fd = sceIoOpen (read->path, PSP_O_RDONLY, 0);
+	if (fd >= 0)
+	{
+		if (sceIoLseek32 (fd, read->offset, PSP_SEEK_SET) == read->offset)
+			got = sceIoRead (fd, read->data, read->length);
+		sceIoClose (fd);
+	}
+
+	read->state = (got == read->length) ? SYS_READ_DONE : SYS_READ_FAILED;
+}
+
+static int Sys_ReadThread (SceSize args, void *argp)
+{
+	while (1)
+	{
+		sceKernelWaitSema (read_sema, 1, NULL);
+		Sys_DoRead (read_queue[read_head % MAX_QUEUED_READS]);
+		read_head++;
+	}
+	return 0;
+}
+
+void Sys_QueueRead (sysread_t *read)
+{
+	read->state = SYS_READ_QUEUED;
+
+	if (read_thread < 0)
+	{
+		if (read_sema < 0)
+			read_sema = sceKernelCreateSema ("read_sema", 0, 0, MAX_QUEUED_READS, NULL);
+		if (read_sema >= 0)
+			read_thread = sceKernelCreateThread ("read_thread", Sys_ReadThread, 0x1f, 0x2000, PSP_THREAD_ATTR_USER, NULL);
+		if (read_thread < 0 || sceKernelStartThread (read_thread, 0, NULL) < 0)
+		{	// no reader; read it now
+			read_thread = -1;
+			Sys_DoRead (read);
+			return;
+		}
+	}
+
+	while (read_tail - read_head == MAX_QUEUED_READS)
+		sceKernelDelayThread (1000);
+
+	read_queue[read_tail % MAX_QUEUED_READS] = read;
+	read_tail++;
+	sceKernelSignalSema (read_sema, 1);
+}
+
+void Sys_WaitRead (sysread_t *read)
+{
+	while (read->state == SYS_READ_QUEUED)
+		sceKernelDelayThread (1000);
+}
+
 int Sys_FileFread (void *dest, int start, int count, int handle)
 {
 	file& file = files[handle];
@@ -456,6 +528,7 @@ char *Sys_FindFirstFile (char *path, char *pattern)
 char *Sys_FindNextFile (void)
 {
 	struct stat	test;
+	char		path[MAX_OSPATH];
 
 	if (!finddir)
 		return NULL;
@@ -466,7 +539,9 @@ char *Sys_FindNextFile (void)
 		{
 			if (!fnmatch (findpattern, finddata->d_name, FNM_PATHNAME))
 			{
-				if ( (stat(va("%s/%s", findpath, finddata->d_name), &test) == 0) && S_ISREG(test.st_mode) )
+				// not va(): callers often hold a va() string across the find
+				snprintf (path, sizeof(path), "%s/%s", findpath, finddata->d_name);
+				if ( (stat(path, &test) == 0) && S_ISREG(test.st_mode) )
 					return finddata->d_name;
 			}
 		}
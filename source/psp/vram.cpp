@@ -42,6 +42,7 @@ namespace quake
 		static allocated_list		allocated(block_count, 0);
 		static std::size_t			bytes_required	= 0;
 		static std::size_t			bytes_allocated	= 0;
+		static std::size_t			bytes_peak		= 0;
 
 		void* allocate(std::size_t size)
 		{
@@ -100,6 +101,10 @@ namespace quake
 						Con_Printf("\tmarking blocks %u to %u as allocated\n", start, end - 1);
 #endif
 						bytes_allocated += (blocks_required * block_size);
+						if (bytes_allocated > bytes_peak)
+						{
+							bytes_peak = bytes_allocated;
+						}
 						for (std::size_t b = start; b < end; ++b)
 						{
 							allocated.at(b) = blocks_required--;
@@ -160,3 +165,10 @@ namespace quake
 		}
 	}
 }
+
+void VRAM_Stats (int *size, int *used, int *peak)
+{
+	*size = quake::vram::block_count * quake::vram::block_size;
+	*used = quake::vram::bytes_allocated;
+	*peak = quake::vram::bytes_peak;
+}
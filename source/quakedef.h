@@ -104,6 +104,7 @@ void	VID_UnlockBuffer (void);
 
 #define	MAX_MSGLEN		8000			// max length of a reliable message
 #define	MAX_DATAGRAM		1024			// max length of unreliable message
+#define	MAX_EXTDATAGRAM		1400			// max length a client can negotiate with "rate"
 
 // per-level limits
 #define	MAX_EDICTS		600
@@ -77,6 +77,13 @@ typedef struct
 #define	NUM_PING_TIMES		16
 #define	NUM_SPAWN_PARMS		16
 
+// what a client was last sent of an entity, for priority scheduling
+typedef struct
+{
+	float			time;				// sv.time it was last sent
+	short			origin[3];			// where it was then, to the unit
+} entsent_t;
+
 typedef struct client_s
 {
 	qboolean		active;				// false = client is free
@@ -122,6 +129,37 @@ typedef struct client_s
 	// JPG 3.30 - allow clients to connect if they don't have the map
 	qboolean		nomap;
 #endif
+
+// entity priority scheduling
+	entsent_t		*ent_sent;			// [sv.max_edicts], hunk allocated with the level
+	int				ent_starved;		// visible entities left out of the last datagram
+	float			ent_starvetime;		// longest wait among those, in seconds
+	int				ent_overflows;		// datagrams that couldn't hold every entity
+
+// delta compressed entity updates
+	qboolean		delta_enabled;		// client asked for svc_deltapacket updates
+	int				delta_sequence;		// last delta frame sent
+	int				delta_acked;		// newest delta frame the client has confirmed
+	int				delta_resetseq;		// acks older than this predate the last reset
+	delta_frame_t	*delta_frames;		// [UPDATE_BACKUP], hunk allocated when first asked for
+
+// rate control
+	int				rate;				// bytes a second the client asked for, 0 = never said
+	int				maxdatagram;		// largest datagram the client can take
+	int				datagram_budget;	// what datagrams are currently held to
+	int				rate_limit;			// bytes a second after backing off for loss, 0 = none
+	double			rate_nextsend;		// when the rate allows another datagram
+	double			rate_checktime;		// last run of the controller
+	netstats_t		rate_stats;			// connection counters at that time
+
+// movement prediction
+	qboolean		predict_enabled;	// client asked for svc_moveack
+	int				move_sequence;		// number of the last clc_move read
+	int				movevars_sent;		// sv_movevarsgeneration the client has, -1 = none
+
+// lag compensation
+	float			lag_time;			// server time of the newest update it had with its last move
+	float			interp_delay;		// seconds it draws the other entities behind that update
 } client_t;
 
 
@@ -224,6 +262,12 @@ extern	cvar_t	sv_maxspeed;
 extern	cvar_t	sv_accelerate;
 extern	cvar_t	sv_idealpitchscale;
 extern	cvar_t	sv_aim;
+extern	cvar_t	sv_deltaupdates;
+extern	cvar_t	sv_maxrate;
+extern	cvar_t	sv_maxdatagram;
+extern	cvar_t	sv_predict;
+extern	cvar_t	sv_lagcomp;
+extern	cvar_t	sv_lagcomp_max;
 extern  cvar_t  alias_sv_aim;
 
 extern	server_static_t	svs;				// persistant server info
@@ -231,6 +275,8 @@ extern	server_t		sv;					// local server
 
 extern	client_t	*host_client;
 
+#define	SV_MINRATE		2500		// bytes a second the controller won't go under
+
 extern	jmp_buf 	host_abortserver;
 
 extern	double		host_time;
@@ -257,12 +303,18 @@ void SV_SetIdealPitch (void);
 void SV_AddUpdates (void);
 
 void SV_ClientThink (void);
+void SV_ApplyFriction (vec3_t vel, float friction, float stopspeed, float frametime);
+void SV_AccelerateVelocity (vec3_t vel, vec3_t dir, float speed, float accelerate, float frametime);
+void SV_AirAccelerateVelocity (vec3_t vel, vec3_t wishveloc, float speed, float accelerate, float frametime);
 void SV_AddClientToServer (struct qsocket_s	*ret);
 
+void SV_ResetDeltaFrames (client_t *client);
+
 void SV_ClientPrintf (char *fmt, ...);
 void SV_BroadcastPrintf (char *fmt, ...);
 
 void SV_Physics (void);
+int ClipVelocity (vec3_t in, vec3_t normal, vec3_t out, float overbounce);
 
 qboolean SV_CheckBottom (edict_t *ent);
 qboolean SV_MoveStep (edict_t *ent, vec3_t move, qboolean relink);
@@ -271,6 +323,11 @@ void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg);
 
 void SV_MoveToGoal (void);
 
+extern	client_t	*sv_lagclient;
+void SV_ResetLagFrames (void);
+void SV_RecordLagFrame (void);
+void SV_LagCompStats_f (void);
+
 void SV_CheckForNewClients (void);
 void SV_RunClients (void);
 void SV_SaveSpawnparms ();
@@ -173,6 +173,43 @@ S_Init
 #ifdef BUILD_MP3_VERSION
 void CDAudioSetVolume (void);
 #endif
+/*
+================
+S_ReleaseSounds
+
+Cache pressure: once a level is running, sounds the level doesn't
+precache and nothing is playing are left over from earlier maps
+================
+*/
+static void S_ReleaseSounds (int size)
+{
+	sfx_t	*sfx;
+	int		i, j;
+
+	if (cls.signon != SIGNONS)
+		return;		// the precache list is still being filled in
+
+	for (sfx=known_sfx, i=0 ; i<num_sfx ; i++, sfx++)
+	{
+		if (!sfx->cache.data)
+			continue;
+
+		for (j=1 ; j<MAX_SOUNDS && cl.sound_precache[j] ; j++)
+			if (cl.sound_precache[j] == sfx)
+				break;
+		if (j<MAX_SOUNDS && cl.sound_precache[j])
+			continue;
+
+		for (j=0 ; j<total_channels ; j++)
+			if (channels[j].sfx == sfx)
+				break;
+		if (j<total_channels)
+			continue;
+
+		Cache_Free (&sfx->cache);
+	}
+}
+
 void S_Init (void)
 {
 	if (COM_CheckParm("-nosound"))
@@ -228,6 +265,8 @@ void S_Init (void)
 	known_sfx = Hunk_AllocName (MAX_SFX*sizeof(sfx_t), "sfx_t");
 	num_sfx = 0;
 
+	Cache_AddRelease (S_ReleaseSounds);
+
 // create a piece of DMA memory
 
 	if (fakedma)
@@ -328,15 +367,18 @@ S_TouchSound
 
 ==================
 */
-void S_TouchSound (char *name)
+qboolean S_TouchSound (char *name)
 {
 	sfx_t	*sfx;
 
 	if (!sound_started)
-		return;
+		return true;
 
 	sfx = S_FindName (name);
-	Cache_Check (&sfx->cache);
+	if (Cache_Check (&sfx->cache))
+		return true;
+
+	return nosound.value || !precache.value;	// won't be loaded anyway
 }
 
 /*
@@ -101,7 +101,7 @@ void S_Update (vec3_t origin, vec3_t v_forward, vec3_t v_right, vec3_t v_up);
 void S_ExtraUpdate (void);
 
 sfx_t *S_PrecacheSound (char *sample);
-void S_TouchSound (char *sample);
+qboolean S_TouchSound (char *sample);	// true if it is still loaded
 void S_ClearPrecache (void);
 void S_BeginPrecaching (void);
 void S_EndPrecaching (void);
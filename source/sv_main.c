@@ -38,6 +38,13 @@ cvar_t	sv_cullentities_notify = {"sv_cullentities_notify", "0", false, true}; //
 #endif
 //cvar_t 	sv_gameplayfix_monster_lerp = {"sv_gameplayfix_monster_lerp", "0", false, true}; // Baker: No "Not lerping" monsters
 cvar_t	sv_allcolors = {"sv_allcolors", "1", false, true};
+cvar_t	sv_entpriority = {"sv_entpriority", "1", false, true};	// rank entities by priority when the datagram overflows
+cvar_t	sv_deltaupdates = {"sv_deltaupdates", "1", false, true};	// allow delta compressed entity updates
+cvar_t	sv_maxrate = {"sv_maxrate", "0", false, true};				// bytes a second per client, 0 = up to the client
+cvar_t	sv_maxdatagram = {"sv_maxdatagram", "1400", false, true};	// largest datagram clients may negotiate
+cvar_t	sv_predict = {"sv_predict", "1", false, true};			// let clients predict their own movement
+
+static	int		sv_movevarsgeneration;		// bumped whenever a movement cvar changes
 
 char	localmodels[MAX_MODELS][5];			// inline model names for precache
 
@@ -96,6 +103,14 @@ void SV_Init (void)
 
 //	Cvar_RegisterVariable (&sv_gameplayfix_monster_lerp, NULL);
 	Cvar_RegisterVariable (&sv_allcolors, NULL);
+	Cvar_RegisterVariable (&sv_entpriority, NULL);
+	Cvar_RegisterVariable (&sv_deltaupdates, NULL);
+	Cvar_RegisterVariable (&sv_maxrate, NULL);
+	Cvar_RegisterVariable (&sv_maxdatagram, NULL);
+	Cvar_RegisterVariable (&sv_predict, NULL);
+	Cvar_RegisterVariable (&sv_lagcomp, NULL);
+	Cvar_RegisterVariable (&sv_lagcomp_max, NULL);
+	Cmd_AddCommand ("lagcomp_stats", SV_LagCompStats_f);
 
 #ifdef PROQUAKE_EXTENSION
 	// Baker: Dedicated server "defaults" - this is ok because quake.rc is executed later, so these "defaults" won't override config.cfg settings, etc.
@@ -286,6 +301,20 @@ void SV_SendServerinfo (client_t *client)
 
 	client->sendsignon = true;
 	client->spawned = false;		// need prespawn, spawn, etc
+
+// edict numbers are reused by the new level
+	memset (client->ent_sent, 0, sv.max_edicts*sizeof(entsent_t));
+	client->ent_starved = 0;
+	client->ent_starvetime = 0;
+
+// the client asks for delta updates again during the signon
+	client->delta_enabled = false;
+	SV_ResetDeltaFrames (client);
+
+// and for movement prediction
+	client->predict_enabled = false;
+	client->move_sequence = 0;
+	client->movevars_sent = -1;
 }
 
 /*
@@ -335,6 +364,9 @@ void SV_ConnectClient (int clientnum)
 	client->message.maxsize = sizeof(client->msgbuf);
 	client->message.allowoverflow = true;		// we can catch it
 	client->privileged = false;
+	client->maxdatagram = MAX_DATAGRAM;		// until it says otherwise
+	client->datagram_budget = MAX_DATAGRAM;
+	client->rate_checktime = realtime;
 
 
 	if (sv.loadgame)
@@ -757,19 +789,97 @@ qboolean SV_InvisibleToClient(edict_t *viewer, edict_t *seen)
 }
 #endif
 
+/*
+=============================================================================
+
+ENTITY PRIORITY
+
+When every visible entity cannot fit in the client datagram, the entities
+are ranked so the ones that matter most to this client go out first.
+Nearby entities, entities that moved a lot since the client last saw them
+and entities that have been waiting a long time all rank higher, so a busy
+scene no longer starves whatever happens to have a high edict number.
+
+=============================================================================
+*/
+
+#define	SV_MAXENTITYUPDATE	16		// worst case bytes for a single entity update
+
+typedef struct
+{
+	edict_t		*ent;
+	int			num;
+	float		priority;
+} sv_entcandidate_t;
+
+static sv_entcandidate_t	sv_entcandidates[MAX_EDICTS];
+
 /*
 =============
-SV_WriteEntitiesToClient
+SV_MarkEntitySent
+=============
+*/
+static void SV_MarkEntitySent (client_t *client, edict_t *ent, int e)
+{
+	int		i;
+
+	client->ent_sent[e].time = sv.time;
+	for (i=0 ; i<3 ; i++)
+		client->ent_sent[e].origin[i] = (short)Q_rint (ent->v.origin[i]);
+}
+
+/*
+=============
+SV_EntityPriority
+=============
+*/
+static float SV_EntityPriority (client_t *client, edict_t *ent, int e, vec3_t org)
+{
+	int		i;
+	vec3_t	delta;
+	float	dist, change, age;
+
+	for (i=0 ; i<3 ; i++)
+		delta[i] = ent->v.origin[i] + 0.5*(ent->v.mins[i] + ent->v.maxs[i]) - org[i];
+	dist = VectorLength (delta);
+
+	for (i=0 ; i<3 ; i++)
+		delta[i] = ent->v.origin[i] - client->ent_sent[e].origin[i];
+	change = VectorLength (delta);
+
+	age = sv.time - client->ent_sent[e].time;
+
+	// a tenth of a second waiting or 16 units of motion count as much as
+	// being 256 units closer
+	return (1 + age * 10 + change / 16) / (1 + dist / 256);
+}
+
+/*
+=============
+SV_EntityPriorityCompare
 =============
 */
-void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg, qboolean nomap)
+static int SV_EntityPriorityCompare (const void *a, const void *b)
 {
-	int		e, i, bits;
-//	int mycount=0;
+	float	pa = ((sv_entcandidate_t *)a)->priority;
+	float	pb = ((sv_entcandidate_t *)b)->priority;
+
+	if (pa > pb)
+		return -1;
+	if (pa < pb)
+		return 1;
+	return ((sv_entcandidate_t *)a)->num - ((sv_entcandidate_t *)b)->num;
+}
+
+/*
+=============
+SV_WriteEntityUpdate
+=============
+*/
+static void SV_WriteEntityUpdate (edict_t *ent, int e, sizebuf_t *msg)
+{
+	int		i, bits;
 	float	miss;
-	byte	*pvs;
-	vec3_t	org;
-	edict_t	*ent;
 #ifdef SUPPORTS_ENTITY_ALPHA
 	float	alpha, fullbright;
 	eval_t  *val;
@@ -788,62 +898,6 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg, qboolean nomap)
     // Tomaz - QC Alpha Scale Glow End
 #endif
 
-// find the client's PVS
-	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
-	pvs = SV_FatPVS (org, sv.worldmodel);
-
-// send over all entities (excpet the client) that touch the pvs
-	ent = NEXT_EDICT(sv.edicts);
-	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
-	{
-
-		if (ent != clent)	// clent is ALWAYS sent
-		{
-// ignore ents without visible models
-			if (!ent->v.modelindex || !pr_strings[ent->v.model])
-				continue;
-
-// ignore if not touching a PV leaf
-			for (i=0 ; i < ent->num_leafs ; i++)
-				if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i]&7) ))
-					break;
-
-			if (i == ent->num_leafs)
-				continue;		// not visible
-#ifdef PROQUAKE_EXTENSION
-			// JPG 3.30 - don't send updates if the client doesn't have the map
-			if (nomap)
-				continue;
-
-			// Baker 3.99b: Slot Zero's user activated anti-lag mod capability
-	       if ((int)clent->v.flags & FL_LOW_BANDWIDTH_CLIENT && (int)ent->v.effects & EF_MAYBE_DRAW)
-	            continue;
-#endif
-
-#ifdef ANTIWALLHACK_SERVER
-// Baker theoretical sv_cullentities_trace
-
-			if (e<=svs.maxclients && sv_cullentities.value) {
-				if(SV_InvisibleToClient(clent, ent)) {
-					if (sv_cullentities_notify.value)
-						Con_Printf("Not visible\n");
-					continue;
-				} else {
-					if (sv_cullentities_notify.value)
-						Con_Printf("Visible\n");
-				}
-			}
-
-// End Baker theoretical
-#endif
-		}
-
-		if (msg->maxsize - msg->cursize < 16)
-		{
-			Con_Printf ("packet overflow\n");
-			return;
-		}
-
 // send an update
 		bits = 0;
 
@@ -1021,9 +1075,433 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg, qboolean nomap)
                 MSG_WriteFloat (msg, fullbright);
 		}
 #endif
+}
+
+/*
+=============================================================================
+
+DELTA COMPRESSION
+
+Clients that asked for delta updates get their entities encoded against the
+last frame they acknowledged instead of the static baselines.  Each client
+keeps a ring of the frames it was sent so the acknowledged one can be found
+again when the clc_deltaack comes back.
+
+=============================================================================
+*/
+
+static int		sv_deltabase[MAX_EDICTS];		// index+1 into the base frame, by entity number
+static qboolean	sv_deltakept[MAX_DELTA_ENTITIES];	// base frame entries still in view
+
+/*
+=============
+SV_ResetDeltaFrames
+
+Forget everything the client acknowledged so the next frame is sent complete
+=============
+*/
+void SV_ResetDeltaFrames (client_t *client)
+{
+	client->delta_acked = 0;
+	client->delta_resetseq = client->delta_sequence + 1;
+}
+
+/*
+=============
+SV_DeltaFromBaseline
+=============
+*/
+static void SV_DeltaFromBaseline (edict_t *ent, int e, entity_delta_t *to)
+{
+	int		i;
+
+	to->number = e;
+	for (i=0 ; i<3 ; i++)
+	{
+		to->origin[i] = (int)(ent->baseline.origin[i]*8);
+		to->angles[i] = ((int)ent->baseline.angles[i]*256/360) & 255;
+	}
+	to->modelindex = ent->baseline.modelindex;
+	to->frame = ent->baseline.frame;
+	to->colormap = ent->baseline.colormap;
+	to->skin = ent->baseline.skin;
+	to->effects = 0;
+	to->step = 0;
+}
+
+/*
+=============
+SV_DeltaFromEdict
+
+Quantizes the entity exactly the way the client is going to see it
+=============
+*/
+static void SV_DeltaFromEdict (edict_t *ent, int e, entity_delta_t *to)
+{
+	int		i;
+
+	to->number = e;
+	for (i=0 ; i<3 ; i++)
+	{
+		to->origin[i] = (int)(ent->v.origin[i]*8);
+		to->angles[i] = ((int)ent->v.angles[i]*256/360) & 255;
+	}
+	to->modelindex = ent->v.modelindex;
+	to->frame = ent->v.frame;
+	to->colormap = ent->v.colormap;
+	to->skin = ent->v.skin;
+	to->effects = ent->v.effects;
+	to->step = (ent->v.movetype == MOVETYPE_STEP);
+}
+
+/*
+=============
+SV_DeltaBits
+
+Returns the update bits needed to turn from into to, or -1 if nothing changed
+=============
+*/
+static int SV_DeltaBits (entity_delta_t *from, entity_delta_t *to)
+{
+	int		i, bits;
+
+	bits = 0;
+
+	for (i=0 ; i<3 ; i++)
+		if (to->origin[i] != from->origin[i])
+			bits |= U_ORIGIN1<<i;
+
+	if (to->angles[0] != from->angles[0])
+		bits |= U_ANGLE1;
+	if (to->angles[1] != from->angles[1])
+		bits |= U_ANGLE2;
+	if (to->angles[2] != from->angles[2])
+		bits |= U_ANGLE3;
+
+	if (to->modelindex != from->modelindex)
+		bits |= U_MODEL;
+	if (to->frame != from->frame)
+		bits |= U_FRAME;
+	if (to->colormap != from->colormap)
+		bits |= U_COLORMAP;
+	if (to->skin != from->skin)
+		bits |= U_SKIN;
+	if (to->effects != from->effects)
+		bits |= U_EFFECTS;
+
+	if (!bits && to->step == from->step)
+		return -1;
+
+	if (to->step)
+		bits |= U_STEP;
+
+	return bits;
+}
+
+/*
+=============
+SV_WriteDeltaHeader
+=============
+*/
+static void SV_WriteDeltaHeader (sizebuf_t *msg, int e, int bits)
+{
+	if (e >= 256)
+		bits |= U_LONGENTITY;
+
+	if (bits >= 256)
+		bits |= U_MOREBITS;
+
+	MSG_WriteByte (msg, bits | U_SIGNAL);
+
+	if (bits & U_MOREBITS)
+		MSG_WriteByte (msg, bits>>8);
+	if (bits & U_LONGENTITY)
+		MSG_WriteShort (msg, e);
+	else
+		MSG_WriteByte (msg, e);
+}
+
+/*
+=============
+SV_WriteDeltaUpdate
+=============
+*/
+static void SV_WriteDeltaUpdate (sizebuf_t *msg, entity_delta_t *to, int bits)
+{
+	SV_WriteDeltaHeader (msg, to->number, bits);
+
+	if (bits & U_MODEL)
+		MSG_WriteByte (msg, to->modelindex);
+	if (bits & U_FRAME)
+		MSG_WriteByte (msg, to->frame);
+	if (bits & U_COLORMAP)
+		MSG_WriteByte (msg, to->colormap);
+	if (bits & U_SKIN)
+		MSG_WriteByte (msg, to->skin);
+	if (bits & U_EFFECTS)
+		MSG_WriteByte (msg, to->effects);
+	if (bits & U_ORIGIN1)
+		MSG_WriteShort (msg, to->origin[0]);
+	if (bits & U_ANGLE1)
+		MSG_WriteByte (msg, to->angles[0]);
+	if (bits & U_ORIGIN2)
+		MSG_WriteShort (msg, to->origin[1]);
+	if (bits & U_ANGLE2)
+		MSG_WriteByte (msg, to->angles[1]);
+	if (bits & U_ORIGIN3)
+		MSG_WriteShort (msg, to->origin[2]);
+	if (bits & U_ANGLE3)
+		MSG_WriteByte (msg, to->angles[2]);
+}
+
+/*
+=============
+SV_WriteDeltaEntities
+
+Writes the svc_deltapacket for the first count entries of sv_entcandidates
+and returns how many of them the client now has up to date
+=============
+*/
+static int SV_WriteDeltaEntities (client_t *client, sizebuf_t *msg, int count)
+{
+	int				i, e, bits, idx, removes, reserve, sent;
+	delta_frame_t	*frame, *base;
+	entity_delta_t	*to, *from, baseline;
+	edict_t			*ent;
+
+	client->delta_sequence++;
+	frame = &client->delta_frames[client->delta_sequence & UPDATE_MASK];
+	frame->sequence = client->delta_sequence;
+	frame->num_entities = 0;
+
+// find the frame the client acknowledged, if it is still in the ring
+	base = NULL;
+	if (client->delta_acked && client->delta_sequence - client->delta_acked < UPDATE_BACKUP)
+	{
+		base = &client->delta_frames[client->delta_acked & UPDATE_MASK];
+		if (base->sequence != client->delta_acked)
+			base = NULL;
+	}
+
+	removes = 0;
+	if (base)
+	{
+		for (i=0 ; i<base->num_entities ; i++)
+		{
+			sv_deltabase[base->entities[i].number] = i + 1;
+			sv_deltakept[i] = false;
+		}
+
+		removes = base->num_entities;
+		for (i=0 ; i<count ; i++)
+		{
+			if ((idx = sv_deltabase[sv_entcandidates[i].num]))
+			{
+				sv_deltakept[idx - 1] = true;
+				removes--;
+			}
+		}
+	}
+
+// entities that left the view must always be removed, so reserve room for
+// them up front; if even that doesn't fit send a complete frame instead
+	reserve = 9 + removes * 4 + 1;
+	if (base && msg->maxsize - msg->cursize < reserve + SV_MAXENTITYUPDATE)
+	{
+		for (i=0 ; i<base->num_entities ; i++)
+			sv_deltabase[base->entities[i].number] = 0;
+		base = NULL;
+		removes = 0;
+		reserve = 9 + 1;
+	}
+
+	MSG_WriteByte (msg, svc_deltapacket);
+	MSG_WriteLong (msg, frame->sequence);
+	MSG_WriteLong (msg, base ? base->sequence : 0);
+	reserve -= 9;
+
+	sent = 0;
+	for (i=0 ; i<count ; i++)
+	{
+		ent = sv_entcandidates[i].ent;
+		e = sv_entcandidates[i].num;
+		to = &frame->entities[frame->num_entities];
+
+		if (base && (idx = sv_deltabase[e]))
+			from = &base->entities[idx - 1];
+		else
+		{
+			SV_DeltaFromBaseline (ent, e, &baseline);
+			from = &baseline;
+			idx = 0;
+		}
+
+		SV_DeltaFromEdict (ent, e, to);
+		bits = SV_DeltaBits (from, to);
+
+		if (bits == -1 && idx)
+			;	// the client already has it
+		else if (msg->maxsize - msg->cursize - reserve < SV_MAXENTITYUPDATE)
+		{
+			// no room, the client keeps what it had
+			if (!idx)
+				continue;
+			*to = *from;
+			frame->num_entities++;
+			continue;
+		}
+		else
+			SV_WriteDeltaUpdate (msg, to, bits == -1 ? 0 : bits);
+
+		frame->num_entities++;
+		SV_MarkEntitySent (client, ent, e);
+
+		// the processed candidates are moved to the front so the caller can
+		// find the starved ones after sent
+		sv_entcandidates[i] = sv_entcandidates[sent];
+		sv_entcandidates[sent].ent = ent;
+		sv_entcandidates[sent].num = e;
+		sent++;
+	}
+
+	if (base)
+	{
+		for (i=0 ; i<base->num_entities ; i++)
+		{
+			if (!sv_deltakept[i])
+				SV_WriteDeltaHeader (msg, base->entities[i].number, U_REMOVE);
+			sv_deltabase[base->entities[i].number] = 0;
+		}
+	}
+
+	MSG_WriteByte (msg, 0);
+
+	return sent;
+}
+
+/*
+=============
+SV_WriteEntitiesToClient
+=============
+*/
+void SV_WriteEntitiesToClient (client_t *client, sizebuf_t *msg, qboolean nomap)
+{
+	int		e, i, count, limit, sent;
+	byte	*pvs;
+	vec3_t	org;
+	edict_t	*ent, *clent;
+	float	age;
+
+	clent = client->edict;
+
+// find the client's PVS
+	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
+	pvs = SV_FatPVS (org, sv.worldmodel);
+
+// collect all entities (excpet the client) that touch the pvs
+	count = 0;
+	ent = NEXT_EDICT(sv.edicts);
+	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
+	{
+
+		if (ent != clent)	// clent is ALWAYS sent
+		{
+// ignore ents without visible models
+			if (!ent->v.modelindex || !pr_strings[ent->v.model])
+				continue;
+
+// ignore if not touching a PV leaf
+			for (i=0 ; i < ent->num_leafs ; i++)
+				if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i]&7) ))
+					break;
+
+			if (i == ent->num_leafs)
+				continue;		// not visible
+#ifdef PROQUAKE_EXTENSION
+			// JPG 3.30 - don't send updates if the client doesn't have the map
+			if (nomap)
+				continue;
+
+			// Baker 3.99b: Slot Zero's user activated anti-lag mod capability
+	       if ((int)clent->v.flags & FL_LOW_BANDWIDTH_CLIENT && (int)ent->v.effects & EF_MAYBE_DRAW)
+	            continue;
+#endif
+
+#ifdef ANTIWALLHACK_SERVER
+// Baker theoretical sv_cullentities_trace
+
+			if (e<=svs.maxclients && sv_cullentities.value) {
+				if(SV_InvisibleToClient(clent, ent)) {
+					if (sv_cullentities_notify.value)
+						Con_Printf("Not visible\n");
+					continue;
+				} else {
+					if (sv_cullentities_notify.value)
+						Con_Printf("Visible\n");
+				}
+			}
+
+// End Baker theoretical
+#endif
+		}
+
+		sv_entcandidates[count].ent = ent;
+		sv_entcandidates[count].num = e;
+		if (ent == clent && count)
+		{
+			// keep the client in the first slot
+			sv_entcandidates[count] = sv_entcandidates[0];
+			sv_entcandidates[0].ent = ent;
+			sv_entcandidates[0].num = e;
+		}
+		count++;
+	}
+
+// a delta frame can only hold so many
+	limit = count;
+	if (client->delta_enabled && limit > MAX_DELTA_ENTITIES)
+		limit = MAX_DELTA_ENTITIES;
+
+// rank everything but the client itself if the whole set can't fit
+	if (sv_entpriority.value && count > 1 && (limit < count || count * SV_MAXENTITYUPDATE > msg->maxsize - msg->cursize))
+	{
+		for (i=0 ; i<count ; i++)
+			sv_entcandidates[i].priority = SV_EntityPriority (client, sv_entcandidates[i].ent, sv_entcandidates[i].num, org);
+
+		qsort (sv_entcandidates + 1, count - 1, sizeof(sv_entcandidates[0]), SV_EntityPriorityCompare);
+	}
+
+// send the updates
+	if (client->delta_enabled)
+		sent = SV_WriteDeltaEntities (client, msg, limit);
+	else
+	{
+		for (sent=0 ; sent<count ; sent++)
+		{
+			if (msg->maxsize - msg->cursize < SV_MAXENTITYUPDATE)
+				break;
+
+			e = sv_entcandidates[sent].num;
+			SV_WriteEntityUpdate (sv_entcandidates[sent].ent, e, msg);
+
+			SV_MarkEntitySent (client, sv_entcandidates[sent].ent, e);
+		}
 	}
 
-//	Con_Printf("%i entities sent\n", mycount);
+// track how badly the entities that didn't make it are being starved
+	client->ent_starved = count - sent;
+	client->ent_starvetime = 0;
+	if (sent < count)
+	{
+		Con_DPrintf ("packet overflow\n");
+		client->ent_overflows++;
+		for (i=sent ; i<count ; i++)
+		{
+			age = sv.time - client->ent_sent[sv_entcandidates[i].num].time;
+			if (age > client->ent_starvetime)
+				client->ent_starvetime = age;
+		}
+	}
 }
 
 /*
@@ -1169,24 +1647,178 @@ void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
 SV_SendClientDatagram
 =======================
 */
+/*
+=======================
+SV_ClientRate
+
+Bytes a second the client may be sent right now, 0 for no limit
+=======================
+*/
+int SV_ClientRate (client_t *client)
+{
+	int		rate;
+
+	rate = client->rate;
+	if (sv_maxrate.value > 0 && (!rate || rate > sv_maxrate.value))
+		rate = sv_maxrate.value;
+	if (client->rate_limit && (!rate || rate > client->rate_limit))
+		rate = client->rate_limit;
+	return rate;
+}
+
+/*
+=======================
+SV_RateSent
+
+Pushes back when the next datagram may go out, by what this one costs
+=======================
+*/
+void SV_RateSent (client_t *client, int bytes)
+{
+	int		rate;
+
+	if (!(rate = SV_ClientRate (client)))
+		return;
+	if (client->rate_nextsend < realtime)
+		client->rate_nextsend = realtime;
+	client->rate_nextsend += (bytes + NET_HEADERSIZE + 28) / (double)rate;	// 28 for UDP/IP
+}
+
+/*
+=======================
+SV_UpdateRate
+
+Once a second, adjusts the client's rate and datagram size to the loss
+seen on its connection: ACKs that had to be resent on the way out, and
+its own unreliable datagrams that went missing on the way in.  Backs off
+by a quarter when over 5% is lost, and creeps back when under 1% is.
+=======================
+*/
+void SV_UpdateRate (client_t *client)
+{
+	netstats_t	*now = &client->netconnection->stats;
+	netstats_t	*then = &client->rate_stats;
+	int			maxdatagram, cap, in, out, limit;
+	double		elapsed, loss;
+
+	maxdatagram = bound(256, QMIN(client->maxdatagram, (int)sv_maxdatagram.value), MAX_EXTDATAGRAM);
+	if (!client->netconnection->driver)
+	{
+		client->datagram_budget = maxdatagram;	// loopback never loses anything
+		return;
+	}
+
+	elapsed = realtime - client->rate_checktime;
+	if (elapsed < 1)
+	{
+		if (client->datagram_budget > maxdatagram)
+			client->datagram_budget = maxdatagram;
+		return;
+	}
+
+	in = (now->unreliableReceived - then->unreliableReceived) + (now->dropped - then->dropped);
+	out = now->packetsSent - then->packetsSent;
+	loss = in ? (now->dropped - then->dropped) / (double)in : 0;
+	if (out && (now->resent - then->resent) / (double)out > loss)
+		loss = (now->resent - then->resent) / (double)out;
+
+	cap = client->rate;
+	if (sv_maxrate.value > 0 && (!cap || cap > sv_maxrate.value))
+		cap = sv_maxrate.value;
+
+	if (loss > 0.05)
+	{
+		limit = client->rate_limit ? client->rate_limit : (now->bytesSent - then->bytesSent) / elapsed;
+		client->rate_limit = QMAX(limit * 3 / 4, SV_MINRATE);
+		// it may be fragments of big datagrams getting lost
+		if (client->datagram_budget > MAX_DATAGRAM)
+			client->datagram_budget = MAX_DATAGRAM;
+		Con_DPrintf ("%s: %.0f%% loss, rate %i\n", client->name, loss * 100, client->rate_limit);
+	}
+	else if (loss < 0.01)
+	{
+		if (client->rate_limit)
+		{
+			client->rate_limit += QMAX((cap ? cap : client->rate_limit) / 10, 500);
+			if ((cap && client->rate_limit >= cap) || (!cap && client->rate_limit > (now->bytesSent - then->bytesSent) / elapsed * 2))
+				client->rate_limit = 0;
+		}
+		client->datagram_budget += 64;
+	}
+	client->datagram_budget = bound(256, client->datagram_budget, maxdatagram);
+
+	client->rate_checktime = realtime;
+	*then = *now;
+}
+
+/*
+=======================
+SV_WriteMoveAck
+
+Tells a predicting client which of its moves the server has run, and
+where they left the player
+=======================
+*/
+void SV_WriteMoveAck (client_t *client, sizebuf_t *msg)
+{
+	edict_t	*ent = client->edict;
+	int		i, flags;
+
+	flags = 0;
+	if ((int)ent->v.flags & FL_ONGROUND)
+		flags |= MA_ONGROUND;
+	if ((int)ent->v.flags & FL_JUMPRELEASED)
+		flags |= MA_JUMPRELEASED;
+	if (ent->v.movetype != MOVETYPE_WALK || ent->v.waterlevel >= 2 || ((int)ent->v.flags & FL_WATERJUMP)
+		|| ent->v.health <= 0 || ent->v.fixangle)
+		flags |= MA_NOPREDICT;
+
+	MSG_WriteByte (msg, svc_moveack);
+	MSG_WriteLong (msg, client->move_sequence);
+	MSG_WriteByte (msg, flags);
+	for (i=0 ; i<3 ; i++)
+		MSG_WriteCoord (msg, ent->v.origin[i]);
+	for (i=0 ; i<3 ; i++)
+		MSG_WriteShort (msg, (int)ent->v.velocity[i]);
+}
+
+/*
+=======================
+SV_WriteMoveVars
+=======================
+*/
+void SV_WriteMoveVars (sizebuf_t *msg)
+{
+	MSG_WriteByte (msg, svc_movevars);
+	MSG_WriteFloat (msg, sv_gravity.value);
+	MSG_WriteFloat (msg, sv_friction.value);
+	MSG_WriteFloat (msg, sv_edgefriction.value);
+	MSG_WriteFloat (msg, sv_stopspeed.value);
+	MSG_WriteFloat (msg, sv_maxspeed.value);
+	MSG_WriteFloat (msg, sv_accelerate.value);
+}
+
 qboolean SV_SendClientDatagram (client_t *client)
 {
-	byte		buf[MAX_DATAGRAM];
+	byte		buf[MAX_EXTDATAGRAM];
 	sizebuf_t	msg;
 
 	msg.data = buf;
-	msg.maxsize = sizeof(buf);
+	msg.maxsize = client->datagram_budget;
 	msg.cursize = 0;
 
 	MSG_WriteByte (&msg, svc_time);
 	MSG_WriteFloat (&msg, sv.time);
 
+	if (client->predict_enabled)
+		SV_WriteMoveAck (client, &msg);
+
 // add the client specific data to the datagram
 	SV_WriteClientdataToMessage (client->edict, &msg);
 #ifdef PROQUAKE_EXTENSION
-	SV_WriteEntitiesToClient (client->edict, &msg, client->nomap);	// JPG 3.30 - added client->nomap
+	SV_WriteEntitiesToClient (client, &msg, client->nomap);	// JPG 3.30 - added client->nomap
 #else
-	SV_WriteEntitiesToClient (client->edict, &msg, 0);
+	SV_WriteEntitiesToClient (client, &msg, 0);
 #endif
 
 // copy the server datagram if there is space
@@ -1199,6 +1831,7 @@ qboolean SV_SendClientDatagram (client_t *client)
 		SV_DropClient (true);// if the message couldn't send, kick off
 		return false;
 	}
+	SV_RateSent (client, msg.cursize);
 
 	return true;
 }
@@ -1212,6 +1845,29 @@ void SV_UpdateToReliableMessages (void)
 {
 	int			i, j;
 	client_t *client;
+	static float	movevars[6];
+	float		current[6];
+
+// predicting clients need to know when the movement cvars change
+	current[0] = sv_gravity.value;
+	current[1] = sv_friction.value;
+	current[2] = sv_edgefriction.value;
+	current[3] = sv_stopspeed.value;
+	current[4] = sv_maxspeed.value;
+	current[5] = sv_accelerate.value;
+	if (memcmp (current, movevars, sizeof(movevars)))
+	{
+		memcpy (movevars, current, sizeof(movevars));
+		sv_movevarsgeneration++;
+	}
+
+	for (j=0, client = svs.clients ; j<svs.maxclients ; j++, client++)
+	{
+		if (!client->active || !client->predict_enabled || client->movevars_sent == sv_movevarsgeneration)
+			continue;
+		SV_WriteMoveVars (&client->message);
+		client->movevars_sent = sv_movevarsgeneration;
+	}
 
 // check for changes to be sent over the reliable streams
 	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
@@ -1286,7 +1942,9 @@ void SV_SendClientMessages (void)
 
 		if (host_client->spawned)
 		{
-			if (!SV_SendClientDatagram (host_client))
+			// skip the datagram while the client's rate is used up
+			SV_UpdateRate (host_client);
+			if (host_client->rate_nextsend <= realtime && !SV_SendClientDatagram (host_client))
 				continue;
 		}
 		else
@@ -1334,6 +1992,7 @@ void SV_SendClientMessages (void)
 			{
 				if (NET_SendMessage (host_client->netconnection, &host_client->message) == -1)
 					SV_DropClient (true);	// if the message couldn't send, kick off
+				SV_RateSent (host_client, host_client->message.cursize);
 				SZ_Clear (&host_client->message);
 				host_client->last_message = realtime;
 				host_client->sendsignon = false;
@@ -1557,6 +2216,8 @@ void SV_SpawnServer (char *server)
 	{
 		ent = EDICT_NUM(i+1);
 		svs.clients[i].edict = ent;
+		svs.clients[i].ent_sent = Hunk_AllocName (sv.max_edicts*sizeof(entsent_t), "entsent");
+		svs.clients[i].delta_frames = NULL;	// went with the old level's hunk
 	}
 
 	sv.state = ss_loading;
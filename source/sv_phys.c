@@ -1025,16 +1025,13 @@ void SV_WalkMove (edict_t *ent)
 
 /*
 ================
-SV_Physics_Client
+SV_Physics_ClientMove
 
 Player character actions
 ================
 */
-void SV_Physics_Client (edict_t	*ent, int num)
+static void SV_Physics_ClientMove (edict_t *ent)
 {
-	if ( ! svs.clients[num-1].active )
-		return;		// unconnected slot
-
 // call standard client pre-think
 	pr_global_struct->time = sv.time;
 	pr_global_struct->self = EDICT_TO_PROG(ent);
@@ -1090,6 +1087,24 @@ void SV_Physics_Client (edict_t	*ent, int num)
 	PR_ExecuteProgram (pr_global_struct->PlayerPostThink);
 }
 
+/*
+================
+SV_Physics_Client
+
+Traces its QC makes see the other players where this client saw them,
+see SV_MoveLagged
+================
+*/
+void SV_Physics_Client (edict_t	*ent, int num)
+{
+	if ( ! svs.clients[num-1].active )
+		return;		// unconnected slot
+
+	sv_lagclient = &svs.clients[num-1];
+	SV_Physics_ClientMove (ent);
+	sv_lagclient = NULL;
+}
+
 //============================================================================
 
 /*
@@ -1332,6 +1347,8 @@ void SV_Physics (void)
 		pr_global_struct->force_retouch--;
 
 	sv.time += host_frametime;
+
+	SV_RecordLagFrame ();
 }
 
 
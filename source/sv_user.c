@@ -120,7 +120,7 @@ SV_UserFriction
 */
 void SV_UserFriction (void)
 {
-	float	*vel, speed, newspeed, control, friction;
+	float	*vel, speed, friction;
 	vec3_t	start, stop;
 	trace_t	trace;
 
@@ -144,8 +144,26 @@ void SV_UserFriction (void)
 		friction = sv_friction.value;
 
 // apply friction
-	control = speed < sv_stopspeed.value ? sv_stopspeed.value : speed;
-	newspeed = speed - host_frametime*control*friction;
+	SV_ApplyFriction (vel, friction, sv_stopspeed.value, host_frametime);
+}
+
+/*
+==================
+SV_ApplyFriction
+
+Shared with the client's movement prediction
+==================
+*/
+void SV_ApplyFriction (vec3_t vel, float friction, float stopspeed, float frametime)
+{
+	float	speed, newspeed, control;
+
+	speed = sqrtf(vel[0]*vel[0] +vel[1]*vel[1]);
+	if (!speed)
+		return;
+
+	control = speed < stopspeed ? stopspeed : speed;
+	newspeed = speed - frametime*control*friction;
 
 	if (newspeed < 0)
 		newspeed = 0;
@@ -164,23 +182,47 @@ SV_Accelerate
 cvar_t	sv_maxspeed = {"sv_maxspeed", "320", false, true};
 cvar_t	sv_accelerate = {"sv_accelerate", "10"};
 void SV_Accelerate (void)
+{
+	SV_AccelerateVelocity (velocity, wishdir, wishspeed, sv_accelerate.value, host_frametime);
+}
+
+void SV_AirAccelerate (vec3_t wishveloc)
+{
+	SV_AirAccelerateVelocity (velocity, wishveloc, wishspeed, sv_accelerate.value, host_frametime);
+}
+
+/*
+==============
+SV_AccelerateVelocity
+
+Ground acceleration; shared with the client's movement prediction
+==============
+*/
+void SV_AccelerateVelocity (vec3_t vel, vec3_t dir, float speed, float accelerate, float frametime)
 {
 	int			i;
 	float		addspeed, accelspeed, currentspeed;
 
-	currentspeed = DotProduct (velocity, wishdir);
-	addspeed = wishspeed - currentspeed;
+	currentspeed = DotProduct (vel, dir);
+	addspeed = speed - currentspeed;
 	if (addspeed <= 0)
 		return;
-	accelspeed = sv_accelerate.value*host_frametime*wishspeed;
+	accelspeed = accelerate*frametime*speed;
 	if (accelspeed > addspeed)
 		accelspeed = addspeed;
 
 	for (i=0 ; i<3 ; i++)
-		velocity[i] += accelspeed*wishdir[i];
+		vel[i] += accelspeed*dir[i];
 }
 
-void SV_AirAccelerate (vec3_t wishveloc)
+/*
+==============
+SV_AirAccelerateVelocity
+
+Air control, capped at 30 units; shared with the client's movement prediction
+==============
+*/
+void SV_AirAccelerateVelocity (vec3_t vel, vec3_t wishveloc, float speed, float accelerate, float frametime)
 {
 	int			i;
 	float		addspeed, wishspd, accelspeed, currentspeed;
@@ -188,17 +230,17 @@ void SV_AirAccelerate (vec3_t wishveloc)
 	wishspd = VectorNormalize (wishveloc);
 	if (wishspd > 30)
 		wishspd = 30;
-	currentspeed = DotProduct (velocity, wishveloc);
+	currentspeed = DotProduct (vel, wishveloc);
 	addspeed = wishspd - currentspeed;
 	if (addspeed <= 0)
 		return;
 //	accelspeed = sv_accelerate.value * host_frametime;
-	accelspeed = sv_accelerate.value*wishspeed * host_frametime;
+	accelspeed = accelerate*speed * frametime;
 	if (accelspeed > addspeed)
 		accelspeed = addspeed;
 
 	for (i=0 ; i<3 ; i++)
-		velocity[i] += accelspeed*wishveloc[i];
+		vel[i] += accelspeed*wishveloc[i];
 }
 
 
@@ -438,7 +480,8 @@ void SV_ReadClientMove (usercmd_t *move)
 	vec3_t	angle;
 
 // read ping time
-	host_client->ping_times[host_client->num_pings%NUM_PING_TIMES]	= sv.time - MSG_ReadFloat ();
+	host_client->lag_time = MSG_ReadFloat ();
+	host_client->ping_times[host_client->num_pings%NUM_PING_TIMES]	= sv.time - host_client->lag_time;
 	host_client->num_pings++;
 
 // read current angles
@@ -506,7 +549,7 @@ Returns false if the client should be killed
 */
 qboolean SV_ReadClientMessage (void)
 {
-	int		ret, cmd;
+	int		ret, cmd, ack;
 	char		*s;
 
 	do {
@@ -584,6 +627,14 @@ nextmsg:
 					ret = 1;
 				else if (strncasecmp(s, "prespawn", 8) == 0)
 					ret = 1;
+				else if (strncasecmp(s, "deltaupdates", 12) == 0)
+					ret = 1;
+				else if (strncasecmp(s, "rate", 4) == 0 && (unsigned char)s[4] <= ' ')
+					ret = 1;
+				else if (strncasecmp(s, "predict", 7) == 0 && (unsigned char)s[7] <= ' ')
+					ret = 1;
+				else if (strncasecmp(s, "interpdelay", 11) == 0 && (unsigned char)s[11] <= ' ')
+					ret = 1;
 				else if (strncasecmp(s, "kick", 4) == 0)
 					ret = 1;
 				else if (strncasecmp(s, "ping", 4) == 0)
@@ -612,6 +663,16 @@ nextmsg:
 			case clc_move:
 				SV_ReadClientMove (&host_client->cmd);
 				break;
+
+			case clc_movesequence:
+				host_client->move_sequence = MSG_ReadLong ();
+				break;
+
+			case clc_deltaack:
+				ack = MSG_ReadLong ();
+				if (ack > host_client->delta_acked && ack >= host_client->delta_resetseq && ack <= host_client->delta_sequence)
+					host_client->delta_acked = ack;
+				break;
 			}
 		}
 	} while (ret == 1);
@@ -36,6 +36,7 @@ typedef struct {
 	trace_t		trace;
 	int			type;
 	edict_t		*passedict;
+	qboolean	lagged;			// players are clipped where they were, not in the links
 } moveclip_t;
 
 int SV_HullPointContents (hull_t *hull, int num, vec3_t p);
@@ -262,6 +263,8 @@ void SV_ClearWorld (void) {
 	memset (sv_areanodes, 0, sizeof(sv_areanodes));
 	sv_numareanodes = 0;
 	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+
+	SV_ResetLagFrames ();
 }
 
 void SV_UnlinkEdict (edict_t *ent)
@@ -861,6 +864,8 @@ void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 			continue;
 		if (touch == clip->passedict)
 			continue;
+		if (clip->lagged && touch >= EDICT_NUM(1) && touch <= EDICT_NUM(svs.maxclients))
+			continue;	// done by SV_ClipToLagged
 		if (touch->v.solid == SOLID_TRIGGER)
 			Sys_Error ("Trigger in clipping list");
 
@@ -966,3 +971,257 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 	return clip.trace;
 }
 
+/*
+===============================================================================
+
+LAG COMPENSATION
+
+Every server frame the players' positions go into a fixed ring.  While a
+client's own physics and think functions run, traces its QC makes with
+traceline start from where that client saw the other players: the server
+time of the newest update it had when it sent its move, less the delay it
+draws entities with (the interpdelay command), no further back than
+sv_lagcomp_max.  Players are moved only for the trace, never in the
+links, so nothing else sees them out of place.
+
+===============================================================================
+*/
+
+cvar_t	sv_lagcomp = {"sv_lagcomp", "1", false, true};		// rewind players for client hitscan traces
+cvar_t	sv_lagcomp_max = {"sv_lagcomp_max", "0.2", false, true};	// most seconds a trace is rewound
+
+#define	LAG_FRAMES		64			// must be a power of two
+
+typedef struct
+{
+	float		time;
+	int			present;			// bit per client that was solid
+	vec3_t		origin[MAX_SCOREBOARD];
+} lagframe_t;
+
+client_t		*sv_lagclient;		// whose think code is running, or NULL
+
+static	lagframe_t	sv_lagframes[LAG_FRAMES];
+static	int			sv_laghead;
+static	int			sv_lagcount;
+
+static	double		lag_recordtime, lag_tracetime;
+static	int			lag_records, lag_traces;
+
+/*
+================
+SV_ResetLagFrames
+================
+*/
+void SV_ResetLagFrames (void)
+{
+	sv_lagcount = 0;
+	sv_lagclient = NULL;
+}
+
+/*
+================
+SV_RecordLagFrame
+
+Called once a frame, after physics, at the time the coming datagrams show
+================
+*/
+void SV_RecordLagFrame (void)
+{
+	lagframe_t	*frame;
+	edict_t		*ent;
+	client_t	*client;
+	int			i;
+	double		start;
+
+	start = Sys_DoubleTime ();
+
+	sv_laghead = (sv_laghead + 1) & (LAG_FRAMES-1);
+	if (sv_lagcount < LAG_FRAMES)
+		sv_lagcount++;
+
+	frame = &sv_lagframes[sv_laghead];
+	frame->time = sv.time;
+	frame->present = 0;
+	for (i=0, client = svs.clients ; i<svs.maxclients ; i++, client++)
+	{
+		ent = client->edict;
+		VectorCopy (ent->v.origin, frame->origin[i]);
+		if (client->active && !ent->free && ent->v.solid != SOLID_NOT)
+			frame->present |= 1<<i;
+	}
+
+	lag_recordtime += Sys_DoubleTime () - start;
+	lag_records++;
+}
+
+/*
+================
+SV_LagPositions
+
+Where the players were at a server time, between the frames either side
+================
+*/
+static qboolean SV_LagPositions (float time, vec3_t *origins, int *present)
+{
+	lagframe_t	*newer, *older;
+	int			i, j;
+	float		f;
+
+	newer = &sv_lagframes[sv_laghead];
+	for (i=1 ; i<sv_lagcount ; i++)
+	{
+		older = &sv_lagframes[(sv_laghead - i) & (LAG_FRAMES-1)];
+		if (older->time <= time)
+		{
+			f = newer->time > older->time ? (time - older->time) / (newer->time - older->time) : 1;
+			*present = older->present & newer->present;
+			for (j=0 ; j<svs.maxclients ; j++)
+			{
+				origins[j][0] = older->origin[j][0] + f * (newer->origin[j][0] - older->origin[j][0]);
+				origins[j][1] = older->origin[j][1] + f * (newer->origin[j][1] - older->origin[j][1]);
+				origins[j][2] = older->origin[j][2] + f * (newer->origin[j][2] - older->origin[j][2]);
+			}
+			return true;
+		}
+		newer = older;
+	}
+
+	return false;
+}
+
+/*
+================
+SV_ClipToLagged
+
+SV_ClipToLinks for the players, at their old positions
+================
+*/
+static void SV_ClipToLagged (moveclip_t *clip, vec3_t *origins, int present)
+{
+	edict_t		*touch;
+	trace_t		trace;
+	vec3_t		saved;
+	int			i, j;
+
+	for (i=0 ; i<svs.maxclients ; i++)
+	{
+		if (!(present & (1<<i)))
+			continue;
+		touch = EDICT_NUM(i+1);
+		if (touch == clip->passedict || touch->free || touch->v.solid == SOLID_NOT || touch->v.solid == SOLID_TRIGGER)
+			continue;
+		if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
+			continue;
+
+		for (j=0 ; j<3 ; j++)
+			if (clip->boxmins[j] > origins[i][j] + touch->v.maxs[j] + 1 || clip->boxmaxs[j] < origins[i][j] + touch->v.mins[j] - 1)
+				break;
+		if (j < 3)
+			continue;
+
+		if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
+			continue;
+		if (clip->trace.allsolid)
+			return;
+		if (clip->passedict)
+		{
+			if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
+				continue;
+			if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
+				continue;
+		}
+
+		VectorCopy (touch->v.origin, saved);
+		VectorCopy (origins[i], touch->v.origin);
+		trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
+		VectorCopy (saved, touch->v.origin);
+
+		if (trace.allsolid || trace.startsolid || trace.fraction < clip->trace.fraction)
+		{
+			trace.ent = touch;
+			if (clip->trace.startsolid)
+			{
+				clip->trace = trace;
+				clip->trace.startsolid = true;
+			}
+			else
+				clip->trace = trace;
+		}
+		else if (trace.startsolid)
+			clip->trace.startsolid = true;
+	}
+}
+
+/*
+================
+SV_MoveLagged
+
+SV_Move for a trace made by the QC on a client's behalf; rewinds the other
+players if that client is the one the trace comes from
+================
+*/
+trace_t SV_MoveLagged (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
+{
+	moveclip_t	clip;
+	vec3_t		origins[MAX_SCOREBOARD];
+	int			present;
+	float		time;
+	double		starttime;
+
+	if (!sv_lagcomp.value || !sv_lagclient || passedict != sv_lagclient->edict || type == MOVE_NOMONSTERS)
+		return SV_Move (start, mins, maxs, end, type, passedict);
+
+	time = sv_lagclient->lag_time - sv_lagclient->interp_delay;
+	if (time < sv.time - sv_lagcomp_max.value)
+		time = sv.time - sv_lagcomp_max.value;
+	if (time >= sv_lagframes[sv_laghead].time)
+		return SV_Move (start, mins, maxs, end, type, passedict);	// nothing to rewind, as on loopback
+
+	starttime = Sys_DoubleTime ();
+	if (!SV_LagPositions (time, origins, &present))
+		return SV_Move (start, mins, maxs, end, type, passedict);
+
+	memset (&clip, 0, sizeof(clip));
+	clip.trace = SV_ClipMoveToEntity (sv.edicts, start, mins, maxs, end);
+	clip.start = start;
+	clip.end = end;
+	clip.mins = mins;
+	clip.maxs = maxs;
+	clip.type = type;
+	clip.passedict = passedict;
+	clip.lagged = true;
+	VectorCopy (mins, clip.mins2);
+	VectorCopy (maxs, clip.maxs2);
+	SV_MoveBounds (start, clip.mins2, clip.maxs2, end, clip.boxmins, clip.boxmaxs);
+
+	SV_ClipToLinks (sv_areanodes, &clip);
+	SV_ClipToLagged (&clip, origins, present);
+
+	lag_tracetime += Sys_DoubleTime () - starttime;
+	lag_traces++;
+
+	return clip.trace;
+}
+
+/*
+================
+SV_LagCompStats_f
+================
+*/
+void SV_LagCompStats_f (void)
+{
+	if (Cmd_Argc () > 1 && !strcmp (Cmd_Argv (1), "reset"))
+	{
+		lag_recordtime = lag_tracetime = 0;
+		lag_records = lag_traces = 0;
+		return;
+	}
+
+	Con_Printf ("history: %i frames of %i, %.1f seconds\n", sv_lagcount, LAG_FRAMES,
+		sv_lagcount ? sv_lagframes[sv_laghead].time - sv_lagframes[(sv_laghead - sv_lagcount + 1) & (LAG_FRAMES-1)].time : 0);
+	if (lag_records)
+		Con_Printf ("recording: %i frames, %.2f usec each for %i slots\n", lag_records, lag_recordtime * 1000000 / lag_records, svs.maxclients);
+	if (lag_traces)
+		Con_Printf ("rewound traces: %i, %.2f usec each\n", lag_traces, lag_tracetime * 1000000 / lag_traces);
+}
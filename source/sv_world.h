@@ -93,5 +93,9 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 
 // passedict is explicitly excluded from clipping checks (normally NULL)
 
+trace_t SV_MoveLagged (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict);
+// SV_Move for QC traces; while a client's think code runs, its own traces
+// see the other players where that client saw them
+
 
 
@@ -30,10 +30,20 @@ int Sys_FileOpenWrite (char *path);
 void Sys_FileClose (int handle);
 void Sys_FileSeek (int handle, int position);
 int Sys_FileRead (int handle, void *dest, int count);
+
+// background reads, done in the order they were queued (see sysread_t)
+struct sysread_s;
+void Sys_QueueRead (struct sysread_s *read);
+void Sys_WaitRead (struct sysread_s *read);
 int Sys_FileWrite (int handle, void *data, int count);
 int	Sys_FileTime (char *path);
 void Sys_mkdir (char *path);
 
+// directory listing; returns bare file names matching pattern, NULL when done
+char *Sys_FindFirstFile (char *path, char *pattern);
+char *Sys_FindNextFile (void);
+void Sys_FindClose (void);
+
 // memory protection
 void Sys_MakeCodeWriteable (unsigned long startaddr, unsigned long length);
 
@@ -30,24 +30,46 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	ZONEID	0x1d4a11
 #define MINFRAGMENT	64
 
+// free blocks are kept on one list per size class: a class for every
+// multiple of 8 below Z_SMALLSIZE, then one per power of two
+#define	Z_SMALLSIZE		256
+#define	Z_SMALLCLASSES	(Z_SMALLSIZE/8)
+#define	Z_CLASSES		64
+
 typedef struct memblock_s
 {
 	int		size;           // including the header and possibly tiny fragments
 	int     tag;            // a tag of 0 is a free block
 	int     id;        		// should be ZONEID
-	struct memblock_s       *next, *prev;
+	struct memblock_s       *next, *prev;	// neighbours in memory
 	int		pad;			// pad to 64 bit boundary
 } memblock_t;
 
+// a free block keeps its size class links where its data would go
+typedef struct
+{
+	memblock_t	*next, *prev;
+} freelink_t;
+
+#define	FREELINK(b)	((freelink_t *)((byte *)(b) + sizeof(memblock_t)))
+
 typedef struct
 {
 	int		size;		// total bytes malloced, including header
 	memblock_t	blocklist;		// start / end cap for linked list
-	memblock_t	*rover;
+	memblock_t	*freelists[Z_CLASSES];
+	unsigned	freemask[Z_CLASSES/32];	// bit set for each non-empty freelist
+
+	int		used, peak;	// bytes in allocated blocks, including headers
+	int		numblocks, peakblocks;
 } memzone_t;
 
+// the first block starts on an 8 byte boundary whatever the header's size
+#define	ZONEHEADER	((sizeof(memzone_t) + 7) & ~7)
+
 void Cache_FreeLow (int new_low_hunk);
 void Cache_FreeHigh (int new_high_hunk);
+static void Memory_CheckPeaks (void);
 
 void memcpy_vfpu( void* dst, void* src, unsigned int size )
 {
@@ -414,7 +436,8 @@ void *Q_strdup (const char *str)
 There is never any space between memblocks, and there will never be two
 contiguous free memblocks.
 
-The rover can be left pointing at a non-empty block
+Free blocks are found through the size class lists, not by walking the
+block list.
 
 The zone calls are pretty much only used for small strings and structures,
 all big things are allocated on the hunk.
@@ -423,6 +446,112 @@ all big things are allocated on the hunk.
 
 memzone_t	*mainzone;
 
+/*
+========================
+Z_SizeClass
+
+The list a free block of this size goes on
+========================
+*/
+static int Z_SizeClass (int size)
+{
+	int		c;
+
+	if (size < Z_SMALLSIZE)
+		return size >> 3;
+
+	for (c = Z_SMALLCLASSES ; size >= Z_SMALLSIZE*2 ; size >>= 1)
+		c++;
+	return c;
+}
+
+/*
+========================
+Z_FitClass
+
+The first list whose every block holds size bytes
+========================
+*/
+static int Z_FitClass (int size)
+{
+	int		c;
+
+	c = Z_SizeClass (size);
+	if (c >= Z_SMALLCLASSES && size != (Z_SMALLSIZE << (c - Z_SMALLCLASSES)))
+		c++;		// not a power of two, so the class also holds smaller blocks
+	return c;
+}
+
+/*
+========================
+Z_FirstClass
+
+The first non-empty list at or after class c, or -1
+========================
+*/
+static int Z_FirstClass (memzone_t *zone, int c)
+{
+	unsigned	bits;
+	int			word;
+
+	for (word = c >> 5 ; word < Z_CLASSES/32 ; word++)
+	{
+		bits = zone->freemask[word];
+		if (word == c >> 5)
+			bits &= ~0u << (c & 31);
+		if (!bits)
+			continue;
+
+		for (c = word << 5 ; !(bits & 1) ; bits >>= 1)
+			c++;
+		return c;
+	}
+
+	return -1;
+}
+
+/*
+========================
+Z_LinkFree
+========================
+*/
+static void Z_LinkFree (memzone_t *zone, memblock_t *block)
+{
+	int		c;
+
+	c = Z_SizeClass (block->size);
+	FREELINK(block)->prev = NULL;
+	FREELINK(block)->next = zone->freelists[c];
+	if (zone->freelists[c])
+		FREELINK(zone->freelists[c])->prev = block;
+	zone->freelists[c] = block;
+	zone->freemask[c >> 5] |= 1u << (c & 31);
+}
+
+/*
+========================
+Z_UnlinkFree
+========================
+*/
+static void Z_UnlinkFree (memzone_t *zone, memblock_t *block)
+{
+	freelink_t	*link;
+	int			c;
+
+	link = FREELINK(block);
+	if (link->prev)
+		FREELINK(link->prev)->next = link->next;
+	else
+	{
+		c = Z_SizeClass (block->size);
+		zone->freelists[c] = link->next;
+		if (!link->next)
+			zone->freemask[c >> 5] &= ~(1u << (c & 31));
+	}
+	if (link->next)
+		FREELINK(link->next)->prev = link->prev;
+}
+
 /*
 ========================
 Z_ClearZone
@@ -434,16 +563,19 @@ void Z_ClearZone (memzone_t *zone, int size)
 
 // set the entire zone to one free block
 
-	zone->blocklist.next = zone->blocklist.prev = block = (memblock_t *)( (byte *)zone + sizeof(memzone_t) );
+	memset (zone, 0, sizeof(memzone_t));
+	zone->size = size;
+
+	zone->blocklist.next = zone->blocklist.prev = block = (memblock_t *)( (byte *)zone + ZONEHEADER );
 	zone->blocklist.tag = 1;	// in use block
 	zone->blocklist.id = 0;
 	zone->blocklist.size = 0;
-	zone->rover = block;
 
 	block->prev = block->next = &zone->blocklist;
 	block->tag = 0;			// free block
 	block->id = ZONEID;
-	block->size = size - sizeof(memzone_t);
+	block->size = (size - ZONEHEADER) & ~7;
+	Z_LinkFree (zone, block);
 }
 
 
@@ -466,27 +598,29 @@ void Z_Free (void *ptr)
 		Sys_Error ("Z_Free: freed a freed pointer");
 
 	block->tag = 0;		// mark as free
+	mainzone->used -= block->size;
+	mainzone->numblocks--;
 
 	other = block->prev;
 	if (!other->tag)
 	{	// merge with previous free block
+		Z_UnlinkFree (mainzone, other);
 		other->size += block->size;
 		other->next = block->next;
 		other->next->prev = other;
-		if (block == mainzone->rover)
-			mainzone->rover = other;
 		block = other;
 	}
 
 	other = block->next;
 	if (!other->tag)
 	{	// merge the next free block onto the end
+		Z_UnlinkFree (mainzone, other);
 		block->size += other->size;
 		block->next = other->next;
 		block->next->prev = block;
-		if (other == mainzone->rover)
-			mainzone->rover = block;
 	}
+
+	Z_LinkFree (mainzone, block);
 }
 
 
@@ -499,7 +633,9 @@ void *Z_Malloc (int size)
 {
 	void	*buf;
 
-Z_CheckHeap ();	// DEBUG
+#ifdef PARANOID
+	Z_CheckHeap ();
+#endif
 	if (!(buf = Z_TagMalloc (size, 1)))
 		Sys_Error ("Z_Malloc: failed on allocation of %i bytes",size);
 	memset (buf, 0, size);
@@ -509,31 +645,32 @@ Z_CheckHeap ();	// DEBUG
 
 void *Z_TagMalloc (int size, int tag)
 {
-	int		extra;
-	memblock_t	*start, *rover, *new, *base;
+	int		extra, c;
+	memblock_t	*new, *base;
 
 	if (!tag)
 		Sys_Error ("Z_TagMalloc: tried to use a 0 tag");
 
-// scan through the block list looking for the first free block
-// of sufficient size
+	if (size < (int)sizeof(freelink_t))
+		size = sizeof(freelink_t);	// room for the links once it is freed
 	size += sizeof(memblock_t);	// account for size of block header
 	size += 4;					// space for memory trash tester
 	size = (size + 7) & ~7;		// align to 8-byte boundary
 
-	base = rover = mainzone->rover;
-	start = base->prev;
-
-	do {
-		if (rover == start)	// scaned all the way around the list
+// take the first block off the smallest list that is sure to fit
+	c = Z_FirstClass (mainzone, Z_FitClass (size));
+	if (c >= 0)
+		base = mainzone->freelists[c];
+	else
+	{	// the list below can still hold a block that is big enough
+		for (base = mainzone->freelists[Z_SizeClass (size)] ; base ; base = FREELINK(base)->next)
+			if (base->size >= size)
+				break;
+		if (!base)
 			return NULL;
-		if (rover->tag)
-			base = rover = rover->next;
-		else
-			rover = rover->next;
-	} while (base->tag || base->size < size);
+	}
+	Z_UnlinkFree (mainzone, base);
 
-// found a block big enough
 	extra = base->size - size;
 	if (extra >  MINFRAGMENT)
 	{	// there will be a free fragment after the allocated block
@@ -546,14 +683,20 @@ void *Z_TagMalloc (int size, int tag)
 		new->next->prev = new;
 		base->next = new;
 		base->size = size;
+		Z_LinkFree (mainzone, new);
 	}
 
 	base->tag = tag;				// no longer a free block
 
-	mainzone->rover = base->next;	// next allocation will start looking here
-
 	base->id = ZONEID;
 
+	mainzone->used += base->size;
+	if (mainzone->used > mainzone->peak)
+		mainzone->peak = mainzone->used;
+	if (++mainzone->numblocks > mainzone->peakblocks)
+		mainzone->peakblocks = mainzone->numblocks;
+	Memory_CheckPeaks ();
+
 // marker for memory trash testing
 	*(int *)((byte *)base + base->size - 4) = ZONEID;
 
@@ -596,9 +739,13 @@ Z_CheckHeap
 void Z_CheckHeap (void)
 {
 	memblock_t	*block;
+	int			c, numfree, listed;
 
+	numfree = 0;
 	for (block = mainzone->blocklist.next ; ; block = block->next)
 	{
+		if (!block->tag)
+			numfree++;
 		if (block->next == &mainzone->blocklist)
 			break;			// all blocks have been hit
 		if ( (byte *)block + block->size != (byte *)block->next)
@@ -608,6 +755,60 @@ void Z_CheckHeap (void)
 		if (!block->tag && !block->next->tag)
 			Sys_Error ("Z_CheckHeap: two consecutive free blocks\n");
 	}
+
+	listed = 0;
+	for (c=0 ; c<Z_CLASSES ; c++)
+	{
+		if (!mainzone->freelists[c] != !(mainzone->freemask[c >> 5] & (1u << (c & 31))))
+			Sys_Error ("Z_CheckHeap: free mask out of step with list %i\n", c);
+
+		for (block = mainzone->freelists[c] ; block ; block = FREELINK(block)->next)
+		{
+			if (block->tag || block->id != ZONEID)
+				Sys_Error ("Z_CheckHeap: used block on a free list\n");
+			if (Z_SizeClass (block->size) != c)
+				Sys_Error ("Z_CheckHeap: free block on the wrong list\n");
+			if (FREELINK(block)->next && FREELINK(FREELINK(block)->next)->prev != block)
+				Sys_Error ("Z_CheckHeap: free list doesn't have proper back link\n");
+			listed++;
+		}
+	}
+
+	if (listed != numfree)
+		Sys_Error ("Z_CheckHeap: %i free blocks, %i on free lists\n", numfree, listed);
+}
+
+/*
+========================
+Z_Report_f
+========================
+*/
+void Z_Report_f (void)
+{
+	memblock_t	*block;
+	int			freebytes, largest;
+
+	freebytes = largest = 0;
+	for (block = mainzone->blocklist.next ; block != &mainzone->blocklist ; block = block->next)
+	{
+		if (block->tag)
+			continue;
+		freebytes += block->size;
+		if (block->size > largest)
+			largest = block->size;
+	}
+
+	Con_Printf ("zone: %i KB, %i KB used in %i blocks, %i KB free\n",
+		mainzone->size >> 10, mainzone->used >> 10, mainzone->numblocks, freebytes >> 10);
+	Con_Printf ("peak: %i KB in %i blocks\n", mainzone->peak >> 10, mainzone->peakblocks);
+	Con_Printf ("largest free block %i KB, fragmentation %i%%\n",
+		largest >> 10, freebytes ? 100 - (int)(100.0 * largest / freebytes) : 0);
+
+	if (Cmd_Argc () > 1 && !strcmp (Cmd_Argv (1), "check"))
+	{
+		Z_CheckHeap ();
+		Con_Printf ("zone is consistent\n");
+	}
 }
 
 //============================================================================
@@ -630,8 +831,46 @@ int		hunk_high_used;
 qboolean	hunk_tempactive;
 int		hunk_tempmark;
 
+int		cache_used;			// bytes in cache blocks, including headers
+
+// high-water marks for the map being played, and the last few before it
+typedef struct
+{
+	char	name[MAX_QPATH];
+	int		peaklow, peakhigh;	// hunk marks
+	int		minfree;			// least hunk left between them
+	int		peakcache, peakzone;
+} mapmem_t;
+
+#define	MAX_MAPMEM	8
+
+static mapmem_t	mapmem_current;
+static mapmem_t	mapmem_history[MAX_MAPMEM];
+static int		mapmem_count;		// maps ever archived
+
 void R_FreeTextures (void);
 
+/*
+==============
+Memory_CheckPeaks
+==============
+*/
+static void Memory_CheckPeaks (void)
+{
+	mapmem_t	*m = &mapmem_current;
+
+	if (hunk_low_used > m->peaklow)
+		m->peaklow = hunk_low_used;
+	if (hunk_high_used > m->peakhigh)
+		m->peakhigh = hunk_high_used;
+	if (hunk_size - hunk_low_used - hunk_high_used < m->minfree)
+		m->minfree = hunk_size - hunk_low_used - hunk_high_used;
+	if (cache_used > m->peakcache)
+		m->peakcache = cache_used;
+	if (mainzone && mainzone->used > m->peakzone)
+		m->peakzone = mainzone->used;
+}
+
 /*
 ==============
 Hunk_Check
@@ -764,6 +1003,7 @@ void *Hunk_AllocName (int size, char *name)
 	hunk_low_used += size;
 
 	Cache_FreeLow (hunk_low_used);
+	Memory_CheckPeaks ();
 
 	memset (h, 0, size);
 
@@ -854,6 +1094,7 @@ void *Hunk_HighAllocName (int size, char *name)
 
 	hunk_high_used += size;
 	Cache_FreeHigh (hunk_high_used);
+	Memory_CheckPeaks ();
 
 	h = (hunk_t *)(hunk_base + hunk_size - hunk_high_used);
 
@@ -893,6 +1134,26 @@ void *Hunk_TempAlloc (int size)
 	return buf;
 }
 
+/*
+=================
+Hunk_TempSpace
+
+The biggest Hunk_TempAlloc that would succeed, counting the current temp
+block and everything in the cache, which it would push out
+=================
+*/
+int Hunk_TempSpace (void)
+{
+	int		free;
+
+	free = hunk_size - hunk_low_used - hunk_high_used;
+	if (hunk_tempactive)
+		free += hunk_high_used - hunk_tempmark;
+	free -= sizeof(hunk_t);
+
+	return free > 0 ? free & ~15 : 0;
+}
+
 /*
 ===============================================================================
 
@@ -908,12 +1169,40 @@ typedef struct cache_system_s
 	char					name[16];
 	struct cache_system_s	*prev, *next;
 	struct cache_system_s	*lru_prev, *lru_next;	// for LRU flushing
+	float					priority;	// GDSF value, lowest goes first
+	int						hits;		// frames it was used on, capped
+	int						lastframe;
 } cache_system_t;
 
 cache_system_t *Cache_TryAlloc (int size, qboolean nobottom);
 
 cache_system_t	cache_head;
 
+// Eviction is greedy-dual-size-frequency: an entry is worth
+// cache_clock + hits * cost / size, where cost is what it takes to load
+// it again (a fixed open and parse overhead plus its bytes).  Every
+// eviction raises cache_clock to the value of what was thrown out, so
+// entries that stop being used age out while a big model that is used
+// every frame isn't traded for a handful of small sounds.
+#define	CACHE_LOADCOST	16384		// per load overhead, in bytes of reading
+#define	CACHE_MAXHITS	32
+
+static float	cache_clock;
+
+// set when an allocation found enough free space, just not in one piece;
+// the compaction waits for Cache_CompactPending at the top of a frame
+static qboolean	cache_compactwanted;
+
+#define	MAX_CACHE_RELEASE	8
+
+static void		(*cache_release[MAX_CACHE_RELEASE]) (int size);
+static int		cache_numrelease;
+
+int		cache_hits, cache_misses;
+int		cache_evictions, cache_compactions;
+double	cache_evictbytes, cache_compactbytes;	// can pass 2GB in a long session
+int		cache_releases;
+
 /*
 ===========
 Cache_Move
@@ -930,8 +1219,12 @@ void Cache_Move ( cache_system_t *c)
 //		Con_Printf ("cache_move ok\n");
 
 		memcpy ( new+1, c+1, c->size - sizeof(cache_system_t) );
+		cache_used += new->size;
 		new->user = c->user;
 		memcpy (new->name, c->name, sizeof(new->name));
+		new->priority = c->priority;
+		new->hits = c->hits;
+		new->lastframe = c->lastframe;
 		Cache_Free (c->user);
 		new->user->data = (void *)(new+1);
 	}
@@ -1134,10 +1427,180 @@ void Cache_Report (void)
 /*
 ============
 Cache_Compact
+
+Slides every entry down against the low hunk so all the free cache
+space is in one piece at the top
 ============
 */
 void Cache_Compact (void)
 {
+	cache_system_t	*cs, *next, *new;
+	byte			*dest;
+
+	cache_compactwanted = false;
+	cache_compactions++;
+
+	dest = hunk_base + hunk_low_used;
+	for (cs = cache_head.next ; cs != &cache_head ; cs = next)
+	{
+		next = cs->next;
+		new = (cache_system_t *)dest;
+		dest += cs->size;
+
+		if (new == cs)
+			continue;
+
+	// the source is always above the destination, and nothing past
+	// the end of the new block has been read yet
+		memmove (new, cs, cs->size);
+		cache_compactbytes += new->size;
+
+		new->prev->next = new;
+		new->next->prev = new;
+		new->lru_prev->lru_next = new;
+		new->lru_next->lru_prev = new;
+		new->user->data = (void *)(new+1);
+	}
+}
+
+/*
+============
+Cache_CompactPending
+
+Does the compaction an earlier Cache_Alloc asked for.  Called where no
+one holds a raw pointer into the cache.
+============
+*/
+void Cache_CompactPending (void)
+{
+	if (cache_compactwanted)
+		Cache_Compact ();
+}
+
+/*
+============
+Cache_Compact_f
+============
+*/
+void Cache_Compact_f (void)
+{
+	Cache_Compact ();
+	Con_Printf ("%.0f KB moved in all\n", cache_compactbytes / 1024);
+}
+
+/*
+============
+Cache_AddRelease
+
+Registers a function that frees optional cache data when an allocation
+would otherwise have to evict something; it is given the bytes wanted
+============
+*/
+void Cache_AddRelease (void (*release) (int size))
+{
+	if (cache_numrelease == MAX_CACHE_RELEASE)
+		Sys_Error ("Cache_AddRelease: too many functions");
+	cache_release[cache_numrelease++] = release;
+}
+
+/*
+============
+Cache_FreeSpace
+
+Cache bytes free between the hunk marks, whether or not they are in one piece
+============
+*/
+static int Cache_FreeSpace (void)
+{
+	return hunk_size - hunk_low_used - hunk_high_used - cache_used;
+}
+
+/*
+============
+Cache_Span
+
+Bytes that would be free if the entries from first up to (not including)
+end were thrown out
+============
+*/
+static int Cache_Span (cache_system_t *first, cache_system_t *end)
+{
+	byte	*bottom, *top;
+
+	if (first->prev == &cache_head)
+		bottom = hunk_base + hunk_low_used;
+	else
+		bottom = (byte *)first->prev + first->prev->size;
+
+	if (end == &cache_head)
+		top = hunk_base + hunk_size - hunk_high_used;
+	else
+		top = (byte *)end;
+
+	return top - bottom;
+}
+
+/*
+============
+Cache_Evict
+
+Throws out the run of neighbouring entries with the least total value
+that leaves a hole of at least size bytes.  Each entry counts what it is
+worth above cache_clock, so a window isn't charged the clock once per
+entry and a few big entries don't beat many small ones just by number.
+============
+*/
+static qboolean Cache_Evict (int size)
+{
+	cache_system_t	*first, *end, *best, *bestend, *next;
+	float			value, bestvalue, maxvalue;
+
+	best = bestend = NULL;
+	bestvalue = 0;
+	value = 0;
+
+	end = cache_head.next;
+	for (first = cache_head.next ; first != &cache_head ; first = first->next)
+	{
+	// no single gap is big enough or Cache_TryAlloc would have used it,
+	// so a window always takes in at least its first entry
+		while (end != &cache_head && Cache_Span (first, end) < size)
+		{
+			value += end->priority - cache_clock;
+			end = end->next;
+		}
+		if (Cache_Span (first, end) < size)
+			break;		// nothing further up can be big enough either
+
+		if (!best || value < bestvalue)
+		{
+			best = first;
+			bestend = end;
+			bestvalue = value;
+		}
+
+		if (end == first)
+			end = first->next;
+		else
+			value -= first->priority - cache_clock;
+	}
+
+	if (!best)
+		return false;
+
+	maxvalue = cache_clock;
+	for (first = best ; first != bestend ; first = next)
+	{
+		next = first->next;
+		if (first->priority > maxvalue)
+			maxvalue = first->priority;
+		cache_evictions++;
+		cache_evictbytes += first->size;
+		Cache_Free (first->user);
+	}
+	cache_clock = maxvalue;
+
+	return true;
 }
 
 /*
@@ -1151,6 +1614,7 @@ void Cache_Init (void)
 	cache_head.lru_next = cache_head.lru_prev = &cache_head;
 
 	Cmd_AddCommand ("flush", Cache_Flush_f);
+	Cmd_AddCommand ("cache_compact", Cache_Compact_f);
 }
 
 /*
@@ -1168,6 +1632,7 @@ void Cache_Free (cache_user_t *c)
 		Sys_Error ("Cache_Free: not allocated");
 
 	cs = ((cache_system_t *)c->data) - 1;
+	cache_used -= cs->size;
 
 	cs->prev->next = cs->next;
 	cs->next->prev = cs->prev;
@@ -1188,25 +1653,45 @@ void *Cache_Check (cache_user_t *c)
 	cache_system_t	*cs;
 
 	if (!c->data)
+	{
+		cache_misses++;
 		return NULL;
+	}
 
+	cache_hits++;
 	cs = ((cache_system_t *)c->data) - 1;
 
 // move to head of LRU
 	Cache_UnlinkLRU (cs);
 	Cache_MakeLRU (cs);
 
+// count each frame it is used on once
+	if (cs->lastframe != host_framecount)
+	{
+		cs->lastframe = host_framecount;
+		if (cs->hits < CACHE_MAXHITS)
+			cs->hits++;
+	}
+	cs->priority = cache_clock + cs->hits * (float)(cs->size + CACHE_LOADCOST) / cs->size;
+
 	return c->data;
 }
 
 /*
 ==============
 Cache_Alloc
+
+Never moves other entries: a caller may hold a pointer from Cache_Check
+or Mod_Extradata across it, and only eviction can take that away.  When
+the space is there but fragmented this evicts anyway and leaves the
+compaction to Cache_CompactPending, which must only run where no raw
+cache pointers are live.
 ==============
 */
 void *Cache_Alloc (cache_user_t *c, int size, char *name)
 {
 	cache_system_t	*cs;
+	int				i;
 
 	if (c->data)
 		Sys_Error ("Cache_Alloc: already allocated");
@@ -1217,24 +1702,268 @@ void *Cache_Alloc (cache_user_t *c, int size, char *name)
 	size = (size + sizeof(cache_system_t) + 15) & ~15;
 
 // find memory for it
-	while (1)
+	cs = Cache_TryAlloc (size, false);
+
+// there is room, just not in one piece
+	if (!cs && Cache_FreeSpace () >= size)
+		cache_compactwanted = true;
+
+// let the subsystems drop what they can live without
+	if (!cs && cache_numrelease)
 	{
-		if ((cs = Cache_TryAlloc (size, false)))
+		cache_releases++;
+		for (i=0 ; i<cache_numrelease ; i++)
+			cache_release[i] (size);
+
+		cs = Cache_TryAlloc (size, false);
+		if (!cs && Cache_FreeSpace () >= size)
+			cache_compactwanted = true;
+	}
+
+// throw out the cheapest run of entries that makes room
+	while (!cs)
+	{
+		if (!Cache_Evict (size))
+			Sys_Error ("Cache_Alloc: out of memory"); // not enough memory at all
+		cs = Cache_TryAlloc (size, false);
+	}
+
+	strncpy (cs->name, name, sizeof(cs->name)-1);
+	c->data = (void *)(cs+1);
+	cs->user = c;
+	cache_used += cs->size;
+	Memory_CheckPeaks ();
+
+	Cache_Check (c);
+	cache_hits--;		// the caller already counted its miss
+
+	return c->data;
+}
+
+/*
+===============================================================================
+
+MEMORY STATS
+
+===============================================================================
+*/
+
+#define	MAX_MEMTAGS		64
+
+typedef struct
+{
+	char	name[9];
+	int		bytes, count;
+	qboolean	high;
+} memtag_t;
+
+static qboolean	memstats_csv;
+
+/*
+============
+Memory_Stat
+
+One line of memstats; "section,name,value" when asked for csv, so it
+can be pulled out of a condump or -condebug log
+============
+*/
+static void Memory_Stat (char *section, char *name, int value, qboolean bytes)
+{
+	if (memstats_csv)
+		Con_Printf ("%s,%s,%i\n", section, name, value);
+	else if (bytes)
+		Con_Printf ("%-7s %-18s %7i KB\n", section, name, (value + 512) >> 10);
+	else
+		Con_Printf ("%-7s %-18s %7i\n", section, name, value);
+}
+
+/*
+============
+Memory_HunkTags
+
+Totals hunk blocks by name, wherever they are in the hunk
+============
+*/
+static int Memory_HunkTags (memtag_t *tags)
+{
+	hunk_t	*h, *end;
+	int		i, numtags, high;
+
+	numtags = 0;
+	for (high=0 ; high<2 ; high++)
+	{
+		if (high)
 		{
-			strncpy (cs->name, name, sizeof(cs->name)-1);
-			c->data = (void *)(cs+1);
-			cs->user = c;
-			break;
+			h = (hunk_t *)(hunk_base + hunk_size - hunk_high_used);
+			end = (hunk_t *)(hunk_base + hunk_size);
+		}
+		else
+		{
+			h = (hunk_t *)hunk_base;
+			end = (hunk_t *)(hunk_base + hunk_low_used);
 		}
 
-	// free the least recently used cahedat
-		if (cache_head.lru_prev == &cache_head)
-			Sys_Error ("Cache_Alloc: out of memory"); // not enough memory at all
+		for ( ; h < end ; h = (hunk_t *)((byte *)h + h->size))
+		{
+			if (h->sentinal != HUNK_SENTINAL || h->size < 16)
+				Sys_Error ("Memory_HunkTags: trashed hunk");
+
+			for (i=0 ; i<numtags ; i++)
+				if (tags[i].high == high && !strncmp (tags[i].name, h->name, 8))
+					break;
+			if (i == numtags)
+			{
+				if (numtags == MAX_MEMTAGS)
+					i--;		// lump the rest into the last one
+				else
+				{
+					memset (&tags[i], 0, sizeof(tags[i]));
+					memcpy (tags[i].name, h->name, 8);
+					tags[i].high = high;
+					numtags++;
+				}
+			}
+			tags[i].bytes += h->size;
+			tags[i].count++;
+		}
+	}
+
+	return numtags;
+}
+
+/*
+============
+Memory_Stats_f
+
+memstats [csv]
+Everything the engine allocates from, on one screen
+============
+*/
+void Memory_Stats_f (void)
+{
+	memtag_t		tags[MAX_MEMTAGS];
+	memblock_t		*block;
+	cache_system_t	*cs;
+	mapmem_t		*m;
+	edict_t			*ed;
+	char			name[32];
+	int				i, numtags, count, bytes, largest;
+	int				vramsize, vramused, vrampeak;
+
+	memstats_csv = (Cmd_Argc () > 1 && !strcmp (Cmd_Argv (1), "csv"));
+
+// hunk
+	Memory_Stat ("hunk", "size", hunk_size, true);
+	Memory_Stat ("hunk", "low", hunk_low_used, true);
+	Memory_Stat ("hunk", "high", hunk_high_used, true);
+	Memory_Stat ("hunk", "free", hunk_size - hunk_low_used - hunk_high_used - cache_used, true);
+	numtags = Memory_HunkTags (tags);
+	for (i=0 ; i<numtags ; i++)
+	{
+		snprintf (name, sizeof(name), "%s:%s", tags[i].high ? "high" : "low", tags[i].name);
+		Memory_Stat ("hunk", name, tags[i].bytes, true);
+	}
+
+// zone
+	bytes = largest = 0;
+	for (block = mainzone->blocklist.next ; block != &mainzone->blocklist ; block = block->next)
+	{
+		if (block->tag)
+			continue;
+		bytes += block->size;
+		if (block->size > largest)
+			largest = block->size;
+	}
+	Memory_Stat ("zone", "size", mainzone->size, true);
+	Memory_Stat ("zone", "used", mainzone->used, true);
+	Memory_Stat ("zone", "peak", mainzone->peak, true);
+	Memory_Stat ("zone", "blocks", mainzone->numblocks, false);
+	Memory_Stat ("zone", "largest_free", largest, true);
+
+// cache, oldest first
+	count = 0;
+	for (cs = cache_head.lru_prev ; cs != &cache_head ; cs = cs->lru_prev)
+		count++;
+	Memory_Stat ("cache", "used", cache_used, true);
+	Memory_Stat ("cache", "entries", count, false);
+	Memory_Stat ("cache", "hits", cache_hits, false);
+	Memory_Stat ("cache", "misses", cache_misses, false);
+	Memory_Stat ("cache", "evictions", cache_evictions, false);
+	Memory_Stat ("cache", "evicted_kb", (int)(cache_evictbytes / 1024), false);
+	Memory_Stat ("cache", "compactions", cache_compactions, false);
+	Memory_Stat ("cache", "compacted_kb", (int)(cache_compactbytes / 1024), false);
+	Memory_Stat ("cache", "releases", cache_releases, false);
+	if (cache_head.lru_prev != &cache_head)
+	{
+		snprintf (name, sizeof(name), "oldest:%s", cache_head.lru_prev->name);
+		Memory_Stat ("cache", name, cache_head.lru_prev->size, true);
+	}
+
+// edicts
+	if (sv.active)
+	{
+		count = 0;
+		for (i=0 ; i<sv.num_edicts ; i++)
+		{
+			ed = EDICT_NUM(i);
+			if (!ed->free)
+				count++;
+		}
+		Memory_Stat ("edicts", "max", sv.max_edicts, false);
+		Memory_Stat ("edicts", "allocated", sv.num_edicts, false);
+		Memory_Stat ("edicts", "in_use", count, false);
+		Memory_Stat ("edicts", "edict_size", pr_edict_size, false);
+		Memory_Stat ("edicts", "bytes", sv.max_edicts * pr_edict_size, true);
+	}
+
+// vram
+	VRAM_Stats (&vramsize, &vramused, &vrampeak);
+	Memory_Stat ("vram", "size", vramsize, true);
+	Memory_Stat ("vram", "used", vramused, true);
+	Memory_Stat ("vram", "peak", vrampeak, true);
 
-		Cache_Free ( cache_head.lru_prev->user );
+// per map high-water marks, current map last
+	count = mapmem_count < MAX_MAPMEM ? mapmem_count : MAX_MAPMEM;
+	for (i=count ; i>=0 ; i--)
+	{
+		m = i ? &mapmem_history[(mapmem_count - i) % MAX_MAPMEM] : &mapmem_current;
+		snprintf (name, sizeof(name), "%s", m->name[0] ? m->name : "(none)");
+		if (memstats_csv)
+			Con_Printf ("map,%s,%i,%i,%i,%i,%i\n", name, m->peaklow, m->peakhigh, m->minfree, m->peakcache, m->peakzone);
+		else
+			Con_Printf ("map     %-18s low %i KB, high %i KB, min free %i KB, cache %i KB, zone %i KB\n", name,
+				m->peaklow >> 10, m->peakhigh >> 10, m->minfree >> 10, m->peakcache >> 10, m->peakzone >> 10);
 	}
+}
+
+/*
+============
+Memory_NameMap
 
-	return Cache_Check (c);
+Names the high-water marks being gathered since the last Memory_ClearMap
+============
+*/
+void Memory_NameMap (char *name)
+{
+	strncpy (mapmem_current.name, name, sizeof(mapmem_current.name) - 1);
+}
+
+/*
+============
+Memory_ClearMap
+
+Called when the level memory is released; keeps the last map's marks
+and starts over from what is still allocated
+============
+*/
+void Memory_ClearMap (void)
+{
+	if (mapmem_current.name[0])
+		mapmem_history[mapmem_count++ % MAX_MAPMEM] = mapmem_current;
+
+	memset (&mapmem_current, 0, sizeof(mapmem_current));
+	mapmem_current.minfree = hunk_size;
+	Memory_CheckPeaks ();
 }
 
 //============================================================================
@@ -1261,4 +1990,9 @@ void Memory_Init (void *buf, int size)
 	Z_ClearZone (mainzone, zonesize);
 
 	Cmd_AddCommand ("hunk_print", Hunk_Print_f); //johnfitz
+	Cmd_AddCommand ("zone_report", Z_Report_f);
+	Cmd_AddCommand ("memstats", Memory_Stats_f);
+
+	mapmem_current.minfree = hunk_size;
+	Memory_CheckPeaks ();
 }
@@ -110,6 +110,7 @@ int	Hunk_HighMark (void);
 void Hunk_FreeToHighMark (int mark);
 
 void *Hunk_TempAlloc (int size);
+int Hunk_TempSpace (void);
 
 void Hunk_Check (void);
 
@@ -130,11 +131,25 @@ void *Cache_Alloc (cache_user_t *c, int size, char *name);
 // Returns NULL if all purgable data was tossed and there still
 // wasn't enough room.
 
+void Cache_Compact (void);
+// moves everything down so the free space is contiguous; the data
+// pointers of the users are updated
+
+void Cache_CompactPending (void);
+// compacts if an allocation found the free space fragmented; only call
+// where no raw pointers into the cache are held
+
+void Cache_AddRelease (void (*release) (int size));
+// release is called to free optional entries before anything is evicted
+
 void Cache_Report (void);
 
 void Hunk_Print_f (void);
 void Hunk_Print (qboolean all);
 
+void Memory_NameMap (char *name);
+void Memory_ClearMap (void);
+
 void memcpy_vfpu(void* dst, void* src, unsigned int size);
 
 u32* sceKernelMemcpy(void *dst, const void *src, unsigned int size);